@@ -0,0 +1,35 @@
+#!/bin/sh
+# bench.sh - build and run the rtlim benchmarks.
+# Output (CSV) goes to stdout; pass a tag (e.g. a version) as $1.
+
+TAG=${1:-dev}
+
+gcc -Wall -O2 -pthread -o bench_take bench_take.c bench_util.c rtlim.c rtlim_tk.c rtlim_refill.c rtlim_rate.c -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./bench_take -t "$TAG"
+
+gcc -Wall -O2 -o bench_pace bench_pace.c bench_util.c rtlim.c -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./bench_pace -t "$TAG"
+
+gcc -Wall -O2 -o bench_wait bench_wait.c bench_util.c rtlim.c -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./bench_wait -t "$TAG"
+
+gcc -Wall -O2 -pthread -o bench_mt bench_mt.c bench_util.c rtlim.c rtlim_pcpu.c -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./bench_mt -t "$TAG"
+
+gcc -Wall -O2 -pthread -o udp_loss udp_loss.c bench_util.c rtlim.c -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./udp_loss -t "$TAG"
+
+gcc -Wall -O2 -o bench_gen bench_gen.c rtlim_gen.c bench_util.c rtlim.c -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./bench_gen -t "$TAG"
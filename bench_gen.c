@@ -0,0 +1,210 @@
+/* bench_gen.c - Throughput and precision of the rtlim_gen traffic generator.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Two kinds of case, one line of CSV each:
+ *   - "fill": cost of computing release times in bulk (rtlim_gen_fill())
+ *     for each arrival process, on a virtual clock so no time is spent
+ *     waiting. Reported as ns per event and events per second.
+ *   - "pace": rtlim_gen_next() releasing evenly spaced events in real
+ *     time, at several rates and in each blocking mode. Reports the
+ *     achieved rate and the lateness of each release (clock reading after
+ *     the wait, minus the scheduled time).
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rtlim.h"
+#include "rtlim_gen.h"
+#include "bench_util.h"
+
+
+/* Command-line options. */
+static int o_cpu = 0;
+static int o_duration_ms = 1000;
+static int o_fill_events = 10000000;
+static char *o_tag = "dev";
+
+
+char *usage_str = "Usage: bench_gen [-h] [-c cpu] [-d duration_ms] [-f fill_events] [-t tag]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -c cpu : CPU to pin to (-1 = no pinning) [%d]\n"
+      "  -d duration_ms : run time per pace case [%d]\n"
+      "  -f fill_events : events per fill case [%d]\n"
+      "  -t tag : label written to every output line (e.g. a version) [%s]\n"
+      , o_cpu, o_duration_ms, o_fill_events, o_tag);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hc:d:f:t:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'c': o_cpu = atoi(optarg); break;
+      case 'd': o_duration_ms = atoi(optarg); break;
+      case 'f': o_fill_events = atoi(optarg); break;
+      case 't': o_tag = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_duration_ms < 1) usage("duration must be > 0");
+  if (o_fill_events < RTLIM_GEN_BATCH) usage("fill_events too small");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+void print_header()
+{
+  printf("tag,bench,process,block,rate,events,ns_per_event,events_per_sec,"
+    "achieved_rate,late_p50,late_p99,late_max\n");
+}  /* print_header */
+
+
+/* Bulk release-time computation, in batches as rtlim_gen_next() does. */
+void run_fill(char *process, int spacing, rtlim_gen_seg_t *segs, int num_segs)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  rtlim_gen_t *gen;
+  unsigned long long batch[RTLIM_GEN_BATCH];
+  unsigned long long start_ns, end_ns, sum = 0;
+  int events = 0;
+
+  vclock.now_ns = 0;
+  rl = rtlim_create(1000, 1);
+  (void)rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock);
+  gen = rtlim_gen_create(rl, spacing, segs, num_segs, 1, 1);
+  NULLCHK(gen);
+
+  start_ns = current_time_ns();
+  while (events < o_fill_events) {
+    events += rtlim_gen_fill(gen, batch, RTLIM_GEN_BATCH);
+    sum += batch[RTLIM_GEN_BATCH - 1];
+  }
+  end_ns = current_time_ns();
+  if (sum == 1) printf("\n");  /* Keep the work. */
+
+  printf("%s,fill,%s,-,%.0f,%d,%.2f,%.0f,,,,\n", o_tag, process,
+    segs[0].start_rate, events, (double)(end_ns - start_ns) / events,
+    events * 1e9 / (end_ns - start_ns));
+  fflush(stdout);
+
+  rtlim_gen_delete(gen);
+  rtlim_delete(rl);
+}  /* run_fill */
+
+
+/* Real-time release of evenly spaced events. */
+void run_pace(double rate, int block)
+{
+  rtlim_t *rl;
+  rtlim_gen_t *gen;
+  rtlim_gen_seg_t seg;
+  bench_stats_t late_stats;
+  double *late_ns;
+  unsigned long long release_ns, first_ns = 0, last_ns = 0, end_ns;
+  int max_events, events = 0;
+
+  max_events = (int)(rate * o_duration_ms / 1000.0) + 1;
+  late_ns = (double *)malloc(max_events * sizeof(double));
+  NULLCHK(late_ns);
+
+  seg.start_rate = seg.end_rate = rate;
+  seg.duration_ns = 0;
+  rl = rtlim_create(1000, 1);
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, &seg, 1, 0, 0);
+  NULLCHK(gen);
+
+  end_ns = rtlim_now(rl) + (unsigned long long)o_duration_ms * 1000000;
+  while (events < max_events) {
+    (void)rtlim_gen_next(gen, block, &release_ns);
+    last_ns = rtlim_now(rl);
+    if (events == 0) first_ns = last_ns;
+    late_ns[events++] = (double)(last_ns - release_ns);
+    if (last_ns >= end_ns) break;
+  }
+
+  bench_stats_calc(&late_stats, late_ns, events);
+  printf("%s,pace,even,%s,%.0f,%d,,,%.1f,%.0f,%.0f,%.0f\n", o_tag,
+    (block == RTLIM_BLOCK_SPIN) ? "spin" : "sleep", rate, events,
+    (last_ns > first_ns) ? (events - 1) * 1e9 / (last_ns - first_ns) : 0.0,
+    late_stats.p50, late_stats.p99, late_stats.max);
+  fflush(stdout);
+
+  rtlim_gen_delete(gen);
+  rtlim_delete(rl);
+  free(late_ns);
+}  /* run_pace */
+
+
+int main(int argc, char **argv)
+{
+  static double rates[] = { 10000.0, 100000.0, 1000000.0 };
+  rtlim_gen_seg_t constant[1] = { { 10000000.0, 10000000.0, 1000000000 } };
+  rtlim_gen_seg_t onoff[2] = {
+    { 20000000.0, 20000000.0, 500000 }, { 0.0, 0.0, 500000 } };
+  rtlim_gen_seg_t ramp[2] = {
+    { 1000000.0, 19000000.0, 1000000 }, { 19000000.0, 1000000.0, 1000000 } };
+  rtlim_gen_seg_t steps[3] = {
+    { 5000000.0, 5000000.0, 1000000 }, { 10000000.0, 10000000.0, 1000000 },
+    { 15000000.0, 15000000.0, 1000000 } };
+  int r;
+
+  get_my_opts(argc, argv);
+
+  if (bench_pin_cpu(o_cpu) != 0) {
+    fprintf(stderr, "Warning, could not pin to CPU %d\n", o_cpu);
+  }
+
+  print_header();
+
+  run_fill("even", RTLIM_GEN_EVEN, constant, 1);
+  run_fill("poisson", RTLIM_GEN_POISSON, constant, 1);
+  run_fill("onoff", RTLIM_GEN_EVEN, onoff, 2);
+  run_fill("ramp", RTLIM_GEN_EVEN, ramp, 2);
+  run_fill("ramp_poisson", RTLIM_GEN_POISSON, ramp, 2);
+  run_fill("steps", RTLIM_GEN_EVEN, steps, 3);
+
+  for (r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+    run_pace(rates[r], RTLIM_BLOCK_SPIN);
+    run_pace(rates[r], RTLIM_BLOCK_SLEEP);
+  }
+
+  return 0;
+}  /* main */
@@ -0,0 +1,380 @@
+/* bench_mt.c - Multi-threaded contention benchmark for a shared rtlim.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Runs 1 to N threads, each pinned to its own CPU (round robin), all
+ * taking single tokens from one shared limiter as fast as they can. The
+ * limiter is configured so that it never runs dry; what is measured is
+ * the cost of sharing it. Since rtlim is not thread-safe, each "sharing"
+ * variant wraps rtlim_take() in a different lock, except "pcpu", which
+ * uses the per-CPU sharded limiter (rtlim_pcpu.c) instead.
+ *
+ * Hardware counters are collected per thread with perf_event_open(),
+ * counting user space only so that it works unprivileged at the default
+ * perf_event_paranoid setting. Counters that can't be opened (e.g. in a
+ * VM without a virtual PMU, or paranoid > 2) are reported as -1.
+ * Cache-line transfers are approximated by L1D read misses: every time the
+ * limiter's line (or the lock's) moves to another core, the next access
+ * there misses L1.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "rtlim.h"
+#include "rtlim_pcpu.h"
+#include "bench_util.h"
+
+
+/* Command-line options. */
+static int o_max_threads = 0;  /* 0 = number of online CPUs. */
+static int o_duration_ms = 500;
+static char *o_tag = "dev";
+
+#define LAT_SAMPLE_MASK 63       /* Time one take in every 64. */
+#define MAX_LAT_SAMPLES 200000   /* Per thread. */
+
+/* Hardware counters collected per thread. */
+#define CTR_CYCLES 0
+#define CTR_INSTRUCTIONS 1
+#define CTR_CACHE_MISSES 2
+#define CTR_L1D_MISSES 3
+#define NUM_CTRS 4
+
+/* For pthread functions, which return an error number. */
+#define PTHCHK(status_) do { \
+  int err_ = (status_); \
+  if (err_ != 0) { \
+    fprintf(stderr, "Failure at %s:%d '%s': %s\n", \
+      __FILE__, __LINE__, #status_, strerror(err_)); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+/* Sharing variants. */
+#define LOCK_MUTEX 0
+#define LOCK_SPIN 1
+#define LOCK_PCPU 2
+#define NUM_LOCKS 3
+
+static char *lock_names[NUM_LOCKS] = { "mutex", "spinlock", "pcpu" };
+
+
+char *usage_str = "Usage: bench_mt [-h] [-m max_threads] [-d duration_ms] [-t tag]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -m max_threads : highest thread count (0 = online CPUs) [%d]\n"
+      "  -d duration_ms : run time per thread count [%d]\n"
+      "  -t tag : label written to every output line (e.g. a version) [%s]\n"
+      , o_max_threads, o_duration_ms, o_tag);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hm:d:t:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'm': o_max_threads = atoi(optarg); break;
+      case 'd': o_duration_ms = atoi(optarg); break;
+      case 't': o_tag = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_max_threads < 0) usage("max_threads must be >= 0");
+  if (o_duration_ms < 1) usage("duration must be > 0");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+/* Shared state for one run. */
+typedef struct shared_s {
+  rtlim_t *rtlim;
+  rtlim_pcpu_t *pcpu;
+  int lock_type;
+  pthread_mutex_t mutex;
+  pthread_spinlock_t spin;
+  pthread_barrier_t barrier;
+  volatile int stop;
+} shared_t;
+
+/* Per-thread state, padded so threads don't share lines with each other. */
+typedef struct worker_s {
+  shared_t *shared;
+  pthread_t thread_id;
+  int cpu;
+  unsigned long long takes;
+  long long ctrs[NUM_CTRS];  /* -1 if not available. */
+  double *lat_ns;
+  int num_lat;
+  char pad[64];
+} worker_t;
+
+
+static int perf_open(unsigned int type, unsigned long long config)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}  /* perf_open */
+
+
+/* Read a counter, scaled up if it was multiplexed. */
+static long long perf_read(int fd)
+{
+  unsigned long long vals[3];  /* value, time enabled, time running. */
+
+  if (fd == -1) {
+    return -1;
+  }
+  if (read(fd, vals, sizeof(vals)) != sizeof(vals) || vals[2] == 0) {
+    return -1;
+  }
+
+  return (long long)((double)vals[0] * vals[1] / vals[2]);
+}  /* perf_read */
+
+
+void *worker_thread(void *arg)
+{
+  worker_t *worker = (worker_t *)arg;
+  shared_t *shared = worker->shared;
+  int fds[NUM_CTRS];
+  unsigned long long takes = 0;
+  int i;
+
+  (void)bench_pin_cpu(worker->cpu);
+
+  fds[CTR_CYCLES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  fds[CTR_INSTRUCTIONS] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS);
+  fds[CTR_CACHE_MISSES] = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+  fds[CTR_L1D_MISSES] = perf_open(PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D |
+    (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16));
+
+  pthread_barrier_wait(&shared->barrier);
+  for (i = 0; i < NUM_CTRS; i++) {
+    if (fds[i] != -1) ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  while (! shared->stop) {
+    unsigned long long start_ns = 0;
+    int sampled = ((takes & LAT_SAMPLE_MASK) == 0) && (worker->num_lat < MAX_LAT_SAMPLES);
+
+    if (sampled) {
+      start_ns = current_time_ns();
+    }
+
+    if (shared->lock_type == LOCK_MUTEX) {
+      pthread_mutex_lock(&shared->mutex);
+      (void)rtlim_take(shared->rtlim, 1, RTLIM_NON_BLOCK);
+      pthread_mutex_unlock(&shared->mutex);
+    }
+    else if (shared->lock_type == LOCK_SPIN) {
+      pthread_spin_lock(&shared->spin);
+      (void)rtlim_take(shared->rtlim, 1, RTLIM_NON_BLOCK);
+      pthread_spin_unlock(&shared->spin);
+    }
+    else {
+      (void)rtlim_pcpu_take(shared->pcpu, 1, RTLIM_NON_BLOCK);
+    }
+
+    if (sampled) {
+      worker->lat_ns[worker->num_lat++] = (double)(current_time_ns() - start_ns);
+    }
+    takes++;
+  }
+
+  for (i = 0; i < NUM_CTRS; i++) {
+    if (fds[i] != -1) ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    worker->ctrs[i] = perf_read(fds[i]);
+    if (fds[i] != -1) close(fds[i]);
+  }
+  worker->takes = takes;
+
+  return NULL;
+}  /* worker_thread */
+
+
+/* Per-take value of a counter summed over all workers, or -1. */
+double ctr_per_take(worker_t *workers, int num_threads, int ctr,
+  unsigned long long total_takes)
+{
+  long long sum = 0;
+  int t;
+
+  for (t = 0; t < num_threads; t++) {
+    if (workers[t].ctrs[ctr] < 0) {
+      return -1.0;
+    }
+    sum += workers[t].ctrs[ctr];
+  }
+
+  return (double)sum / total_takes;
+}  /* ctr_per_take */
+
+
+void run_threads(int lock_type, int num_threads, int num_cpus)
+{
+  shared_t shared;
+  worker_t *workers;
+  double *all_lat;
+  unsigned long long total_takes = 0;
+  unsigned long long start_ns, end_ns;
+  double sum = 0.0, sumsq = 0.0, share_min = 1.0, share_max = 0.0, fairness;
+  bench_stats_t lat_stats;
+  int t, num_lat = 0;
+
+  memset(&shared, 0, sizeof(shared));
+  /* Never runs dry: measures sharing cost, not rate limiting. */
+  shared.rtlim = rtlim_create(1000000, 1000000000);
+  shared.pcpu = rtlim_pcpu_create(1000000, 1000000000);
+  shared.lock_type = lock_type;
+  PTHCHK(pthread_mutex_init(&shared.mutex, NULL));
+  PTHCHK(pthread_spin_init(&shared.spin, PTHREAD_PROCESS_PRIVATE));
+  PTHCHK(pthread_barrier_init(&shared.barrier, NULL, num_threads + 1));
+
+  workers = (worker_t *)calloc(num_threads, sizeof(worker_t));
+  NULLCHK(workers);
+  for (t = 0; t < num_threads; t++) {
+    workers[t].shared = &shared;
+    workers[t].cpu = t % num_cpus;
+    workers[t].lat_ns = (double *)malloc(MAX_LAT_SAMPLES * sizeof(double));
+    NULLCHK(workers[t].lat_ns);
+    PTHCHK(pthread_create(&workers[t].thread_id, NULL, worker_thread,
+      &workers[t]));
+  }
+
+  pthread_barrier_wait(&shared.barrier);
+  start_ns = current_time_ns();
+  usleep(o_duration_ms * 1000);
+  shared.stop = 1;
+  for (t = 0; t < num_threads; t++) {
+    pthread_join(workers[t].thread_id, NULL);
+  }
+  end_ns = current_time_ns();
+
+  for (t = 0; t < num_threads; t++) {
+    total_takes += workers[t].takes;
+    num_lat += workers[t].num_lat;
+  }
+  all_lat = (double *)malloc((num_lat + 1) * sizeof(double));
+  NULLCHK(all_lat);
+  num_lat = 0;
+  for (t = 0; t < num_threads; t++) {
+    double share = (double)workers[t].takes / total_takes;
+    sum += workers[t].takes;
+    sumsq += (double)workers[t].takes * workers[t].takes;
+    if (share < share_min) share_min = share;
+    if (share > share_max) share_max = share;
+    memcpy(&all_lat[num_lat], workers[t].lat_ns, workers[t].num_lat * sizeof(double));
+    num_lat += workers[t].num_lat;
+  }
+  /* Jain's fairness index: 1.0 = perfectly even, 1/n = one thread got all. */
+  fairness = (sumsq > 0.0) ? (sum * sum) / (num_threads * sumsq) : 0.0;
+  bench_stats_calc(&lat_stats, all_lat, num_lat);
+
+  printf("%s,%s,%d,%.0f,%.4f,%.4f,%.4f,%.0f,%.0f,%.0f,%.1f,%.1f,%.3f,%.3f\n",
+    o_tag, lock_names[lock_type], num_threads,
+    (double)total_takes * 1e9 / (end_ns - start_ns), fairness,
+    share_min * num_threads, share_max * num_threads,
+    lat_stats.p50, lat_stats.p99, lat_stats.max,
+    ctr_per_take(workers, num_threads, CTR_CYCLES, total_takes),
+    ctr_per_take(workers, num_threads, CTR_INSTRUCTIONS, total_takes),
+    ctr_per_take(workers, num_threads, CTR_CACHE_MISSES, total_takes),
+    ctr_per_take(workers, num_threads, CTR_L1D_MISSES, total_takes));
+  fflush(stdout);
+
+  for (t = 0; t < num_threads; t++) {
+    free(workers[t].lat_ns);
+  }
+  free(workers);
+  free(all_lat);
+  pthread_barrier_destroy(&shared.barrier);
+  pthread_spin_destroy(&shared.spin);
+  pthread_mutex_destroy(&shared.mutex);
+  rtlim_delete(shared.rtlim);
+  rtlim_pcpu_delete(shared.pcpu);
+}  /* run_threads */
+
+
+int main(int argc, char **argv)
+{
+  int num_cpus, lock_type, num_threads, fd;
+
+  get_my_opts(argc, argv);
+
+  num_cpus = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (num_cpus < 1) num_cpus = 1;
+  if (o_max_threads == 0) o_max_threads = num_cpus;
+
+  fd = perf_open(PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES);
+  if (fd == -1) {
+    fprintf(stderr, "Note: hardware counters unavailable (%s); counter columns will be -1.\n",
+      strerror(errno));
+  }
+  else {
+    close(fd);
+  }
+
+  printf("tag,lock,threads,takes_per_sec,fairness,share_min,share_max,"
+    "lat_p50,lat_p99,lat_max,cycles_per_take,instr_per_take,"
+    "cache_miss_per_take,l1d_miss_per_take\n");
+  for (lock_type = 0; lock_type < NUM_LOCKS; lock_type++) {
+    for (num_threads = 1; num_threads <= o_max_threads; num_threads *= 2) {
+      run_threads(lock_type, num_threads, num_cpus);
+      if (num_threads < o_max_threads && num_threads * 2 > o_max_threads) {
+        run_threads(lock_type, o_max_threads, num_cpus);
+      }
+    }
+  }
+
+  return 0;
+}  /* main */
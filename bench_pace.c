@@ -0,0 +1,221 @@
+/* bench_pace.c - Pacing accuracy and jitter benchmark for rtlim.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Runs the README's send loop (take one token, then "send") against each
+ * configuration for a fixed duration, with the send simulated by a busy
+ * loop of a given cost. Every release time (the limiter's grant timestamp)
+ * is recorded, and from those the program reports:
+ *   - achieved long-run rate versus configured rate,
+ *   - inter-departure gap distribution,
+ *   - wake-up overshoot: for takes that had to wait, how late the grant
+ *     was relative to the refill time the limiter was waiting for,
+ *   - the maximum number of tokens released in any window of size W.
+ * Output is CSV on stdout.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rtlim.h"
+#include "bench_util.h"
+
+
+/* Command-line options. */
+static int o_cpu = 0;
+static int o_duration_ms = 1000;
+static int o_send_ns = 2000;
+static char *o_tag = "dev";
+
+/* Window sizes for the max-tokens-per-window columns. */
+static unsigned long long windows_ns[] = {
+  10000, 100000, 1000000, 10000000, 100000000 };
+#define NUM_WINDOWS (sizeof(windows_ns) / sizeof(windows_ns[0]))
+
+
+char *usage_str = "Usage: bench_pace [-h] [-c cpu] [-d duration_ms] [-s send_ns] [-t tag]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -c cpu : CPU to pin to (-1 = no pinning) [%d]\n"
+      "  -d duration_ms : run time per configuration [%d]\n"
+      "  -s send_ns : simulated cost of each send [%d]\n"
+      "  -t tag : label written to every output line (e.g. a version) [%s]\n"
+      , o_cpu, o_duration_ms, o_send_ns, o_tag);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hc:d:s:t:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'c': o_cpu = atoi(optarg); break;
+      case 'd': o_duration_ms = atoi(optarg); break;
+      case 's': o_send_ns = atoi(optarg); break;
+      case 't': o_tag = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_duration_ms < 1) usage("duration must be > 0");
+  if (o_send_ns < 0) usage("send_ns must be >= 0");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+/* Maximum number of releases within any window of "window_ns", given
+ * sorted release timestamps (one token per release). */
+int max_in_window(unsigned long long *release_ns, int count,
+  unsigned long long window_ns)
+{
+  int max_count = 0;
+  int head, tail = 0;
+
+  for (head = 0; head < count; head++) {
+    while (release_ns[head] - release_ns[tail] >= window_ns) {
+      tail++;
+    }
+    if (head - tail + 1 > max_count) {
+      max_count = head - tail + 1;
+    }
+  }
+
+  return max_count;
+}  /* max_in_window */
+
+
+void run_config(unsigned long long refill_interval_ns, int refill_token_amount,
+  int block)
+{
+  rtlim_t *rl;
+  unsigned long long *release_ns;
+  double *gaps, *overshoots;
+  int max_releases, count, over_count, i;
+  unsigned long long end_ns;
+  double cfg_rate, achieved_rate;
+  bench_stats_t gap_stats, over_stats;
+
+  cfg_rate = (double)refill_token_amount * 1e9 / refill_interval_ns;
+  /* The limiter can't release much more than its configured rate. */
+  max_releases = (int)(cfg_rate * o_duration_ms / 1000.0 * 1.1) +
+    refill_token_amount + 16;
+
+  release_ns = (unsigned long long *)malloc(max_releases * sizeof(unsigned long long));
+  NULLCHK(release_ns);
+  gaps = (double *)malloc(max_releases * sizeof(double));
+  NULLCHK(gaps);
+  overshoots = (double *)malloc(max_releases * sizeof(double));
+  NULLCHK(overshoots);
+
+  rl = rtlim_create(refill_interval_ns, refill_token_amount);
+  end_ns = current_time_ns() + (unsigned long long)o_duration_ms * 1000000;
+  count = 0;
+  over_count = 0;
+  while (count < max_releases) {
+    unsigned long long due_ns = rl->last_refill_ns + rl->refill_interval_ns;
+    unsigned long long before_ns = current_time_ns();
+    int must_wait = (rl->current_tokens < 1) && (before_ns < due_ns);
+
+    rtlim_take(rl, 1, block);
+    release_ns[count++] = rl->cur_ns;
+    if (must_wait) {
+      overshoots[over_count++] = (double)(rl->cur_ns - due_ns);
+    }
+
+    if (rl->cur_ns >= end_ns) {
+      break;
+    }
+    bench_spin_ns(o_send_ns);
+  }
+  rtlim_delete(rl);
+
+  for (i = 1; i < count; i++) {
+    gaps[i - 1] = (double)(release_ns[i] - release_ns[i - 1]);
+  }
+  /* Long-run rate from first to last release. The initial full bucket
+   * biases it slightly high for short runs. */
+  achieved_rate = (double)(count - 1) * 1e9 / (release_ns[count - 1] - release_ns[0]);
+  bench_stats_calc(&gap_stats, gaps, count - 1);
+  bench_stats_calc(&over_stats, overshoots, over_count);
+
+  printf("%s,%llu,%d,%s,%d,%d,%.1f,%.1f,%.3f,%.0f,%.0f,%.0f,%.0f,%d,%.0f,%.0f,%.0f",
+    o_tag, refill_interval_ns, refill_token_amount,
+    (block == RTLIM_BLOCK_SPIN) ? "spin" : (block == RTLIM_BLOCK_HYBRID) ? "hybrid" : "sleep",
+    o_send_ns, count,
+    cfg_rate, achieved_rate, (achieved_rate - cfg_rate) * 100.0 / cfg_rate,
+    gap_stats.p50, gap_stats.p90, gap_stats.p99, gap_stats.max,
+    over_count, over_stats.p50, over_stats.p99, over_stats.max);
+  for (i = 0; i < NUM_WINDOWS; i++) {
+    printf(",%d", max_in_window(release_ns, count, windows_ns[i]));
+  }
+  printf("\n");
+  fflush(stdout);
+
+  free(release_ns);
+  free(gaps);
+  free(overshoots);
+}  /* run_config */
+
+
+int main(int argc, char **argv)
+{
+  /* Same long-run rate (50,000/sec) at different granularities, per the
+   * README's 1 ms/50 versus 10 ms/500 comparison, plus a lower rate. */
+  static unsigned long long intervals_ns[] = { 100000, 1000000, 10000000, 1000000 };
+  static int amounts[] = { 5, 50, 500, 10 };
+  int c, i;
+
+  get_my_opts(argc, argv);
+
+  if (bench_pin_cpu(o_cpu) != 0) {
+    fprintf(stderr, "Warning, could not pin to CPU %d\n", o_cpu);
+  }
+
+  printf("tag,interval_ns,amount,block,send_ns,releases,cfg_rate,achieved_rate,"
+    "rate_err_pct,gap_p50,gap_p90,gap_p99,gap_max,"
+    "waits,overshoot_p50,overshoot_p99,overshoot_max");
+  for (i = 0; i < NUM_WINDOWS; i++) {
+    printf(",max_in_%lluns", windows_ns[i]);
+  }
+  printf("\n");
+
+  for (c = 0; c < sizeof(amounts) / sizeof(amounts[0]); c++) {
+    run_config(intervals_ns[c], amounts[c], RTLIM_BLOCK_SPIN);
+    run_config(intervals_ns[c], amounts[c], RTLIM_BLOCK_HYBRID);
+    run_config(intervals_ns[c], amounts[c], RTLIM_BLOCK_SLEEP);
+  }
+
+  return 0;
+}  /* main */
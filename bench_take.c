@@ -0,0 +1,629 @@
+/* bench_take.c - Microbenchmark of per-take overhead of rtlim.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Each measurement "sample" times a batch of operations with both the
+ * monotonic clock and the time stamp counter, and divides by the batch
+ * size. The reported statistics are over the samples (after warmup).
+ * Output is CSV on stdout, one line per case, so that runs from different
+ * versions can be compared mechanically.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <limits.h>
+
+#include "rtlim.h"
+#include "rtlim_tk.h"
+#include "rtlim_refill.h"
+#include "rtlim_rate.h"
+#include "bench_util.h"
+
+
+/* Command-line options. */
+static int o_cpu = 0;
+static int o_tk_cpu = 1;
+static int o_samples = 2000;
+static int o_warmup = 200;
+static char *o_tag = "dev";
+
+/* Keep the compiler from discarding results. */
+static volatile unsigned long long sink;
+
+
+char *usage_str = "Usage: bench_take [-h] [-c cpu] [-k tk_cpu] [-n samples] [-w warmup] [-t tag]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -c cpu : CPU to pin to (-1 = no pinning) [%d]\n"
+      "  -k tk_cpu : CPU for the spinning timekeeper thread (-1 = skip\n"
+      "             timekeeper cases) [%d]\n"
+      "  -n samples : number of measured samples per case [%d]\n"
+      "  -w warmup : number of discarded warmup samples per case [%d]\n"
+      "  -t tag : label written to every output line (e.g. a version) [%s]\n"
+      , o_cpu, o_tk_cpu, o_samples, o_warmup, o_tag);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hc:k:n:w:t:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'c': o_cpu = atoi(optarg); break;
+      case 'k': o_tk_cpu = atoi(optarg); break;
+      case 'n': o_samples = atoi(optarg); break;
+      case 'w': o_warmup = atoi(optarg); break;
+      case 't': o_tag = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_samples < 1) usage("samples must be > 0");
+  if (o_warmup < 0) usage("warmup must be >= 0");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+char *block_name(int block)
+{
+  switch (block) {
+    case RTLIM_BLOCK_SPIN: return "spin";
+    case RTLIM_BLOCK_SLEEP: return "sleep";
+    case RTLIM_BLOCK_HYBRID: return "hybrid";
+    case RTLIM_NON_BLOCK: return "nonblock";
+  }
+  return "?";
+}  /* block_name */
+
+
+/* One benchmark case. */
+typedef struct bench_case_s {
+  char *name;
+  int block;
+  unsigned long long refill_interval_ns;
+  int refill_token_amount;
+  int take_token_amount;
+  int start_tokens;   /* Loaded into the limiter before each sample. */
+  int batch;          /* Operations per sample. */
+  int clock_type;     /* RTLIM_CLOCK_... */
+  void *clock_clientd;  /* For RTLIM_CLOCK_TIMEKEEPER. */
+  int shadow;         /* Attach a shadow limiter with the same config. */
+  int background;     /* Refilled by a refiller (which never runs). */
+} bench_case_t;
+
+
+char *clock_name(int clock_type)
+{
+  switch (clock_type) {
+    case RTLIM_CLOCK_MONOTONIC: return "monotonic";
+    case RTLIM_CLOCK_MONOTONIC_COARSE: return "monotonic_coarse";
+    case RTLIM_CLOCK_MONOTONIC_RAW: return "monotonic_raw";
+    case RTLIM_CLOCK_TSC: return "tsc";
+    case RTLIM_CLOCK_TIMEKEEPER: return "timekeeper";
+  }
+  return "?";
+}  /* clock_name */
+
+
+void print_header()
+{
+  printf("tag,bench,block,take_amount,clock,samples,batch,"
+    "ns_min,ns_p50,ns_mean,ns_p99,ns_var,cyc_p50,cyc_p99\n");
+}  /* print_header */
+
+
+void print_result(char *bench, char *block, int take_amount, char *clock,
+  int batch, bench_stats_t *ns, bench_stats_t *cyc)
+{
+  printf("%s,%s,%s,%d,%s,%d,%d,%.2f,%.2f,%.2f,%.2f,%.3f,%.1f,%.1f\n",
+    o_tag, bench, block, take_amount, clock, ns->count, batch,
+    ns->min, ns->p50, ns->mean, ns->p99, ns->var, cyc->p50, cyc->p99);
+  fflush(stdout);
+}  /* print_result */
+
+
+void run_case(bench_case_t *bc, double *ns_samples, double *cyc_samples)
+{
+  rtlim_t *rl;
+  rtlim_shadow_t *shadow = NULL;
+  rtlim_refiller_t *refiller = NULL;
+  bench_stats_t ns_stats, cyc_stats;
+  int sample, i;
+
+  rl = rtlim_create(bc->refill_interval_ns, bc->refill_token_amount);
+  if (rtlim_set_clock(rl, bc->clock_type, NULL, bc->clock_clientd) != 0) {
+    fprintf(stderr, "Note: clock %s not supported, skipping.\n",
+      clock_name(bc->clock_type));
+    rtlim_delete(rl);
+    return;
+  }
+  if (bc->shadow) {
+    shadow = rtlim_shadow_create(bc->refill_interval_ns, bc->refill_token_amount);
+    (void)rtlim_set_shadow(rl, shadow);
+  }
+  if (bc->background) {
+    refiller = rtlim_refiller_create(RTLIM_NON_BLOCK, -1);
+    NULLCHK(refiller);
+    (void)rtlim_refiller_add(refiller, rl);
+  }
+
+  for (sample = -o_warmup; sample < o_samples; sample++) {
+    unsigned long long start_ns, end_ns, start_cyc, end_cyc;
+    int status = 0;
+
+    rl->current_tokens = bc->start_tokens;
+
+    start_ns = current_time_ns();
+    start_cyc = bench_cycles();
+    for (i = 0; i < bc->batch; i++) {
+      status += rtlim_take(rl, bc->take_token_amount, bc->block);
+    }
+    end_cyc = bench_cycles();
+    end_ns = current_time_ns();
+    sink += status;
+
+    if (sample >= 0) {
+      ns_samples[sample] = (double)(end_ns - start_ns) / bc->batch;
+      cyc_samples[sample] = (double)(end_cyc - start_cyc) / bc->batch;
+    }
+  }
+
+  if (refiller != NULL) {
+    rtlim_refiller_delete(refiller);
+  }
+  rtlim_delete(rl);
+  if (shadow != NULL) {
+    rtlim_shadow_delete(shadow);
+  }
+
+  bench_stats_calc(&ns_stats, ns_samples, o_samples);
+  bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+  print_result(bc->name, block_name(bc->block), bc->take_token_amount,
+    clock_name(bc->clock_type), bc->batch, &ns_stats, &cyc_stats);
+}  /* run_case */
+
+
+/* A batch of "batch" one-token messages scheduled by rtlim_schedule(),
+ * versus discovered by back-to-back blocking takes (on a virtual clock,
+ * so that neither waits). Reported per message. */
+void run_schedule(int batch, double *ns_samples, double *cyc_samples)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  bench_stats_t ns_stats, cyc_stats;
+  int *costs;
+  unsigned long long *departures;
+  int use_schedule, sample, i;
+
+  costs = (int *)malloc(batch * sizeof(int));
+  NULLCHK(costs);
+  departures = (unsigned long long *)malloc(batch * sizeof(unsigned long long));
+  NULLCHK(departures);
+  for (i = 0; i < batch; i++) {
+    costs[i] = 1;
+  }
+
+  for (use_schedule = 0; use_schedule < 2; use_schedule++) {
+    vclock.now_ns = 0;
+    rl = rtlim_create(1000000, 50);
+    (void)rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock);
+
+    for (sample = -o_warmup; sample < o_samples; sample++) {
+      unsigned long long start_ns, end_ns, start_cyc, end_cyc;
+      int status = 0;
+
+      start_ns = current_time_ns();
+      start_cyc = bench_cycles();
+      if (use_schedule) {
+        status = rtlim_schedule(rl, costs, departures, batch);
+        sink += departures[batch - 1];
+      }
+      else {
+        for (i = 0; i < batch; i++) {
+          status += rtlim_take(rl, costs[i], RTLIM_BLOCK_SPIN);
+        }
+      }
+      end_cyc = bench_cycles();
+      end_ns = current_time_ns();
+      sink += status;
+
+      if (sample >= 0) {
+        ns_samples[sample] = (double)(end_ns - start_ns) / batch;
+        cyc_samples[sample] = (double)(end_cyc - start_cyc) / batch;
+      }
+    }
+    rtlim_delete(rl);
+
+    bench_stats_calc(&ns_stats, ns_samples, o_samples);
+    bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+    print_result(use_schedule ? "schedule" : "take_loop", "spin", 1,
+      "virtual", batch, &ns_stats, &cyc_stats);
+  }
+
+  free(costs);
+  free(departures);
+}  /* run_schedule */
+
+
+/* One refiller servicing "num_limiters" limiters that are all due at
+ * once: the cost per refill (on a virtual clock). */
+void run_refiller(int num_limiters, double *ns_samples, double *cyc_samples)
+{
+  rtlim_vclock_t vclock;
+  rtlim_refiller_t *refiller;
+  rtlim_t **limiters;
+  bench_stats_t ns_stats, cyc_stats;
+  int sample, i;
+
+  refiller = rtlim_refiller_create(RTLIM_NON_BLOCK, -1);
+  NULLCHK(refiller);
+  limiters = (rtlim_t **)malloc(num_limiters * sizeof(rtlim_t *));
+  NULLCHK(limiters);
+  vclock.now_ns = 0;
+  for (i = 0; i < num_limiters; i++) {
+    limiters[i] = rtlim_create(1000, 1);
+    (void)rtlim_set_clock(limiters[i], RTLIM_CLOCK_VIRTUAL, NULL, &vclock);
+    (void)rtlim_refiller_add(refiller, limiters[i]);
+  }
+
+  for (sample = -o_warmup; sample < o_samples; sample++) {
+    unsigned long long start_ns, end_ns, start_cyc, end_cyc;
+
+    vclock.now_ns += 1000;
+    start_ns = current_time_ns();
+    start_cyc = bench_cycles();
+    sink += rtlim_refiller_run(refiller, vclock.now_ns);
+    end_cyc = bench_cycles();
+    end_ns = current_time_ns();
+
+    if (sample >= 0) {
+      ns_samples[sample] = (double)(end_ns - start_ns) / num_limiters;
+      cyc_samples[sample] = (double)(end_cyc - start_cyc) / num_limiters;
+    }
+  }
+
+  rtlim_refiller_delete(refiller);
+  for (i = 0; i < num_limiters; i++) {
+    rtlim_delete(limiters[i]);
+  }
+  free(limiters);
+
+  bench_stats_calc(&ns_stats, ns_samples, o_samples);
+  bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+  print_result("refiller_run", "-", 0, "virtual", num_limiters, &ns_stats, &cyc_stats);
+}  /* run_refiller */
+
+
+/* Fast path of a fractional-rate limiter (see rtlim_rate.h), which
+ * earns credit on every take instead of at refills. */
+void run_rate(int block, double *ns_samples, double *cyc_samples)
+{
+  rtlim_rate_t *rate;
+  bench_stats_t ns_stats, cyc_stats;
+  int batch = 1000;
+  int sample, i;
+
+  rate = rtlim_rate_create_ratio(1, 1000, INT_MAX);  /* Never runs out. */
+  NULLCHK(rate);
+
+  for (sample = -o_warmup; sample < o_samples; sample++) {
+    unsigned long long start_ns, end_ns, start_cyc, end_cyc;
+    int status = 0;
+
+    rate->credit = rate->max_credit;
+
+    start_ns = current_time_ns();
+    start_cyc = bench_cycles();
+    for (i = 0; i < batch; i++) {
+      status += rtlim_rate_take(rate, 1, block);
+    }
+    end_cyc = bench_cycles();
+    end_ns = current_time_ns();
+    sink += status;
+
+    if (sample >= 0) {
+      ns_samples[sample] = (double)(end_ns - start_ns) / batch;
+      cyc_samples[sample] = (double)(end_cyc - start_cyc) / batch;
+    }
+  }
+
+  rtlim_rate_delete(rate);
+
+  bench_stats_calc(&ns_stats, ns_samples, o_samples);
+  bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+  print_result("fast_path_rate", block_name(block), 1, "monotonic", batch, &ns_stats, &cyc_stats);
+}  /* run_rate */
+
+
+/* Cost of reading each candidate clock source. */
+void run_clock(char *name, clockid_t clock_id, double *ns_samples,
+  double *cyc_samples)
+{
+  bench_stats_t ns_stats, cyc_stats;
+  int batch = 1000;
+  int sample, i;
+
+  for (sample = -o_warmup; sample < o_samples; sample++) {
+    unsigned long long start_ns, end_ns, start_cyc, end_cyc;
+    unsigned long long sum = 0;
+
+    start_ns = current_time_ns();
+    start_cyc = bench_cycles();
+    if (clock_id == (clockid_t)-1) {
+      for (i = 0; i < batch; i++) {
+        sum += bench_cycles();
+      }
+    }
+    else {
+      for (i = 0; i < batch; i++) {
+        struct timespec ts;
+        clock_gettime(clock_id, &ts);
+        sum += ts.tv_nsec;
+      }
+    }
+    end_cyc = bench_cycles();
+    end_ns = current_time_ns();
+    sink += sum;
+
+    if (sample >= 0) {
+      ns_samples[sample] = (double)(end_ns - start_ns) / batch;
+      cyc_samples[sample] = (double)(end_cyc - start_cyc) / batch;
+    }
+  }
+
+  bench_stats_calc(&ns_stats, ns_samples, o_samples);
+  bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+  print_result("clock_read", "-", 0, name, batch, &ns_stats, &cyc_stats);
+}  /* run_clock */
+
+
+/* Cost of reading a timekeeper's shared clock, and how far it lags
+ * CLOCK_MONOTONIC (the "clock_lag" line's ns columns are the lag). */
+void run_timekeeper(rtlim_tk_t *tk, double *ns_samples, double *cyc_samples)
+{
+  bench_stats_t ns_stats, cyc_stats;
+  int batch = 1000;
+  int sample, i;
+
+  for (sample = -o_warmup; sample < o_samples; sample++) {
+    unsigned long long start_ns, end_ns, start_cyc, end_cyc;
+    unsigned long long sum = 0;
+
+    start_ns = current_time_ns();
+    start_cyc = bench_cycles();
+    for (i = 0; i < batch; i++) {
+      sum += tk->clock.now_ns;
+    }
+    end_cyc = bench_cycles();
+    end_ns = current_time_ns();
+    sink += sum;
+
+    if (sample >= 0) {
+      ns_samples[sample] = (double)(end_ns - start_ns) / batch;
+      cyc_samples[sample] = (double)(end_cyc - start_cyc) / batch;
+    }
+  }
+  bench_stats_calc(&ns_stats, ns_samples, o_samples);
+  bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+  print_result("clock_read", "-", 0, "timekeeper", batch, &ns_stats, &cyc_stats);
+
+  for (sample = -o_warmup; sample < o_samples; sample++) {
+    unsigned long long tk_ns = tk->clock.now_ns;
+    unsigned long long now_ns = current_time_ns();
+
+    if (sample >= 0) {
+      ns_samples[sample] = (double)(now_ns - tk_ns);
+      cyc_samples[sample] = 0.0;
+    }
+  }
+  bench_stats_calc(&ns_stats, ns_samples, o_samples);
+  bench_stats_calc(&cyc_stats, cyc_samples, o_samples);
+  print_result("clock_lag", "-", 0, "timekeeper", 1, &ns_stats, &cyc_stats);
+}  /* run_timekeeper */
+
+
+int main(int argc, char **argv)
+{
+  static int blocks[] = { RTLIM_NON_BLOCK, RTLIM_BLOCK_SPIN, RTLIM_BLOCK_SLEEP, RTLIM_BLOCK_HYBRID };
+  int num_blocks = sizeof(blocks) / sizeof(blocks[0]);
+  static int amounts[] = { 1, 8, 64 };
+  double *ns_samples, *cyc_samples;
+  bench_case_t bc;
+  rtlim_tk_t *tk = NULL;
+  int b, a, c;
+
+  get_my_opts(argc, argv);
+
+  if (bench_pin_cpu(o_cpu) != 0) {
+    fprintf(stderr, "Warning, could not pin to CPU %d\n", o_cpu);
+  }
+
+  ns_samples = (double *)malloc(o_samples * sizeof(double));
+  NULLCHK(ns_samples);
+  cyc_samples = (double *)malloc(o_samples * sizeof(double));
+  NULLCHK(cyc_samples);
+
+  print_header();
+  memset(&bc, 0, sizeof(bc));
+  bc.clock_type = RTLIM_CLOCK_MONOTONIC;
+
+  run_clock("monotonic", CLOCK_MONOTONIC, ns_samples, cyc_samples);
+  run_clock("monotonic_coarse", CLOCK_MONOTONIC_COARSE, ns_samples, cyc_samples);
+  run_clock("monotonic_raw", CLOCK_MONOTONIC_RAW, ns_samples, cyc_samples);
+  run_clock("realtime", CLOCK_REALTIME, ns_samples, cyc_samples);
+  run_clock("tsc", (clockid_t)-1, ns_samples, cyc_samples);
+
+  for (b = 0; b < num_blocks; b++) {
+    for (a = 0; a < 3; a++) {
+      /* Fast path: plenty of tokens, interval never expires. */
+      bc.name = "fast_path";
+      bc.block = blocks[b];
+      bc.refill_interval_ns = 1000000000000ull;
+      bc.refill_token_amount = INT_MAX;
+      bc.take_token_amount = amounts[a];
+      bc.start_tokens = INT_MAX;
+      bc.batch = 1000;
+      run_case(&bc, ns_samples, cyc_samples);
+
+      /* Refill boundary: a zero interval refills on every take. */
+      bc.name = "refill_boundary";
+      bc.refill_interval_ns = 0;
+      bc.refill_token_amount = 64;
+      bc.start_tokens = 64;
+      run_case(&bc, ns_samples, cyc_samples);
+    }
+  }
+
+  /* Fast path with each limiter clock source. */
+  for (c = RTLIM_CLOCK_MONOTONIC_COARSE; c <= RTLIM_CLOCK_TSC; c++) {
+    bc.name = "fast_path";
+    bc.block = RTLIM_NON_BLOCK;
+    bc.refill_interval_ns = 1000000000000ull;
+    bc.refill_token_amount = INT_MAX;
+    bc.take_token_amount = 1;
+    bc.start_tokens = INT_MAX;
+    bc.batch = 1000;
+    bc.clock_type = c;
+    run_case(&bc, ns_samples, cyc_samples);
+  }
+  bc.clock_type = RTLIM_CLOCK_MONOTONIC;
+
+  /* Timekeeper clock, spinning on its own CPU. */
+  if (o_tk_cpu >= 0) {
+    tk = rtlim_tk_create(0, RTLIM_BLOCK_SPIN, o_tk_cpu);
+    if (tk == NULL) {
+      fprintf(stderr, "Note: can't run timekeeper on CPU %d, skipping.\n", o_tk_cpu);
+    }
+  }
+  if (tk != NULL) {
+    run_timekeeper(tk, ns_samples, cyc_samples);
+    bc.name = "fast_path";
+    bc.block = RTLIM_NON_BLOCK;
+    bc.refill_interval_ns = 1000000000000ull;
+    bc.refill_token_amount = INT_MAX;
+    bc.take_token_amount = 1;
+    bc.start_tokens = INT_MAX;
+    bc.batch = 1000;
+    bc.clock_type = RTLIM_CLOCK_TIMEKEEPER;
+    bc.clock_clientd = &tk->clock;
+    run_case(&bc, ns_samples, cyc_samples);
+    fprintf(stderr, "Timekeeper: max gap between clock reads %llu ns\n", tk->max_gap_ns);
+    rtlim_tk_delete(tk);
+    bc.clock_type = RTLIM_CLOCK_MONOTONIC;
+    bc.clock_clientd = NULL;
+  }
+
+  /* Fast path with a shadow limiter attached (its extra cost). */
+  for (b = 0; b < 2; b++) {
+    bc.name = "fast_path_shadow";
+    bc.block = blocks[b];
+    bc.refill_interval_ns = 1000000000000ull;
+    bc.refill_token_amount = INT_MAX;
+    bc.take_token_amount = 1;
+    bc.start_tokens = INT_MAX;
+    bc.batch = 1000;
+    bc.shadow = 1;
+    run_case(&bc, ns_samples, cyc_samples);
+  }
+  bc.shadow = 0;
+
+  /* Fast path refilled in the background (no clock read), and the
+   * refiller's cost. */
+  for (b = 0; b < 2; b++) {
+    bc.name = "fast_path_background";
+    bc.block = blocks[b];
+    bc.refill_interval_ns = 1000000000000ull;
+    bc.refill_token_amount = INT_MAX;
+    bc.take_token_amount = 1;
+    bc.start_tokens = INT_MAX;
+    bc.batch = 1000;
+    bc.background = 1;
+    run_case(&bc, ns_samples, cyc_samples);
+  }
+  bc.background = 0;
+  run_refiller(10000, ns_samples, cyc_samples);
+
+  for (b = 0; b < 2; b++) {
+    run_rate(blocks[b], ns_samples, cyc_samples);
+  }
+
+  /* Non-blocking failure path: empty limiter, interval never expires. */
+  for (a = 0; a < 3; a++) {
+    bc.name = "nonblock_fail";
+    bc.block = RTLIM_NON_BLOCK;
+    bc.refill_interval_ns = 1000000000000ull;
+    bc.refill_token_amount = 64;
+    bc.take_token_amount = amounts[a];
+    bc.start_tokens = 0;
+    bc.batch = 1000;
+    run_case(&bc, ns_samples, cyc_samples);
+  }
+
+  /* Blocking takes that must wait one 20 us interval each. The excess of
+   * ns/op over 20000 is the cost (and imprecision) of the wait. (A wait
+   * this short is all spin for hybrid; see the 1 ms case.) */
+  for (b = 1; b < num_blocks; b++) {
+    bc.name = "refill_wait_20us";
+    bc.block = blocks[b];
+    bc.refill_interval_ns = 20000;
+    bc.refill_token_amount = 1;
+    bc.take_token_amount = 1;
+    bc.start_tokens = 0;
+    bc.batch = 10;
+    run_case(&bc, ns_samples, cyc_samples);
+  }
+
+  /* Blocking takes that wait one 1 ms interval each: long enough for
+   * hybrid to sleep most of it, then spin. */
+  for (b = 1; b < num_blocks; b++) {
+    bc.name = "refill_wait_1ms";
+    bc.block = blocks[b];
+    bc.refill_interval_ns = 1000000;
+    bc.refill_token_amount = 1;
+    bc.take_token_amount = 1;
+    bc.start_tokens = 0;
+    bc.batch = 1;
+    run_case(&bc, ns_samples, cyc_samples);
+  }
+
+  /* Bulk scheduling of a queued batch. */
+  run_schedule(10000, ns_samples, cyc_samples);
+
+  free(ns_samples);
+  free(cyc_samples);
+
+  return 0;
+}  /* main */
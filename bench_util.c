@@ -0,0 +1,147 @@
+/* bench_util.c - Shared helpers for the rtlim benchmark programs.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#include <sched.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "rtlim.h"
+#include "bench_util.h"
+
+
+unsigned long long bench_cycles()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return 0;
+#endif
+}  /* bench_cycles */
+
+
+unsigned long long bench_thread_cpu_ns()
+{
+  struct timespec ts;
+
+  FAILCHK(clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts));
+
+  return (unsigned long long)ts.tv_sec * 1000000000ll +
+    (unsigned long long)ts.tv_nsec;
+}  /* bench_thread_cpu_ns */
+
+
+int bench_pin_cpu(int cpu)
+{
+  cpu_set_t cpuset;
+
+  if (cpu < 0) {
+    return 0;
+  }
+
+  CPU_ZERO(&cpuset);
+  CPU_SET(cpu, &cpuset);
+  if (sched_setaffinity(0, sizeof(cpuset), &cpuset) != 0) {
+    return -1;
+  }
+
+  return 0;
+}  /* bench_pin_cpu */
+
+
+void bench_spin_ns(unsigned long long ns)
+{
+  unsigned long long end_ns = current_time_ns() + ns;
+
+  while (current_time_ns() < end_ns) {
+  }
+}  /* bench_spin_ns */
+
+
+static int double_cmp(const void *a, const void *b)
+{
+  double da = *(const double *)a;
+  double db = *(const double *)b;
+
+  return (da > db) - (da < db);
+}  /* double_cmp */
+
+
+double bench_quantile(const double *sorted, int count, double q)
+{
+  int index;
+
+  if (count <= 0) {
+    return 0.0;
+  }
+
+  /* Nearest-rank method. */
+  index = (int)ceil(q * count) - 1;
+  if (index < 0) {
+    index = 0;
+  }
+  if (index >= count) {
+    index = count - 1;
+  }
+
+  return sorted[index];
+}  /* bench_quantile */
+
+
+void bench_stats_calc(bench_stats_t *stats, double *samples, int count)
+{
+  double sum = 0.0;
+  double sumsq = 0.0;
+  int i;
+
+  memset(stats, 0, sizeof(*stats));
+  if (count <= 0) {
+    return;
+  }
+
+  qsort(samples, count, sizeof(double), double_cmp);
+
+  for (i = 0; i < count; i++) {
+    sum += samples[i];
+  }
+  stats->mean = sum / count;
+  for (i = 0; i < count; i++) {
+    double d = samples[i] - stats->mean;
+    sumsq += d * d;
+  }
+
+  stats->count = count;
+  stats->min = samples[0];
+  stats->max = samples[count - 1];
+  stats->var = sumsq / count;
+  stats->stddev = sqrt(stats->var);
+  stats->p50 = bench_quantile(samples, count, 0.50);
+  stats->p90 = bench_quantile(samples, count, 0.90);
+  stats->p99 = bench_quantile(samples, count, 0.99);
+  stats->p999 = bench_quantile(samples, count, 0.999);
+}  /* bench_stats_calc */
@@ -0,0 +1,87 @@
+/* bench_util.h - Shared helpers for the rtlim benchmark programs.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Primitive error handling - exit on error. Fine for test programs. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+#define FAILCHK(status_) do { \
+  if ((status_) == -1) { \
+    perror("Failed status"); \
+    fprintf(stderr, "Failure at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #status_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+
+/* Summary statistics over a set of samples (see bench_stats_calc()). */
+typedef struct bench_stats_s {
+  int count;
+  double min;
+  double max;
+  double mean;
+  double var;     /* Population variance. */
+  double stddev;
+  double p50;     /* Median. */
+  double p90;
+  double p99;
+  double p999;
+} bench_stats_t;
+
+
+/* Time stamp counter ticks (0 on platforms without one). */
+unsigned long long bench_cycles();
+/* CPU time consumed by the calling thread, in nanoseconds. */
+unsigned long long bench_thread_cpu_ns();
+/* Pin the calling thread to "cpu". Returns 0 on success, -1 on failure.
+ * A negative "cpu" leaves the affinity alone and returns 0. */
+int bench_pin_cpu(int cpu);
+/* Busy-loop for "ns" nanoseconds (simulated work, e.g. a send call). */
+void bench_spin_ns(unsigned long long ns);
+/* Fill "stats" from "samples". Sorts "samples" in place. */
+void bench_stats_calc(bench_stats_t *stats, double *samples, int count);
+/* Value at quantile "q" (0.0 .. 1.0) of already-sorted samples. */
+double bench_quantile(const double *sorted, int count, double q);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* BENCH_UTIL_H */
@@ -0,0 +1,377 @@
+/* bench_wait.c - Wake-up latency of the wait primitives rtlim could use.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* For each wait primitive and each requested duration, repeatedly waits
+ * for that duration and measures the overshoot (actual elapsed minus
+ * requested), along with the fraction of a CPU consumed while waiting.
+ * Results are CSV on stdout. A summary recommending which primitive to
+ * use for which wait lengths on this host is written to stderr.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/select.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "rtlim.h"
+#include "bench_util.h"
+
+
+/* Command-line options. */
+static int o_cpu = 0;
+static int o_budget_ms = 100;
+static int o_max_samples = 1000;
+static char *o_tag = "dev";
+
+static unsigned long long durations_ns[] = {
+  1000, 2000, 5000, 10000, 20000, 50000, 100000, 200000, 500000,
+  1000000, 2000000, 5000000, 10000000 };
+#define NUM_DURATIONS (sizeof(durations_ns) / sizeof(durations_ns[0]))
+
+/* Per-primitive context. */
+static int timer_fd = -1;
+static int epoll_fd = -1;
+static int futex_word = 0;
+static double tsc_per_ns = 0.0;  /* Zero if TPAUSE is unavailable. */
+
+
+char *usage_str = "Usage: bench_wait [-h] [-c cpu] [-b budget_ms] [-n max_samples] [-t tag]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -c cpu : CPU to pin to (-1 = no pinning) [%d]\n"
+      "  -b budget_ms : approximate time spent per primitive and duration [%d]\n"
+      "  -n max_samples : upper limit on samples per primitive and duration [%d]\n"
+      "  -t tag : label written to every output line (e.g. a version) [%s]\n"
+      , o_cpu, o_budget_ms, o_max_samples, o_tag);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hc:b:n:t:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'c': o_cpu = atoi(optarg); break;
+      case 'b': o_budget_ms = atoi(optarg); break;
+      case 'n': o_max_samples = atoi(optarg); break;
+      case 't': o_tag = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_budget_ms < 1) usage("budget must be > 0");
+  if (o_max_samples < 1) usage("max_samples must be > 0");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+void ns_to_timespec(unsigned long long ns, struct timespec *ts)
+{
+  ts->tv_sec = ns / 1000000000;
+  ts->tv_nsec = ns % 1000000000;
+}  /* ns_to_timespec */
+
+
+/* Each wait function waits until "deadline_ns" (monotonic), having been
+ * called at "start_ns" (deadline_ns - start_ns is the requested time). */
+
+void wait_select(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  unsigned long long delta_ns = deadline_ns - start_ns;
+  struct timeval tv;
+
+  tv.tv_sec = (delta_ns / 1000000000);
+  tv.tv_usec = ((delta_ns / 1000) % 1000000);
+  (void)select(1, NULL, NULL, NULL, &tv);
+}  /* wait_select */
+
+
+void wait_nanosleep(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  struct timespec ts;
+
+  ns_to_timespec(deadline_ns - start_ns, &ts);
+  (void)nanosleep(&ts, NULL);
+}  /* wait_nanosleep */
+
+
+void wait_clock_nanosleep_abs(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  struct timespec ts;
+
+  ns_to_timespec(deadline_ns, &ts);
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+  }
+}  /* wait_clock_nanosleep_abs */
+
+
+void wait_timerfd_epoll(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  struct itimerspec its;
+  struct epoll_event ev;
+  unsigned long long expirations;
+
+  memset(&its, 0, sizeof(its));
+  ns_to_timespec(deadline_ns, &its.it_value);
+  FAILCHK(timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &its, NULL));
+  while (epoll_wait(epoll_fd, &ev, 1, -1) != 1) {
+  }
+  FAILCHK((int)read(timer_fd, &expirations, sizeof(expirations)));
+}  /* wait_timerfd_epoll */
+
+
+void wait_futex(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  struct timespec ts;
+
+  /* FUTEX_WAIT_BITSET takes an absolute CLOCK_MONOTONIC timeout. Nobody
+   * ever wakes the word, so this always times out. */
+  ns_to_timespec(deadline_ns, &ts);
+  while (syscall(SYS_futex, &futex_word, FUTEX_WAIT_BITSET | FUTEX_PRIVATE_FLAG,
+    0, &ts, NULL, FUTEX_BITSET_MATCH_ANY) == -1 && errno == EINTR) {
+  }
+}  /* wait_futex */
+
+
+void wait_yield(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  while (current_time_ns() < deadline_ns) {
+    sched_yield();
+  }
+}  /* wait_yield */
+
+
+void wait_spin(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  while (current_time_ns() < deadline_ns) {
+  }
+}  /* wait_spin */
+
+
+void wait_pause(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  while (current_time_ns() < deadline_ns) {
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+  }
+}  /* wait_pause */
+
+
+#if defined(__x86_64__) || defined(__i386__)
+/* TPAUSE (WAITPKG) sleeps in C0.1/C0.2 until a TSC deadline, or until
+ * the OS-imposed maximum (IA32_UMWAIT_CONTROL), so loop on the TSC. It is
+ * emitted as bytes so the program builds without -mwaitpkg. */
+void wait_tpause(unsigned long long start_ns, unsigned long long deadline_ns)
+{
+  unsigned long long deadline_tsc = bench_cycles() +
+    (unsigned long long)((deadline_ns - start_ns) * tsc_per_ns);
+
+  while (bench_cycles() < deadline_tsc) {
+    unsigned int lo = (unsigned int)deadline_tsc;
+    unsigned int hi = (unsigned int)(deadline_tsc >> 32);
+    /* tpause %ecx, with ecx=0 requesting the deeper C0.2 state. */
+    __asm__ volatile(".byte 0x66, 0x0f, 0xae, 0xf1"
+      : : "c"(0), "a"(lo), "d"(hi) : "cc", "memory");
+  }
+}  /* wait_tpause */
+
+
+int tpause_supported()
+{
+  unsigned int eax, ebx, ecx, edx;
+
+  if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) == 0) {
+    return 0;
+  }
+  return (ecx & (1 << 5)) != 0;  /* CPUID.7.0:ECX.WAITPKG */
+}  /* tpause_supported */
+#endif
+
+
+/* Measure the TSC rate against the monotonic clock. */
+double calibrate_tsc_per_ns()
+{
+  unsigned long long start_ns, start_tsc, end_ns, end_tsc;
+
+  start_ns = current_time_ns();
+  start_tsc = bench_cycles();
+  wait_spin(start_ns, start_ns + 20000000);  /* 20 ms */
+  end_tsc = bench_cycles();
+  end_ns = current_time_ns();
+
+  return (double)(end_tsc - start_tsc) / (end_ns - start_ns);
+}  /* calibrate_tsc_per_ns */
+
+
+typedef void (*wait_fn_t)(unsigned long long start_ns, unsigned long long deadline_ns);
+
+typedef struct primitive_s {
+  char *name;
+  wait_fn_t wait_fn;
+  int sleeps;  /* Gives the CPU to other threads while waiting. */
+  double p99_ns[NUM_DURATIONS];
+  double cpu_pct[NUM_DURATIONS];
+} primitive_t;
+
+
+void run_primitive(primitive_t *prim, double *samples)
+{
+  int d;
+
+  for (d = 0; d < NUM_DURATIONS; d++) {
+    unsigned long long req_ns = durations_ns[d];
+    unsigned long long wall_start_ns, wall_end_ns, cpu_start_ns, cpu_end_ns;
+    bench_stats_t stats;
+    int num_samples, i;
+
+    num_samples = (int)(((unsigned long long)o_budget_ms * 1000000) / req_ns);
+    if (num_samples > o_max_samples) num_samples = o_max_samples;
+    if (num_samples < 10) num_samples = 10;
+
+    /* Warm up (page faults, timer slack, frequency ramp). */
+    for (i = 0; i < 3; i++) {
+      unsigned long long start_ns = current_time_ns();
+      (*prim->wait_fn)(start_ns, start_ns + req_ns);
+    }
+
+    wall_start_ns = current_time_ns();
+    cpu_start_ns = bench_thread_cpu_ns();
+    for (i = 0; i < num_samples; i++) {
+      unsigned long long start_ns = current_time_ns();
+      (*prim->wait_fn)(start_ns, start_ns + req_ns);
+      samples[i] = (double)(current_time_ns() - start_ns) - (double)req_ns;
+    }
+    cpu_end_ns = bench_thread_cpu_ns();
+    wall_end_ns = current_time_ns();
+
+    bench_stats_calc(&stats, samples, num_samples);
+    prim->p99_ns[d] = stats.p99;
+    prim->cpu_pct[d] = (double)(cpu_end_ns - cpu_start_ns) * 100.0 /
+      (wall_end_ns - wall_start_ns);
+
+    printf("%s,%s,%llu,%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.1f\n",
+      o_tag, prim->name, req_ns, num_samples, stats.min, stats.p50,
+      stats.p90, stats.p99, stats.max, prim->cpu_pct[d]);
+    fflush(stdout);
+  }
+}  /* run_primitive */
+
+
+int main(int argc, char **argv)
+{
+  static primitive_t prims[] = {
+    { "select", wait_select, 1 },
+    { "nanosleep", wait_nanosleep, 1 },
+    { "clock_nanosleep_abs", wait_clock_nanosleep_abs, 1 },
+    { "timerfd_epoll", wait_timerfd_epoll, 1 },
+    { "futex", wait_futex, 1 },
+    { "sched_yield", wait_yield, 0 },
+    { "spin", wait_spin, 0 },
+    { "pause_spin", wait_pause, 0 },
+#if defined(__x86_64__) || defined(__i386__)
+    { "tpause", wait_tpause, 0 },
+#endif
+  };
+  int num_prims = sizeof(prims) / sizeof(prims[0]);
+  struct epoll_event ev;
+  double *samples;
+  int p, d;
+
+  get_my_opts(argc, argv);
+
+  if (bench_pin_cpu(o_cpu) != 0) {
+    fprintf(stderr, "Warning, could not pin to CPU %d\n", o_cpu);
+  }
+
+  samples = (double *)malloc(o_max_samples * sizeof(double));
+  NULLCHK(samples);
+
+  timer_fd = timerfd_create(CLOCK_MONOTONIC, 0);
+  FAILCHK(timer_fd);
+  epoll_fd = epoll_create1(0);
+  FAILCHK(epoll_fd);
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  FAILCHK(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &ev));
+
+#if defined(__x86_64__) || defined(__i386__)
+  if (tpause_supported()) {
+    tsc_per_ns = calibrate_tsc_per_ns();
+  }
+  else {
+    fprintf(stderr, "Note: TPAUSE (WAITPKG) not supported on this CPU, skipping.\n");
+    num_prims--;  /* tpause is last. */
+  }
+#endif
+
+  printf("tag,primitive,req_ns,samples,over_min,over_p50,over_p90,over_p99,over_max,cpu_pct\n");
+  for (p = 0; p < num_prims; p++) {
+    run_primitive(&prims[p], samples);
+  }
+
+  /* Recommendation: for each duration, the sleeping primitive with the
+   * best p99 overshoot, and whether it is within 10% of the request (if
+   * not, spinning is the only precise choice at that duration). */
+  fprintf(stderr, "\nRecommended wait strategy on this host (p99 overshoot):\n");
+  for (d = 0; d < NUM_DURATIONS; d++) {
+    int best = -1;
+    for (p = 0; p < num_prims; p++) {
+      if (prims[p].sleeps && (best == -1 || prims[p].p99_ns[d] < prims[best].p99_ns[d])) {
+        best = p;
+      }
+    }
+    fprintf(stderr, "  %8llu ns: %-20s p99 over %8.0f ns -> %s\n",
+      durations_ns[d], prims[best].name, prims[best].p99_ns[d],
+      (prims[best].p99_ns[d] <= durations_ns[d] / 10) ? "sleep" : "spin");
+  }
+
+  close(epoll_fd);
+  close(timer_fd);
+  free(samples);
+
+  return 0;
+}  /* main */
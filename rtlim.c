@@ -26,7 +26,12 @@
 #include <unistd.h>
 #include <time.h>
 #include <errno.h>
+#include <limits.h>
 #include <sys/select.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
 
 #include "rtlim.h"
 
@@ -52,25 +57,268 @@
 } while (0);
 
 
-/* Monotonic clock (not "wall clock") with nanosecond precision.
- * Retuens: 64-bit unsigned number of nanoseconds.
- */
-unsigned long long current_time_ns()
+/* Read a clock_gettime() clock in nanoseconds. */
+static unsigned long long clock_ns(clockid_t clock_id)
 {
   struct timespec cur_timespec;
   int status;
   unsigned long long rtn_time;
 
-  status = clock_gettime(CLOCK_MONOTONIC, &cur_timespec);
+  status = clock_gettime(clock_id, &cur_timespec);
   FAILCHK(status);
 
   rtn_time = (unsigned long long)cur_timespec.tv_sec * 1000000000ll +
     (unsigned long long)cur_timespec.tv_nsec;
 
   return rtn_time;
+}  /* clock_ns */
+
+
+/* Monotonic clock (not "wall clock") with nanosecond precision.
+ * Retuens: 64-bit unsigned number of nanoseconds.
+ */
+unsigned long long current_time_ns()
+{
+  return clock_ns(CLOCK_MONOTONIC);
 }  /* current_time_ns */
 
 
+#if defined(__x86_64__)
+/* Time stamp counter, converted to nanoseconds with a fixed-point (32.32)
+ * multiplier measured against CLOCK_MONOTONIC the first time a limiter
+ * selects RTLIM_CLOCK_TSC. Values are aligned to CLOCK_MONOTONIC at that
+ * moment, but drift from it slowly (the calibration is not perfect). */
+static unsigned long long tsc_base_tsc = 0;
+static unsigned long long tsc_base_ns = 0;
+static unsigned long long tsc_mult = 0;
+
+static int tsc_calibrate()
+{
+  unsigned int eax, ebx, ecx, edx;
+  unsigned long long start_ns, start_tsc, end_ns, end_tsc;
+
+  if (tsc_mult != 0) {
+    return 0;  /* Already calibrated. */
+  }
+
+  /* Only an invariant TSC (constant rate, runs in all C-states) is usable. */
+  if (__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) == 0 ||
+      (edx & (1 << 8)) == 0) {
+    return -1;
+  }
+
+  start_ns = current_time_ns();
+  start_tsc = __rdtsc();
+  do {
+    end_ns = current_time_ns();
+  } while (end_ns - start_ns < 10000000);  /* 10 ms */
+  end_tsc = __rdtsc();
+
+  tsc_mult = (unsigned long long)(((unsigned __int128)(end_ns - start_ns) << 32) /
+    (end_tsc - start_tsc));
+  tsc_base_tsc = end_tsc;
+  tsc_base_ns = end_ns;
+
+  return 0;
+}  /* tsc_calibrate */
+
+static unsigned long long tsc_time_ns()
+{
+  return tsc_base_ns +
+    (unsigned long long)(((unsigned __int128)(__rdtsc() - tsc_base_tsc) * tsc_mult) >> 32);
+}  /* tsc_time_ns */
+#endif
+
+
+/* API to read the rtlim object's clock (nanoseconds). */
+unsigned long long rtlim_now(rtlim_t *rtlim)
+{
+  switch (rtlim->clock_type) {
+    case RTLIM_CLOCK_MONOTONIC_COARSE:
+      return clock_ns(CLOCK_MONOTONIC_COARSE);
+    case RTLIM_CLOCK_MONOTONIC_RAW:
+      return clock_ns(CLOCK_MONOTONIC_RAW);
+#if defined(__x86_64__)
+    case RTLIM_CLOCK_TSC:
+      return tsc_time_ns();
+#endif
+    case RTLIM_CLOCK_CALLBACK:
+      return (*rtlim->clock_cb)(rtlim->clock_clientd);
+    case RTLIM_CLOCK_VIRTUAL:
+      return ((rtlim_vclock_t *)rtlim->clock_clientd)->now_ns;
+    case RTLIM_CLOCK_TIMEKEEPER:
+      return ((rtlim_tkclock_t *)rtlim->clock_clientd)->now_ns;
+  }
+
+  return current_time_ns();
+}  /* rtlim_now */
+
+
+/* Wait for the limiter's clock to reach "until_ns" (or thereabouts; the
+ * caller re-reads the clock). A virtual clock is advanced instead.
+ * Returns 1 if it slept, 0 if the caller is to spin. */
+static int rtlim_wait(rtlim_t *rtlim, unsigned long long until_ns, int block)
+{
+  if (block == RTLIM_BLOCK_HYBRID) {
+    /* Sleep through all but the last part of the wait, then spin. */
+    if (until_ns > rtlim->cur_ns + RTLIM_HYBRID_SPIN_NS) {
+      until_ns -= RTLIM_HYBRID_SPIN_NS;
+      block = RTLIM_BLOCK_SLEEP;
+    }
+    else {
+      block = RTLIM_BLOCK_SPIN;
+    }
+  }
+
+  if (rtlim->clock_type == RTLIM_CLOCK_VIRTUAL) {
+    rtlim_vclock_t *vclock = (rtlim_vclock_t *)rtlim->clock_clientd;
+    if (vclock->now_ns < until_ns) {
+      vclock->now_ns = until_ns;
+    }
+  }
+  else if (block == RTLIM_BLOCK_SLEEP) {
+    /* How many microseconds to wait? */
+    unsigned long long delta_ns;
+    delta_ns = until_ns - rtlim->cur_ns;
+    if (delta_ns > 0) {
+      struct timeval tv;
+      tv.tv_sec = (delta_ns / 1000000000);
+      tv.tv_usec = ((delta_ns / 1000) % 1000000);
+      (void)select(1, NULL, NULL, NULL, &tv);
+    }
+  }
+  /* For RTLIM_BLOCK_SPIN, return right away; the caller busy loops. */
+
+  return (block == RTLIM_BLOCK_SLEEP);
+}  /* rtlim_wait */
+
+
+/* The block mode to wait with when the caller asked for "block". */
+static int gov_block(rtlim_gov_t *gov, int block)
+{
+  if (block == RTLIM_BLOCK_SPIN) {
+    return gov->block;
+  }
+  if (block == RTLIM_BLOCK_HYBRID && gov->block == RTLIM_BLOCK_SLEEP) {
+    return RTLIM_BLOCK_SLEEP;
+  }
+  return block;
+}  /* gov_block */
+
+
+/* Rolling estimate of a per-window total: all of this window plus the
+ * part of the previous one that is still inside "window_ns" of now. */
+static unsigned long long gov_estimate(rtlim_gov_t *gov,
+  unsigned long long *totals, unsigned long long now_ns)
+{
+  unsigned long long elapsed_ns = (now_ns > gov->window_start_ns) ? now_ns - gov->window_start_ns : 0;
+
+  return totals[0] + (unsigned long long)((double)totals[1] *
+    (gov->window_ns - elapsed_ns) / gov->window_ns);
+}  /* gov_estimate */
+
+
+/* Charge the governor for waiting from "start_ns" to "end_ns" towards
+ * "until_ns", as the caller asked with "block", and re-evaluate. Waits
+ * are charged what the caller's mode, and the hybrid mode, would spin,
+ * whatever they actually did, so that a downgrade can be lifted. */
+static void gov_charge(rtlim_gov_t *gov, rtlim_t *rtlim, int block,
+  unsigned long long start_ns, unsigned long long end_ns,
+  unsigned long long until_ns)
+{
+  unsigned long long hybrid_start_ns, hybrid_ns, demand, hybrid;
+  int new_block;
+
+  if (end_ns >= gov->window_start_ns + gov->window_ns) {
+    unsigned long long windows = (end_ns - gov->window_start_ns) / gov->window_ns;
+    gov->demand_ns[1] = (windows == 1) ? gov->demand_ns[0] : 0;
+    gov->hybrid_ns[1] = (windows == 1) ? gov->hybrid_ns[0] : 0;
+    gov->demand_ns[0] = gov->hybrid_ns[0] = 0;
+    gov->window_start_ns += windows * gov->window_ns;
+  }
+
+  /* Part of the wait within RTLIM_HYBRID_SPIN_NS of its end. */
+  hybrid_start_ns = (until_ns > RTLIM_HYBRID_SPIN_NS) ? until_ns - RTLIM_HYBRID_SPIN_NS : 0;
+  if (hybrid_start_ns < start_ns) {
+    hybrid_start_ns = start_ns;
+  }
+  hybrid_ns = (end_ns > hybrid_start_ns) ? end_ns - hybrid_start_ns : 0;
+
+  /* A sleeping caller never spins, whatever the governor's mode, so it
+   * charges nothing. */
+  if (block == RTLIM_BLOCK_SPIN) {
+    gov->demand_ns[0] += end_ns - start_ns;
+    gov->hybrid_ns[0] += hybrid_ns;
+  }
+  else if (block == RTLIM_BLOCK_HYBRID) {
+    gov->demand_ns[0] += hybrid_ns;
+    gov->hybrid_ns[0] += hybrid_ns;
+  }
+
+  demand = gov_estimate(gov, gov->demand_ns, end_ns);
+  hybrid = gov_estimate(gov, gov->hybrid_ns, end_ns);
+  /* Lifting a downgrade needs the estimate under half the budget, so the
+   * mode doesn't flap around the limit. */
+  if (demand <= ((gov->block == RTLIM_BLOCK_SPIN) ? gov->budget_ns : gov->budget_ns / 2)) {
+    new_block = RTLIM_BLOCK_SPIN;
+  }
+  else if (hybrid <= ((gov->block == RTLIM_BLOCK_SLEEP) ? gov->budget_ns / 2 : gov->budget_ns)) {
+    new_block = RTLIM_BLOCK_HYBRID;
+  }
+  else {
+    new_block = RTLIM_BLOCK_SLEEP;
+  }
+
+  if (new_block != gov->block) {
+    /* SPIN < HYBRID < SLEEP in how little they spin. */
+    if (new_block == RTLIM_BLOCK_SLEEP || gov->block == RTLIM_BLOCK_SPIN) {
+      gov->degrades++;
+    }
+    else {
+      gov->restores++;
+    }
+    gov->block = new_block;
+    if (gov->report_cb != NULL) {
+      (*gov->report_cb)(gov, rtlim, new_block, gov->report_clientd);
+    }
+  }
+}  /* gov_charge */
+
+
+/* One step of a blocking wait towards "until_ns" (a sleep, or one pass
+ * of a spin), then re-read the clock. Applies the governor, if any. */
+static void rtlim_wait_step(rtlim_t *rtlim, unsigned long long until_ns, int block)
+{
+  unsigned long long start_ns = rtlim->cur_ns;
+  int slept;
+
+  if (rtlim->gov == NULL) {
+    (void)rtlim_wait(rtlim, until_ns, block);
+    rtlim->cur_ns = rtlim_now(rtlim);
+    return;
+  }
+
+  slept = rtlim_wait(rtlim, until_ns, gov_block(rtlim->gov, block));
+  rtlim->cur_ns = rtlim_now(rtlim);
+  if (! slept) {
+    rtlim->gov->spin_ns += rtlim->cur_ns - start_ns;
+  }
+  gov_charge(rtlim->gov, rtlim, block, start_ns, rtlim->cur_ns, until_ns);
+}  /* rtlim_wait_step */
+
+
+/* API to wait until the rtlim object's clock reaches "until_ns", using
+ * the same waits as a blocking rtlim_take() ("block" is RTLIM_BLOCK_SPIN,
+ * RTLIM_BLOCK_SLEEP or RTLIM_BLOCK_HYBRID). Doesn't touch the tokens. */
+void rtlim_wait_until(rtlim_t *rtlim, unsigned long long until_ns, int block)
+{
+  rtlim->cur_ns = rtlim_now(rtlim);
+  while (rtlim->cur_ns < until_ns) {
+    rtlim_wait_step(rtlim, until_ns, block);
+  }
+}  /* rtlim_wait_until */
+
+
 /* API to create rtlim object. */
 rtlim_t *rtlim_create(unsigned long long refill_interval_ns, int refill_token_amount)
 {
@@ -82,6 +330,15 @@ rtlim_t *rtlim_create(unsigned long long refill_interval_ns, int refill_token_am
   rtlim->refill_interval_ns = refill_interval_ns;
   rtlim->refill_token_amount = refill_token_amount;
   rtlim->current_tokens = refill_token_amount;  /* Fill rate limiter. */
+  rtlim->owed_tokens = 0;
+  rtlim->duty_begin_ns = 0;
+  rtlim->clock_type = RTLIM_CLOCK_MONOTONIC;
+  rtlim->clock_cb = NULL;
+  rtlim->clock_clientd = NULL;
+  rtlim->shadow = NULL;
+  rtlim->refiller = NULL;
+  rtlim->refiller_index = -1;
+  rtlim->gov = NULL;
   rtlim->cur_ns = rtlim->last_refill_ns = current_time_ns();
 
   return rtlim;
@@ -95,9 +352,258 @@ void rtlim_delete(rtlim_t *rtlim)
 }  /* rtlim_delete */
 
 
+/* API to select the clock used by an rtlim object.
+ * For RTLIM_CLOCK_CALLBACK, "clock_cb" is called with "clock_clientd".
+ * For RTLIM_CLOCK_VIRTUAL, "clock_clientd" points at an rtlim_vclock_t.
+ * For RTLIM_CLOCK_TIMEKEEPER, "clock_clientd" points at an rtlim_tkclock_t.
+ * Other clock types ignore both. The refill interval restarts at the
+ * new clock's current time; the token count is unchanged.
+ * Returns:
+ *    0 for success,
+ *   -1 for an invalid or unsupported clock (e.g. no invariant TSC), or
+ *      if a refiller owns the limiter's schedule (see "rtlim_refill.c").
+ */
+int rtlim_set_clock(rtlim_t *rtlim, int clock_type, rtlim_clock_cb_t clock_cb,
+  void *clock_clientd)
+{
+  if (rtlim->refiller != NULL) {
+    return -1;
+  }
+
+  switch (clock_type) {
+    case RTLIM_CLOCK_MONOTONIC:
+    case RTLIM_CLOCK_MONOTONIC_COARSE:
+    case RTLIM_CLOCK_MONOTONIC_RAW:
+      break;
+    case RTLIM_CLOCK_TSC:
+#if defined(__x86_64__)
+      if (tsc_calibrate() != 0) {
+        return -1;
+      }
+      break;
+#else
+      return -1;
+#endif
+    case RTLIM_CLOCK_CALLBACK:
+      if (clock_cb == NULL) {
+        return -1;
+      }
+      break;
+    case RTLIM_CLOCK_VIRTUAL:
+    case RTLIM_CLOCK_TIMEKEEPER:
+      if (clock_clientd == NULL) {
+        return -1;
+      }
+      break;
+    default:
+      return -1;
+  }
+
+  rtlim->clock_type = clock_type;
+  rtlim->clock_cb = clock_cb;
+  rtlim->clock_clientd = clock_clientd;
+  rtlim->cur_ns = rtlim->last_refill_ns = rtlim_now(rtlim);
+
+  return 0;
+}  /* rtlim_set_clock */
+
+
+/* API to create a shadow limiter with its own configuration. */
+rtlim_shadow_t *rtlim_shadow_create(unsigned long long refill_interval_ns,
+  int refill_token_amount)
+{
+  rtlim_shadow_t *shadow;
+
+  shadow = (rtlim_shadow_t *)malloc(sizeof(rtlim_shadow_t));
+  NULLCHK(shadow);
+  memset(shadow, 0, sizeof(*shadow));
+
+  shadow->rtlim = rtlim_create(refill_interval_ns, refill_token_amount);
+  /* Starts full at time 0, so the first take refills it anyway. */
+  (void)rtlim_set_clock(shadow->rtlim, RTLIM_CLOCK_VIRTUAL, NULL, &shadow->vclock);
+
+  return shadow;
+}  /* rtlim_shadow_create */
+
+
+/* API to delete a shadow limiter. Detach it first (rtlim_set_shadow()). */
+void rtlim_shadow_delete(rtlim_shadow_t *shadow)
+{
+  rtlim_delete(shadow->rtlim);
+  free(shadow);
+}  /* rtlim_shadow_delete */
+
+
+/* API to attach a shadow limiter to "rtlim" (NULL detaches). A shadow
+ * may be moved between limiters, but only attached to one at a time.
+ * A shadow is not thread-safe, so it can't be attached to a limiter
+ * refilled in the background (see "rtlim_refill.c"), which many threads
+ * may take from.
+ * Returns 0 for success, -1 if a refiller owns "rtlim". */
+int rtlim_set_shadow(rtlim_t *rtlim, rtlim_shadow_t *shadow)
+{
+  if (shadow != NULL && rtlim->refiller != NULL) {
+    return -1;
+  }
+  rtlim->shadow = shadow;
+
+  return 0;
+}  /* rtlim_set_shadow */
+
+
+/* API to create a spin governor (see rtlim.h). "report_cb" (may be NULL)
+ * is called with "report_clientd" each time the governor changes the
+ * mode it allows. Returns NULL for a zero window or budget. */
+rtlim_gov_t *rtlim_gov_create(unsigned long long window_ns,
+  unsigned long long budget_ns, rtlim_gov_cb_t report_cb, void *report_clientd)
+{
+  rtlim_gov_t *gov;
+
+  if (window_ns == 0 || budget_ns == 0) {
+    return NULL;
+  }
+
+  gov = (rtlim_gov_t *)malloc(sizeof(rtlim_gov_t));
+  NULLCHK(gov);
+  memset(gov, 0, sizeof(*gov));
+
+  gov->window_ns = window_ns;
+  gov->budget_ns = budget_ns;
+  gov->report_cb = report_cb;
+  gov->report_clientd = report_clientd;
+  gov->block = RTLIM_BLOCK_SPIN;
+
+  return gov;
+}  /* rtlim_gov_create */
+
+
+/* API to delete a spin governor. Detach it first (rtlim_set_gov()). */
+void rtlim_gov_delete(rtlim_gov_t *gov)
+{
+  free(gov);
+}  /* rtlim_gov_delete */
+
+
+/* API to attach a spin governor to "rtlim" (NULL detaches). Limiters
+ * sharing a governor must be used from one thread and share a clock. */
+void rtlim_set_gov(rtlim_t *rtlim, rtlim_gov_t *gov)
+{
+  if (gov != NULL && gov->window_start_ns == 0) {
+    gov->window_start_ns = rtlim_now(rtlim);
+  }
+  rtlim->gov = gov;
+}  /* rtlim_set_gov */
+
+
+/* Evaluate a take at "now_ns" on the shadow. A take that the shadow would
+ * have delayed advances its virtual clock, so a later take can also be
+ * delayed while the shadow's sender would still have been waiting. */
+static void shadow_take(rtlim_shadow_t *shadow, unsigned long long now_ns,
+  int take_token_amount, int block)
+{
+  unsigned long long delay_ns;
+
+  if (shadow->vclock.now_ns < now_ns) {
+    shadow->vclock.now_ns = now_ns;
+  }
+  shadow->takes++;
+  if (rtlim_take(shadow->rtlim, take_token_amount, block) != 0) {
+    shadow->rejects++;
+  }
+  delay_ns = shadow->vclock.now_ns - now_ns;
+  if (delay_ns > 0) {
+    shadow->blocks++;
+    shadow->block_ns += delay_ns;
+    if (delay_ns > shadow->max_block_ns) {
+      shadow->max_block_ns = delay_ns;
+    }
+  }
+}  /* shadow_take */
+
+
+/* How long a sleeping background_take() waits when the refill it waits
+ * for is already due (the refiller is running late). */
+#ifndef RTLIM_LATE_SLEEP_NS
+#define RTLIM_LATE_SLEEP_NS 10000
+#endif
+
+/* Take for a limiter refilled in the background by a refiller (see
+ * "rtlim_refill.c"), which owns last_refill_ns and resets current_tokens.
+ * Safe to call from several threads. Never reads the clock, except to
+ * sleep until the next refill. */
+static int background_take(rtlim_t *rtlim, int take_token_amount, int block)
+{
+  volatile int *tokens = &rtlim->current_tokens;
+
+  for (;;) {
+    int cur = *tokens;
+    int got = (cur < take_token_amount) ? cur : take_token_amount;
+
+    if (block == RTLIM_NON_BLOCK && got < take_token_amount) {
+      return -1;
+    }
+    if (got > 0 && ! __sync_bool_compare_and_swap(tokens, cur, cur - got)) {
+      continue;  /* Another taker, or a refill, got in first. */
+    }
+    take_token_amount -= got;
+    if (take_token_amount == 0) {
+      return 0;
+    }
+
+    /* For blocking, took all available tokens; wait for more. Spinning
+     * just watches the tokens. Sleeping waits for the next scheduled
+     * refill, on a private copy since others may be waiting too. (So
+     * the governor, which is not thread-safe, does not apply.) */
+    if (block != RTLIM_BLOCK_SPIN) {
+      rtlim_t waiter = *rtlim;
+      unsigned long long until_ns = rtlim->last_refill_ns + rtlim->refill_interval_ns;
+      waiter.cur_ns = rtlim_now(&waiter);
+      if (waiter.cur_ns < until_ns) {
+        rtlim_wait(&waiter, until_ns, block);
+      }
+      else {  /* Refiller is late; don't busy loop waiting for it. */
+        rtlim_wait(&waiter, waiter.cur_ns + RTLIM_LATE_SLEEP_NS, RTLIM_BLOCK_SLEEP);
+      }
+    }
+  }
+}  /* background_take */
+
+
+/* Start a new refill interval at cur_ns if the last one is over. Tokens
+ * are normally just reset; tokens owed (by rtlim_duty_end()) are paid off
+ * at refill_token_amount per interval that has passed. Debt too big for
+ * current_tokens waits in owed_tokens, with current_tokens at INT_MIN. */
+static void rtlim_refill(rtlim_t *rtlim)
+{
+  if (rtlim->cur_ns >= rtlim->last_refill_ns + rtlim->refill_interval_ns) {
+    if (rtlim->current_tokens < 0) {
+      unsigned long long intervals =
+        (rtlim->cur_ns - rtlim->last_refill_ns) / rtlim->refill_interval_ns;
+      long long tokens;
+      if (intervals > INT_MAX) {
+        intervals = INT_MAX;
+      }
+      tokens = rtlim->current_tokens + (long long)(rtlim->refill_token_amount * intervals);
+      if (rtlim->owed_tokens > 0) {
+        unsigned long long room = (unsigned long long)(tokens - INT_MIN);
+        unsigned long long paid = (rtlim->owed_tokens < room) ? rtlim->owed_tokens : room;
+        tokens -= (long long)paid;
+        rtlim->owed_tokens -= paid;
+      }
+      rtlim->current_tokens = (tokens < (long long)rtlim->refill_token_amount) ?
+        (int)tokens : (int)rtlim->refill_token_amount;
+    }
+    else {
+      rtlim->current_tokens = rtlim->refill_token_amount;  /* refill */
+    }
+    rtlim->last_refill_ns = rtlim->cur_ns;
+  }
+}  /* rtlim_refill */
+
+
 /* API to request tokens from rtlim object.
  * The "block" parameter must one of: RTLIM_BLOCK_SPIN, RTLIM_BLOCK_SLEEP,
- *   RTLIM_NON_BLOCK.
+ *   RTLIM_BLOCK_HYBRID, RTLIM_NON_BLOCK.
  * Returns:
  *    0 for success,
  *   -1 for tokens not availale.
@@ -106,18 +612,24 @@ void rtlim_delete(rtlim_t *rtlim)
 int rtlim_take(rtlim_t *rtlim, int take_token_amount, int block)
 {
   if ((block == RTLIM_NON_BLOCK) && take_token_amount > rtlim->refill_token_amount) {
+    if (rtlim->shadow != NULL) {
+      shadow_take(rtlim->shadow, rtlim_now(rtlim), take_token_amount, block);
+    }
     return -2;
   }
+  if (rtlim->refiller != NULL) {
+    return background_take(rtlim, take_token_amount, block);
+  }
+
+  rtlim->cur_ns = rtlim_now(rtlim);
+  if (rtlim->shadow != NULL) {
+    shadow_take(rtlim->shadow, rtlim->cur_ns, take_token_amount, block);
+  }
 
   /* For blocking, this do loop can busy loop until enough tokens are earned. */
   do {
-    rtlim->cur_ns = current_time_ns();
-
     /* Has an interval of time passed since the last refill? */
-    if (rtlim->cur_ns >= rtlim->last_refill_ns + rtlim->refill_interval_ns) {
-      rtlim->current_tokens = rtlim->refill_token_amount;  /* refill */
-      rtlim->last_refill_ns = rtlim->cur_ns;
-    }
+    rtlim_refill(rtlim);
 
     /* Does rate limiter have enough tokens for the request? */
     if (take_token_amount <= rtlim->current_tokens) {
@@ -133,18 +645,7 @@ int rtlim_take(rtlim_t *rtlim, int take_token_amount, int block)
         /* For blocking, take all available tokens and wait for more. */
         take_token_amount -= rtlim->current_tokens;
         rtlim->current_tokens = 0;
-        if (block == RTLIM_BLOCK_SLEEP) {
-          /* How many microseconds to wait? */
-          unsigned long long delta_ns;
-          delta_ns = (rtlim->last_refill_ns + rtlim->refill_interval_ns) -
-                    rtlim->cur_ns;
-          if (delta_ns > 0) {
-            struct timeval tv;
-            tv.tv_sec = (delta_ns / 1000000000);
-            tv.tv_usec = ((delta_ns / 1000) % 1000000);
-            (void)select(1, NULL, NULL, NULL, &tv);
-          }
-        }
+        rtlim_wait_step(rtlim, rtlim->last_refill_ns + rtlim->refill_interval_ns, block);
       }
     }
   } while (take_token_amount > 0);
@@ -153,9 +654,168 @@ int rtlim_take(rtlim_t *rtlim, int take_token_amount, int block)
 }  /* rtlim_take */
 
 
+/* API to begin an operation whose share of time is limited (a duty
+ * cycle). Tokens are nanoseconds: e.g. rtlim_create(10000000, 3000000)
+ * allows 30% of each 10 ms. As refill_token_amount is an int, an
+ * interval's time can be at most INT_MAX ns (about 2.147 seconds).
+ * Waits, if the operations have used up the current interval's time, for
+ * an interval that has some left. The clock reading it begins at is kept
+ * (in duty_begin_ns, which nothing else touches) for rtlim_duty_end().
+ * The "block" parameter must be one of: RTLIM_BLOCK_SPIN,
+ *   RTLIM_BLOCK_SLEEP, RTLIM_BLOCK_HYBRID, RTLIM_NON_BLOCK.
+ * Returns:
+ *    0 for success (call rtlim_duty_end() when the operation is done),
+ *   -1 for no time left and RTLIM_NON_BLOCK,
+ *   -2 if a refiller owns the limiter (see "rtlim_refill.c"), which
+ *      would reset away the debt of an overrun.
+ */
+int rtlim_duty_begin(rtlim_t *rtlim, int block)
+{
+  if (rtlim->refiller != NULL) {
+    return -2;
+  }
+
+  rtlim->cur_ns = rtlim_now(rtlim);
+  for (;;) {
+    rtlim_refill(rtlim);
+    if (rtlim->current_tokens > 0) {
+      rtlim->duty_begin_ns = rtlim->cur_ns;
+      return 0;
+    }
+    if (block == RTLIM_NON_BLOCK) {
+      return -1;
+    }
+    rtlim_wait_step(rtlim, rtlim->last_refill_ns + rtlim->refill_interval_ns, block);
+  }
+}  /* rtlim_duty_begin */
+
+
+/* API to end an operation started by rtlim_duty_begin(), charging the
+ * time since then as tokens. An operation that overran the time left
+ * puts the limiter in debt, which delays later begins until it is paid
+ * off. Debt beyond what current_tokens holds (INT_MIN) is kept in
+ * owed_tokens, so however long the overrun, all of it is paid. Other
+ * calls on the limiter in between don't change the time charged. */
+void rtlim_duty_end(rtlim_t *rtlim)
+{
+  unsigned long long used_ns;
+  long long tokens;
+
+  rtlim->cur_ns = rtlim_now(rtlim);
+  used_ns = rtlim->cur_ns - rtlim->duty_begin_ns;
+  if (used_ns > (unsigned long long)INT_MAX * 2) {
+    rtlim->owed_tokens += used_ns - (unsigned long long)INT_MAX * 2;
+    used_ns = (unsigned long long)INT_MAX * 2;
+  }
+  tokens = rtlim->current_tokens - (long long)used_ns;
+  if (tokens < INT_MIN) {
+    rtlim->owed_tokens += (unsigned long long)(INT_MIN - tokens);  /* Saturated. */
+    tokens = INT_MIN;
+  }
+  rtlim->current_tokens = (int)tokens;
+}  /* rtlim_duty_end */
+
+
+/* Running totals of "costs" (which must be >= 0) into "sums". */
+static void prefix_sums(const int *costs, unsigned long long *sums, int count)
+{
+  unsigned long long total = 0;
+  int i = 0;
+
+#if defined(__x86_64__)
+  /* SSE2 (always present on x86-64): four costs per iteration, widened to
+   * 64 bits and summed two lanes at a time. "carry" holds the running
+   * total in both lanes. */
+  __m128i zero = _mm_setzero_si128();
+  __m128i carry = _mm_setzero_si128();
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i c = _mm_loadu_si128((const __m128i *)&costs[i]);
+    __m128i lo = _mm_unpacklo_epi32(c, zero);  /* [c0, c1] */
+    __m128i hi = _mm_unpackhi_epi32(c, zero);  /* [c2, c3] */
+
+    lo = _mm_add_epi64(lo, _mm_slli_si128(lo, 8));  /* [c0, c0+c1] */
+    hi = _mm_add_epi64(hi, _mm_slli_si128(hi, 8));  /* [c2, c2+c3] */
+    lo = _mm_add_epi64(lo, carry);
+    hi = _mm_add_epi64(hi, _mm_shuffle_epi32(lo, 0xEE));  /* + lo's upper lane */
+    carry = _mm_shuffle_epi32(hi, 0xEE);
+    _mm_storeu_si128((__m128i *)&sums[i], lo);
+    _mm_storeu_si128((__m128i *)&sums[i + 2], hi);
+  }
+  total = (unsigned long long)_mm_cvtsi128_si64(carry);
+#endif
+
+  for (; i < count; i++) {
+    total += costs[i];
+    sums[i] = total;
+  }
+}  /* prefix_sums */
+
+
+/* API to schedule a batch of messages at once.
+ * "costs" are the messages' token amounts (each >= 0). Fills
+ * "departures_ns" with the time (on the rtlim object's clock) at which
+ * each may be sent: the same times that back-to-back blocking
+ * rtlim_take()s, starting now, would return at. The limiter's state is
+ * advanced as if all of them had been taken, so it can be in the future;
+ * send the batch before taking again.
+ * Returns:
+ *    0 for success,
+ *   -1 if a refiller owns the limiter's schedule (see "rtlim_refill.c").
+ */
+int rtlim_schedule(rtlim_t *rtlim, const int *costs,
+  unsigned long long *departures_ns, int count)
+{
+  unsigned long long refill_ns, depart_ns, total;
+  long long granted;
+  int i;
+
+  if (rtlim->refiller != NULL) {
+    return -1;
+  }
+  if (count <= 0) {
+    return 0;
+  }
+
+  rtlim->cur_ns = rtlim_now(rtlim);
+  if (rtlim->shadow != NULL) {
+    for (i = 0; i < count; i++) {
+      shadow_take(rtlim->shadow, rtlim->cur_ns, costs[i], RTLIM_BLOCK_SPIN);
+    }
+  }
+  rtlim_refill(rtlim);
+
+  /* Message i may go once the tokens granted (those available now plus a
+   * refill amount per refill) cover the running total of costs through i.
+   * Totals only grow, so the refill count only moves forward. Tokens owed
+   * (negative) hold back even zero-cost messages until paid off. */
+  prefix_sums(costs, departures_ns, count);
+  total = departures_ns[count - 1];
+  granted = rtlim->current_tokens;
+  refill_ns = rtlim->last_refill_ns;
+  depart_ns = rtlim->cur_ns;
+  for (i = 0; i < count; i++) {
+    while ((long long)departures_ns[i] > granted) {
+      granted += rtlim->refill_token_amount;
+      refill_ns += rtlim->refill_interval_ns;
+      depart_ns = refill_ns;
+    }
+    departures_ns[i] = depart_ns;
+  }
+
+  rtlim->current_tokens = (int)(granted - total);
+  rtlim->last_refill_ns = refill_ns;
+
+  return 0;
+}  /* rtlim_schedule */
+
+
 #ifdef SELFTEST
 /************************ Test code *************************/
 
+/* The tests run on a virtual clock, so they take no real time and can
+ * check times exactly. */
+
 #define EQUALCHK(val_,chk_) do { \
   unsigned long long inval_ = (unsigned long long)(val_); \
   unsigned long long inchk_ = (unsigned long long)(chk_); \
@@ -167,90 +827,519 @@ int rtlim_take(rtlim_t *rtlim, int take_token_amount, int block)
   } \
 } while (0)
 
-/* For checking things like times, don't need exact accuracy.
- * Make sure actual is within +/- 2% of the check value. */
-#define APPROXCHK(val_,chk_) do { \
-  unsigned long long inval_ = (unsigned long long)(val_); \
-  unsigned long long inchk_ = (unsigned long long)(chk_); \
-  unsigned long long chkhi_ = inchk_ + (inchk_ / 50); /* 2% higher. */ \
-  unsigned long long chklo_ = inchk_ - (inchk_ / 50); /* 2% lower. */ \
-  if ((inval_ > chkhi_) || (inval_ < chklo_)) { \
-    fprintf(stderr, "Approx check failed at %s:%d, %s=%llu, %s=%llu (%llu..%llu)\n", \
-      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_, chklo_, chkhi_); \
-    fflush(stderr); \
-    exit(1); \
-  } \
-} while (0)
+
+/* Clock callback for testing: counts calls. */
+unsigned long long test_clock_cb(void *clock_clientd)
+{
+  unsigned long long *ticks = (unsigned long long *)clock_clientd;
+
+  (*ticks)++;
+  return *ticks * 1000;
+}  /* test_clock_cb */
+
+
+/* Run random operations against a limiter on a virtual clock, checking
+ * each result against a closed-form model of the algorithm. */
+void random_scenario(unsigned int seed, int num_ops)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  unsigned long long interval, last_refill;
+  int amount, tokens, op;
+
+  srand(seed);
+  interval = 1 + rand() % 1000000;
+  amount = 1 + rand() % 200;
+
+  vclock.now_ns = (unsigned long long)rand() * 1000;
+  rl = rtlim_create(interval, amount);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  last_refill = vclock.now_ns;
+  tokens = amount;
+
+  for (op = 0; op < num_ops; op++) {
+    int block = 1 + rand() % 4;
+    int take = rand() % (amount * 3 + 1);
+    unsigned long long start_ns;
+    int status;
+
+    vclock.now_ns += rand() % (interval * 3);
+    start_ns = vclock.now_ns;
+
+    status = rtlim_take(rl, take, block);
+
+    if (block == RTLIM_NON_BLOCK && take > amount) {
+      EQUALCHK(status, -2);  /* Rejected before looking at the clock. */
+      EQUALCHK(vclock.now_ns, start_ns);
+      continue;
+    }
+    if (start_ns >= last_refill + interval) {
+      tokens = amount;
+      last_refill = start_ns;
+    }
+    if (take <= tokens) {
+      EQUALCHK(status, 0);
+      EQUALCHK(vclock.now_ns, start_ns);  /* No delay. */
+      tokens -= take;
+    }
+    else if (block == RTLIM_NON_BLOCK) {
+      EQUALCHK(status, -1);
+      EQUALCHK(vclock.now_ns, start_ns);
+    }
+    else {
+      /* Drains the bucket, then takes "amount" at each of the next
+       * "refills" refill times. */
+      int remaining = take - tokens;
+      int refills = (remaining + amount - 1) / amount;
+      last_refill += refills * interval;
+      tokens = refills * amount - remaining;
+      EQUALCHK(status, 0);
+      EQUALCHK(vclock.now_ns, last_refill);
+    }
+    EQUALCHK(rl->current_tokens, tokens);
+    EQUALCHK(rl->last_refill_ns, last_refill);
+  }
+
+  rtlim_delete(rl);
+}  /* random_scenario */
+
+
+/* A schedule must match back-to-back blocking takes exactly. */
+void test_schedule(unsigned int seed)
+{
+  rtlim_vclock_t vclock1, vclock2;
+  rtlim_t *rl1, *rl2;
+  static int costs[1000];
+  static unsigned long long departures[1000];
+  unsigned long long interval;
+  int amount, count, i, max_cost;
+
+  srand(seed);
+  interval = 1 + rand() % 1000000;
+  amount = 1 + rand() % 200;
+  count = rand() % 1000;
+  max_cost = (rand() % 2) ? amount : amount * 3;
+
+  vclock1.now_ns = vclock2.now_ns = 1000000000;
+  rl1 = rtlim_create(interval, amount);
+  rl2 = rtlim_create(interval, amount);
+  EQUALCHK(rtlim_set_clock(rl1, RTLIM_CLOCK_VIRTUAL, NULL, &vclock1), 0);
+  EQUALCHK(rtlim_set_clock(rl2, RTLIM_CLOCK_VIRTUAL, NULL, &vclock2), 0);
+
+  /* Same arbitrary starting state. */
+  EQUALCHK(rtlim_take(rl1, rand() % (amount + 1), RTLIM_NON_BLOCK), 0);
+  if (rand() % 4 == 0) {
+    rl1->current_tokens = -(rand() % (amount * 3 + 1));  /* Owed. */
+  }
+  rl2->current_tokens = rl1->current_tokens;
+  vclock1.now_ns += rand() % (interval * 2);
+  vclock2.now_ns = vclock1.now_ns;
+
+  for (i = 0; i < count; i++) {
+    costs[i] = rand() % (max_cost + 1);
+  }
+  EQUALCHK(rtlim_schedule(rl1, costs, departures, count), 0);
+  EQUALCHK(vclock1.now_ns, vclock2.now_ns);  /* Doesn't wait. */
+
+  for (i = 0; i < count; i++) {
+    EQUALCHK(rtlim_take(rl2, costs[i], RTLIM_BLOCK_SPIN), 0);
+    EQUALCHK(departures[i], vclock2.now_ns);
+  }
+  EQUALCHK(rl1->current_tokens, rl2->current_tokens);
+  if (count > 0) {
+    EQUALCHK(rl1->last_refill_ns, rl2->last_refill_ns);
+  }
+
+  rtlim_delete(rl1);
+  rtlim_delete(rl2);
+}  /* test_schedule */
+
+/* Shadow limiter sees the same takes at the same times. */
+void test_shadow()
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  rtlim_shadow_t *shadow;
+  unsigned long long t0;
+
+  vclock.now_ns = t0 = 5000000000;
+  rl = rtlim_create(1000000, 10);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  shadow = rtlim_shadow_create(1000000, 5);
+  EQUALCHK(rtlim_set_shadow(rl, shadow), 0);
+
+  EQUALCHK(rtlim_take(rl, 3, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_take(rl, 3, RTLIM_NON_BLOCK), 0);  /* Shadow: 2 left, rejects. */
+  EQUALCHK(shadow->rejects, 1);
+  EQUALCHK(rtlim_take(rl, 2, RTLIM_BLOCK_SPIN), 0);  /* Shadow: 0 left. */
+  EQUALCHK(rtlim_take(rl, 6, RTLIM_NON_BLOCK), -1);  /* Shadow: -2. */
+  EQUALCHK(shadow->rejects, 2);
+  EQUALCHK(shadow->blocks, 0);
+
+  /* Both wait for the next refill. */
+  EQUALCHK(rtlim_take(rl, 4, RTLIM_BLOCK_SPIN), 0);
+  EQUALCHK(vclock.now_ns, t0 + 1000000);
+  EQUALCHK(rl->current_tokens, 8);
+  EQUALCHK(shadow->rtlim->current_tokens, 1);
+  EQUALCHK(shadow->blocks, 1);
+  EQUALCHK(shadow->block_ns, 1000000);
+
+  /* Only the shadow waits. */
+  EQUALCHK(rtlim_take(rl, 3, RTLIM_BLOCK_SLEEP), 0);
+  EQUALCHK(vclock.now_ns, t0 + 1000000);
+  EQUALCHK(shadow->vclock.now_ns, t0 + 2000000);
+  EQUALCHK(shadow->blocks, 2);
+  EQUALCHK(shadow->block_ns, 2000000);
+  EQUALCHK(shadow->max_block_ns, 1000000);
+  EQUALCHK(shadow->takes, 6);
+
+  /* A take while the shadow's sender would still be waiting. */
+  vclock.now_ns = t0 + 1500000;
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(shadow->blocks, 3);
+  EQUALCHK(shadow->block_ns, 2500000);
+
+  EQUALCHK(rtlim_set_shadow(rl, NULL), 0);
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(shadow->takes, 7);
+
+  rtlim_shadow_delete(shadow);
+  rtlim_delete(rl);
+}  /* test_shadow */
+
+
+/* Governor report callback for testing: counts reports. */
+void test_gov_cb(rtlim_gov_t *gov, rtlim_t *rtlim, int block, void *report_clientd)
+{
+  int *reports = (int *)report_clientd;
+
+  (*reports)++;
+}  /* test_gov_cb */
+
+
+void test_gov()
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl, *rl2;
+  rtlim_gov_t *gov;
+  unsigned long long t0, until_ns;
+  int reports = 0;
+  int i;
+
+  EQUALCHK(rtlim_gov_create(0, 1, NULL, NULL), NULL);
+  EQUALCHK(rtlim_gov_create(1, 0, NULL, NULL), NULL);
+
+  vclock.now_ns = t0 = 1000000000;
+  rl = rtlim_create(1000000, 1);  /* 1 ms per token. */
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  /* 20 ms of spinning per 100 ms. */
+  gov = rtlim_gov_create(100000000, 20000000, test_gov_cb, &reports);
+  rtlim_set_gov(rl, gov);
+  EQUALCHK(gov->window_start_ns, t0);
+
+  /* Each take spins 1 ms for the next refill. */
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);
+  for (i = 1; i <= 20; i++) {
+    EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);
+    EQUALCHK(gov->block, RTLIM_BLOCK_SPIN);
+  }
+  EQUALCHK(reports, 0);
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);  /* Over budget. */
+  EQUALCHK(gov->block, RTLIM_BLOCK_HYBRID);
+  EQUALCHK(reports, 1);
+  EQUALCHK(gov->degrades, 1);
+  EQUALCHK(gov->spin_ns, 21000000);
+
+  /* Hybrid only spins the end of each wait, and is still on time. */
+  for (i = 22; i < 72; i++) {
+    EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);
+    EQUALCHK(vclock.now_ns, t0 + i * 1000000);
+  }
+  EQUALCHK(gov->block, RTLIM_BLOCK_HYBRID);
+  EQUALCHK(gov->spin_ns, 21000000 + 50 * RTLIM_HYBRID_SPIN_NS);
+
+  /* Waits too short for hybrid to sleep: down to sleeping. */
+  rl2 = rtlim_create(RTLIM_HYBRID_SPIN_NS / 2, 1);
+  EQUALCHK(rtlim_set_clock(rl2, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  rtlim_set_gov(rl2, gov);
+  for (i = 0; i < 1000 && gov->block == RTLIM_BLOCK_HYBRID; i++) {
+    EQUALCHK(rtlim_take(rl2, 1, RTLIM_BLOCK_SPIN), 0);
+  }
+  EQUALCHK(gov->block, RTLIM_BLOCK_SLEEP);
+  EQUALCHK(reports, 2);
+  EQUALCHK(gov->degrades, 2);
+  EQUALCHK(vclock.now_ns < t0 + 100000000, 1);  /* Same window. */
+
+  /* Quiet for a while: the first wait lifts the downgrade. */
+  vclock.now_ns += 1000000000;
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);  /* Refilled. */
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);
+  EQUALCHK(gov->block, RTLIM_BLOCK_SPIN);
+  EQUALCHK(reports, 3);
+  EQUALCHK(gov->restores, 1);
+
+  rtlim_set_gov(rl, NULL);
+  rtlim_set_gov(rl2, NULL);
+  rtlim_gov_delete(gov);
+  rtlim_delete(rl2);
+
+  /* Sleeping callers sharing the governor aren't charged for spinning,
+   * so they don't count against the spinners' budget. */
+  gov = rtlim_gov_create(100000000, 20000000, NULL, NULL);
+  rl2 = rtlim_create(1000000, 1);
+  EQUALCHK(rtlim_set_clock(rl2, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  rtlim_set_gov(rl, gov);
+  rtlim_set_gov(rl2, gov);
+  vclock.now_ns += 1000000000;
+  t0 = vclock.now_ns;
+  EQUALCHK(rtlim_take(rl2, 1, RTLIM_BLOCK_SLEEP), 0);  /* Refilled. */
+  for (i = 0; i < 50; i++) {
+    EQUALCHK(rtlim_take(rl2, 1, RTLIM_BLOCK_SLEEP), 0);
+  }
+  EQUALCHK(gov->demand_ns[0] + gov->hybrid_ns[0], 0);
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);  /* Refilled. */
+  for (i = 0; i < 20; i++) {
+    EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SPIN), 0);
+  }
+  EQUALCHK(gov->block, RTLIM_BLOCK_SPIN);
+  EQUALCHK(gov->demand_ns[0], 20000000);
+  EQUALCHK(vclock.now_ns < t0 + 100000000, 1);  /* Same window. */
+  rtlim_set_gov(rl, NULL);
+  rtlim_set_gov(rl2, NULL);
+  rtlim_gov_delete(gov);
+  rtlim_delete(rl2);
+
+  /* Hybrid on a real clock. */
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_MONOTONIC, NULL, NULL), 0);
+  until_ns = rtlim_now(rl) + 2 * RTLIM_HYBRID_SPIN_NS;
+  rtlim_wait_until(rl, until_ns, RTLIM_BLOCK_HYBRID);
+  EQUALCHK(rtlim_now(rl) >= until_ns, 1);
+
+  rtlim_delete(rl);
+}  /* test_gov */
+
+/* 30% of each 10 ms. */
+void test_duty()
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  unsigned long long t0, busy_ns;
+  int i;
+
+  vclock.now_ns = t0 = 1000000000;
+  rl = rtlim_create(10000000, 3000000);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_NON_BLOCK), 0);
+  vclock.now_ns += 2000000;
+  rtlim_duty_end(rl);
+  EQUALCHK(rl->current_tokens, 1000000);
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_NON_BLOCK), 0);
+  vclock.now_ns += 2000000;
+  rtlim_duty_end(rl);
+  EQUALCHK(rl->current_tokens, -1000000);  /* Overran. */
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_NON_BLOCK), -1);
+
+  /* Waits for the next interval, which pays off the debt. */
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_BLOCK_SPIN), 0);
+  EQUALCHK(vclock.now_ns, t0 + 10000000);
+  EQUALCHK(rl->current_tokens, 2000000);
+
+  /* A long operation: 2 intervals already passed when it ends pay off
+   * 6 ms of the 23 ms owed, and the rest takes 6 more. */
+  vclock.now_ns += 25000000;
+  rtlim_duty_end(rl);
+  EQUALCHK(rl->current_tokens, -23000000);
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_BLOCK_SLEEP), 0);
+  EQUALCHK(vclock.now_ns, t0 + 95000000);
+  EQUALCHK(rl->current_tokens, 1000000);
+  rtlim_duty_end(rl);
+
+  /* Idle long enough forgives all debt, but no more than an interval's
+   * worth builds up. */
+  vclock.now_ns += 50000000;
+  rtlim_duty_end(rl);
+  EQUALCHK(rl->current_tokens, -49000000);
+  vclock.now_ns += 1000000000;
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rl->current_tokens, 3000000);
+  rtlim_duty_end(rl);
+
+  /* Debt beyond what current_tokens holds is kept, not forgiven: a 10 s
+   * overrun takes 3333 intervals of 3 ms to pay off. */
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_NON_BLOCK), 0);
+  t0 = vclock.now_ns;
+  vclock.now_ns += 10000000000ull;
+  rtlim_duty_end(rl);
+  EQUALCHK(rl->current_tokens, INT_MIN);
+  EQUALCHK(rl->owed_tokens, 9997000000ull + INT_MIN);
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_BLOCK_SLEEP), 0);
+  EQUALCHK(vclock.now_ns, t0 + 3333 * 10000000ull);
+  EQUALCHK(rl->current_tokens, 2000000);
+  EQUALCHK(rl->owed_tokens, 0);
+  rtlim_duty_end(rl);
+
+  /* Other calls between begin and end (which read the clock) don't
+   * shorten the operation. */
+  EQUALCHK(rtlim_duty_begin(rl, RTLIM_NON_BLOCK), 0);
+  vclock.now_ns += 500000;
+  EQUALCHK(rtlim_take(rl, 1, RTLIM_NON_BLOCK), 0);
+  vclock.now_ns += 500000;
+  rtlim_duty_end(rl);
+  EQUALCHK(rl->current_tokens, 2000000 - 1 - 1000000);
+
+  /* Over a long run of operations of random length, the duty cycle is
+   * 30%, give or take the tokens at the start and the debt at the end. */
+  srand(1);
+  t0 = vclock.now_ns;
+  busy_ns = 0;
+  for (i = 0; i < 10000; i++) {
+    unsigned long long op_ns = rand() % 5000000;
+    EQUALCHK(rtlim_duty_begin(rl, RTLIM_BLOCK_HYBRID), 0);
+    vclock.now_ns += op_ns;
+    rtlim_duty_end(rl);
+    busy_ns += op_ns;
+    vclock.now_ns += rand() % 1000000;  /* Between operations. */
+  }
+  EQUALCHK(busy_ns <= (vclock.now_ns - t0) * 3 / 10 + 3000000 + 5000000, 1);
+  EQUALCHK(busy_ns >= (vclock.now_ns - t0) * 29 / 100, 1);
+
+  rtlim_delete(rl);
+}  /* test_duty */
 
 
 int main(int argc, char **argv)
 {
   rtlim_t *rl;
+  rtlim_vclock_t vclock;
+  rtlim_tkclock_t tkclock;
   int status;
-  unsigned long long start_time;
+  unsigned long long start_time, ticks, prev_ns;
+  unsigned int seed;
+  int clock_type, scenario;
 
+  vclock.now_ns = 1000000000;
   rl = rtlim_create(500000000, 100);  /* Half second. */
+  status = rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock);
+  EQUALCHK(status, 0);
+  EQUALCHK(rl->last_refill_ns, 1000000000);
 
   /* Error: taking more tokens than it refills to with a non-blocking take. */
-  start_time = current_time_ns();
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 200, RTLIM_NON_BLOCK);
   EQUALCHK(status, -2);  /* make sure it failed. */
-  APPROXCHK(current_time_ns(), start_time);  /* no time delay. */
+  EQUALCHK(vclock.now_ns, start_time);  /* no time delay. */
 
-  /* Success: take 2 intervals worth (takes a full second). */
-  start_time = current_time_ns();
+  /* Success: take 2 intervals worth (100 now, 100 at the next refill). */
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 200, RTLIM_BLOCK_SPIN);
   EQUALCHK(status, 0);
-  APPROXCHK(current_time_ns(), start_time + 1000000000);  /* 1 sec. */
+  EQUALCHK(vclock.now_ns, start_time + 500000000);  /* .5 sec. */
   EQUALCHK(rl->current_tokens, 0);
 
   /* Sleep less than the refill interval and nonblock for 100. Should fail. */
-  usleep(400000);  /* .4 sec */
-  start_time = current_time_ns();
+  vclock.now_ns += 400000000;  /* .4 sec */
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 100, RTLIM_NON_BLOCK);
   EQUALCHK(status, -1);  /* make sure it failed. */
-  APPROXCHK(current_time_ns(), start_time);  /* no time delay. */
+  EQUALCHK(vclock.now_ns, start_time);  /* no time delay. */
   EQUALCHK(rl->current_tokens, 0);
 
   /* Sleep past than the refill interval and nonblock for 100. Should be OK. */
-  usleep(200000);  /* .2 sec */
-  start_time = current_time_ns();
+  vclock.now_ns += 200000000;  /* .2 sec */
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 100, RTLIM_NON_BLOCK);
   EQUALCHK(status, 0);  /* Success. */
-  APPROXCHK(current_time_ns(), start_time);  /* no time delay. */
+  EQUALCHK(vclock.now_ns, start_time);  /* no time delay. */
   EQUALCHK(rl->current_tokens, 0);
+  EQUALCHK(rl->last_refill_ns, start_time);
 
-  /* Sleep past than the refill interval and nonblock for 80. Should be OK. */
-  usleep(600000);  /* .6 sec */
-  start_time = current_time_ns();
+  /* Sleep past than the refill interval and block for 80. Should be OK. */
+  vclock.now_ns += 600000000;  /* .6 sec */
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 80, RTLIM_BLOCK_SPIN);
   EQUALCHK(status, 0);  /* Success. */
-  APPROXCHK(current_time_ns(), start_time);  /* no time delay. */
+  EQUALCHK(vclock.now_ns, start_time);  /* no time delay. */
   EQUALCHK(rl->current_tokens, 20);
 
   /* Block for 80 more. */
-  start_time = current_time_ns();
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 80, RTLIM_BLOCK_SPIN);
   EQUALCHK(status, 0);  /* Success. */
-  APPROXCHK(current_time_ns(), start_time + 500000000);  /* .5 sec. */
+  EQUALCHK(vclock.now_ns, start_time + 500000000);  /* .5 sec. */
   EQUALCHK(rl->current_tokens, 40);
 
   /* Block for 400 more. */
-  start_time = current_time_ns();
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 400, RTLIM_BLOCK_SPIN);
   EQUALCHK(status, 0);  /* Success. */
-  APPROXCHK(current_time_ns(), start_time + 2000000000);  /* 2 seconds. */
+  EQUALCHK(vclock.now_ns, start_time + 2000000000);  /* 2 seconds. */
   EQUALCHK(rl->current_tokens, 40);
 
-  /* Block for 200 more. */
-  start_time = current_time_ns();
+  /* Block for 400 more, sleeping. */
+  start_time = vclock.now_ns;
   status = rtlim_take(rl, 400, RTLIM_BLOCK_SLEEP);
   EQUALCHK(status, 0);  /* Success. */
-  APPROXCHK(current_time_ns(), start_time + 1000000000);  /* 1 second. */
+  EQUALCHK(vclock.now_ns, start_time + 2000000000);  /* 2 seconds. */
   EQUALCHK(rl->current_tokens, 40);
+  EQUALCHK(rl->cur_ns, vclock.now_ns);
+
+  /* Callback clock. */
+  ticks = 0;
+  status = rtlim_set_clock(rl, RTLIM_CLOCK_CALLBACK, test_clock_cb, &ticks);
+  EQUALCHK(status, 0);
+  EQUALCHK(rl->last_refill_ns, 1000);
+  status = rtlim_take(rl, 1, RTLIM_NON_BLOCK);
+  EQUALCHK(status, 0);
+  EQUALCHK(rl->cur_ns, 2000);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_CALLBACK, NULL, NULL), -1);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, NULL), -1);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_TIMEKEEPER, NULL, NULL), -1);
+  EQUALCHK(rtlim_set_clock(rl, 99, NULL, NULL), -1);
+
+  /* Timekeeper clock, with no timekeeper thread: reads what was stored. */
+  tkclock.now_ns = 5000;
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_TIMEKEEPER, NULL, &tkclock), 0);
+  EQUALCHK(rl->last_refill_ns, 5000);
+  tkclock.now_ns = 7000;
+  EQUALCHK(rtlim_now(rl), 7000);
+  EQUALCHK((unsigned long long)&tkclock % 64, 0);
+
+  /* Real clocks: must be usable and not go backwards. TSC may be
+   * unsupported on this host. */
+  for (clock_type = RTLIM_CLOCK_MONOTONIC; clock_type <= RTLIM_CLOCK_TSC; clock_type++) {
+    int i;
+    if (rtlim_set_clock(rl, clock_type, NULL, NULL) != 0) {
+      EQUALCHK(clock_type, RTLIM_CLOCK_TSC);
+      continue;
+    }
+    prev_ns = rtlim_now(rl);
+    for (i = 0; i < 1000; i++) {
+      unsigned long long now_ns = rtlim_now(rl);
+      if (now_ns < prev_ns) {
+        EQUALCHK(now_ns, prev_ns);  /* Fails. */
+      }
+      prev_ns = now_ns;
+    }
+    status = rtlim_take(rl, 1, RTLIM_NON_BLOCK);
+    EQUALCHK(status, 0);  /* Just refilled by rtlim_set_clock(). */
+  }
 
   rtlim_delete(rl);
 
+  test_shadow();
+  test_gov();
+  test_duty();
+  for (scenario = 0; scenario < 200; scenario++) {
+    test_schedule(scenario);
+  }
+
+  /* Randomized scenarios ("./rtlim seed" to reproduce a failure). */
+  seed = (argc > 1) ? (unsigned int)atoi(argv[1]) : 1;
+  for (scenario = 0; scenario < 2000; scenario++) {
+    random_scenario(seed + scenario, 200);
+  }
+
   printf("OK\n");
 
   return 0;
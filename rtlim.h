@@ -28,6 +28,30 @@ extern "C" {
 #endif /* __cplusplus */
 
 
+/* Application-supplied clock (RTLIM_CLOCK_CALLBACK). Must return
+ * monotonically non-decreasing nanoseconds. */
+typedef unsigned long long (*rtlim_clock_cb_t)(void *clock_clientd);
+
+/* Virtual clock (RTLIM_CLOCK_VIRTUAL). Time only moves when the app sets
+ * now_ns, or when a blocking rtlim_take() advances it instead of waiting.
+ * Several rtlim objects may share one. */
+typedef struct rtlim_vclock_s {
+  unsigned long long now_ns;
+} rtlim_vclock_t;
+
+/* Shared clock (RTLIM_CLOCK_TIMEKEEPER), kept current by another thread
+ * (see rtlim_tk.h). Reading it is a single load. It has a cache line to
+ * itself, so readers only miss when it changes. */
+typedef struct rtlim_tkclock_s {
+  volatile unsigned long long now_ns;
+  char pad[64 - sizeof(unsigned long long)];
+} __attribute__((aligned(64))) rtlim_tkclock_t;
+
+
+struct rtlim_shadow_s;
+struct rtlim_refiller_s;
+struct rtlim_gov_s;
+
 /* Structure for "rtlim" object. App should mostly treat it as opaque. */
 typedef struct rtlim_s {
   unsigned long long refill_interval_ns;   /* Set by rtlim_create() */
@@ -35,19 +59,99 @@ typedef struct rtlim_s {
   unsigned long long refill_token_amount;  /* Set by rtlim_create() */
   unsigned long long cur_ns;               /* Last timestamp taken. */
   int current_tokens;                      /* Available tokens to take. */
+  unsigned long long owed_tokens;          /* Debt below INT_MIN (duty). */
+  unsigned long long duty_begin_ns;        /* Set by rtlim_duty_begin() */
+  int clock_type;                          /* Set by rtlim_set_clock() */
+  rtlim_clock_cb_t clock_cb;               /* Set by rtlim_set_clock() */
+  void *clock_clientd;                     /* Set by rtlim_set_clock() */
+  struct rtlim_shadow_s *shadow;           /* Set by rtlim_set_shadow() */
+  struct rtlim_refiller_s *refiller;       /* Set by rtlim_refiller_add() */
+  int refiller_index;                      /* Position in refiller's heap. */
+  struct rtlim_gov_s *gov;                 /* Set by rtlim_set_gov() */
 } rtlim_t;
 
 
+/* Shadow (dry-run) limiter: a second configuration that sees every
+ * rtlim_take() of the limiter it is attached to, at the same timestamp,
+ * and records what it would have done, without affecting the caller.
+ * It runs on its own virtual clock, as if it were the only limiter. */
+typedef struct rtlim_shadow_s {
+  rtlim_vclock_t vclock;
+  rtlim_t *rtlim;                  /* Shadow configuration. */
+  unsigned long long takes;
+  unsigned long long blocks;       /* Takes it would have delayed. */
+  unsigned long long block_ns;     /* Total delay it would have added. */
+  unsigned long long max_block_ns;
+  unsigned long long rejects;      /* Non-blocking takes it would fail. */
+} rtlim_shadow_t;
+
+
+/* Spin governor: bounds the CPU time that blocking takes spend spinning.
+ * Attach one to a limiter, or the same one to all of a thread's limiters
+ * (they must share a clock). It keeps a rolling estimate, over the last
+ * "window_ns", of the time the callers' block modes would spin. If that
+ * exceeds "budget_ns", their spins are downgraded to RTLIM_BLOCK_HYBRID,
+ * or, if even the hybrid's spins would exceed it, to RTLIM_BLOCK_SLEEP.
+ * The downgrade is lifted once the estimate falls below half the budget. */
+typedef void (*rtlim_gov_cb_t)(struct rtlim_gov_s *gov, rtlim_t *rtlim,
+  int block, void *report_clientd);
+typedef struct rtlim_gov_s {
+  unsigned long long window_ns;        /* Set by rtlim_gov_create() */
+  unsigned long long budget_ns;        /* Set by rtlim_gov_create() */
+  rtlim_gov_cb_t report_cb;            /* Called when "block" changes. */
+  void *report_clientd;
+  int block;               /* Most spinning mode allowed now. */
+  unsigned long long window_start_ns;
+  unsigned long long demand_ns[2];     /* Wanted spin, [0] this window. */
+  unsigned long long hybrid_ns[2];     /* Spin if hybrid, [0] this window. */
+  unsigned long long spin_ns;          /* Total time actually spun. */
+  unsigned long long degrades;         /* Changes to a less spinning mode. */
+  unsigned long long restores;
+} rtlim_gov_t;
+
+
 /* Values for rtlim_take() "block" parameter. */
-#define RTLIM_BLOCK_SPIN  1
-#define RTLIM_BLOCK_SLEEP 2
-#define RTLIM_NON_BLOCK   3
+#define RTLIM_BLOCK_SPIN   1
+#define RTLIM_BLOCK_SLEEP  2
+#define RTLIM_NON_BLOCK    3
+#define RTLIM_BLOCK_HYBRID 4  /* Sleep, then spin for the last part. */
+
+/* How long RTLIM_BLOCK_HYBRID spins at the end of a wait; enough to cover
+ * a typical sleep's wake-up overshoot. */
+#ifndef RTLIM_HYBRID_SPIN_NS
+#define RTLIM_HYBRID_SPIN_NS 100000
+#endif
+
+/* Values for rtlim_set_clock() "clock_type" parameter. */
+#define RTLIM_CLOCK_MONOTONIC        1  /* Default. */
+#define RTLIM_CLOCK_MONOTONIC_COARSE 2
+#define RTLIM_CLOCK_MONOTONIC_RAW    3
+#define RTLIM_CLOCK_TSC              4
+#define RTLIM_CLOCK_CALLBACK         5
+#define RTLIM_CLOCK_VIRTUAL          6
+#define RTLIM_CLOCK_TIMEKEEPER       7
 
 
 unsigned long long current_time_ns();
 rtlim_t *rtlim_create(unsigned long long refill_interval_ns, int refill_token_amount);
 void rtlim_delete(rtlim_t *rtlim);
 int rtlim_take(rtlim_t *rtlim, int take_token_amount, int block);
+int rtlim_set_clock(rtlim_t *rtlim, int clock_type, rtlim_clock_cb_t clock_cb,
+  void *clock_clientd);
+unsigned long long rtlim_now(rtlim_t *rtlim);
+void rtlim_wait_until(rtlim_t *rtlim, unsigned long long until_ns, int block);
+int rtlim_schedule(rtlim_t *rtlim, const int *costs,
+  unsigned long long *departures_ns, int count);
+rtlim_shadow_t *rtlim_shadow_create(unsigned long long refill_interval_ns,
+  int refill_token_amount);
+void rtlim_shadow_delete(rtlim_shadow_t *shadow);
+int rtlim_set_shadow(rtlim_t *rtlim, rtlim_shadow_t *shadow);
+int rtlim_duty_begin(rtlim_t *rtlim, int block);
+void rtlim_duty_end(rtlim_t *rtlim);
+rtlim_gov_t *rtlim_gov_create(unsigned long long window_ns,
+  unsigned long long budget_ns, rtlim_gov_cb_t report_cb, void *report_clientd);
+void rtlim_gov_delete(rtlim_gov_t *gov);
+void rtlim_set_gov(rtlim_t *rtlim, rtlim_gov_t *gov);
 
 #if defined(__cplusplus)
 }
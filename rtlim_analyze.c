@@ -0,0 +1,308 @@
+/* rtlim_analyze.c - Check a captured send stream for rate conformance.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Reads a timestamped send stream (pcap or "timestamp_ns,size" text, see
+ * rtlim_sim.h) in a single streaming pass and writes CSV tables to stdout:
+ *
+ *   - a summary (messages, bytes, duration, mean rates),
+ *   - the rate-versus-timescale curve: for windows from 1 us to 10 s
+ *     (1-2-5 steps), the maximum messages and bytes in any window of that
+ *     size, as peak rates. With "-i" and "-a", each window is also checked
+ *     against the most an rtlim limiter with that configuration can
+ *     release in it, amount * (ceil(window / interval) + 1) tokens,
+ *   - with "-r", the microbursts that overflow a model of the downstream
+ *     buffers (see rtlim_qmodel_t): overflows less than "-g" ns apart are
+ *     merged into one burst.
+ *
+ * Windows are measured with timestamps rounded to a quantum of at most
+ * 1/resolution of the window (see rtlim_peak_t), so memory does not grow
+ * with the stream's rate or length.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rtlim.h"
+#include "rtlim_sim.h"
+
+
+/* Command-line options. */
+static unsigned long long o_interval_ns = 0;
+static int o_amount = 0;
+static int o_bytes_per_token = 0;
+static char *o_buffer_bytes = "131072";
+static char *o_drain_rates = NULL;
+static unsigned long long o_gap_ns = 1000000;
+static int o_max_bursts = 100;
+static unsigned long long o_resolution = 1000;
+static char *o_trace_path = NULL;
+
+#define MAX_STAGES 16
+/* 1 us to 10 s in 1-2-5 steps. */
+#define NUM_WINDOWS 22
+
+
+/* A microburst: a run of overflows at one stage. */
+typedef struct burst_s {
+  int stage;
+  unsigned long long start_ns;
+  unsigned long long end_ns;
+  unsigned long long overflows;
+  unsigned long long overflow_bytes;
+} burst_t;
+
+typedef struct bursts_s {
+  burst_t *list;          /* Up to o_max_bursts. */
+  int num_listed;
+  unsigned long long num_bursts;
+  burst_t cur[MAX_STAGES];  /* Open burst per stage (overflows == 0: none). */
+} bursts_t;
+
+
+char *usage_str = "Usage: rtlim_analyze [-h] [-i interval_ns -a amount] [-p bytes_per_token] [-b buffer_bytes] [-r drain_rates] [-g gap_ns] [-m max_bursts] [-R resolution] trace_file";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -i interval_ns : configured limiter refill interval (for conformance)\n"
+      "  -a amount : configured limiter refill token amount (for conformance)\n"
+      "  -p bytes_per_token : message cost is size/bytes_per_token+1 tokens\n"
+      "                       (0 = one token per message) [%d]\n"
+      "  -b buffer_bytes : comma-separated downstream buffer sizes [%s]\n"
+      "  -r drain_rates : comma-separated downstream drain rates (bytes/sec),\n"
+      "                   one per buffer, first to last (default: no model)\n"
+      "  -g gap_ns : overflows closer than this are one microburst [%llu]\n"
+      "  -m max_bursts : most microbursts to list [%d]\n"
+      "  -R resolution : minimum timestamp quanta per window (0 = exact) [%llu]\n"
+      "  trace_file : pcap or text trace ('-' = standard input)\n"
+      , o_bytes_per_token, o_buffer_bytes, o_gap_ns, o_max_bursts, o_resolution);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hi:a:p:b:r:g:m:R:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'i': o_interval_ns = strtoull(optarg, NULL, 10); break;
+      case 'a': o_amount = atoi(optarg); break;
+      case 'p': o_bytes_per_token = atoi(optarg); break;
+      case 'b': o_buffer_bytes = optarg; break;
+      case 'r': o_drain_rates = optarg; break;
+      case 'g': o_gap_ns = strtoull(optarg, NULL, 10); break;
+      case 'm': o_max_bursts = atoi(optarg); break;
+      case 'R': o_resolution = strtoull(optarg, NULL, 10); break;
+      default: usage(NULL);
+    }
+  }
+  if ((o_interval_ns == 0) != (o_amount <= 0)) usage("Need both -i and -a, or neither");
+  if (o_bytes_per_token < 0) usage("bytes_per_token must be >= 0");
+  if (o_max_bursts < 0) usage("max_bursts must be >= 0");
+  if (optind != argc - 1) usage("Need exactly one trace file");
+  o_trace_path = argv[optind];
+}  /* get_my_opts */
+
+
+/* Close a stage's open burst, listing it if there's room. */
+void burst_close(bursts_t *bursts, int stage)
+{
+  burst_t *cur = &bursts->cur[stage];
+
+  if (cur->overflows == 0) {
+    return;
+  }
+  if (bursts->num_listed < o_max_bursts) {
+    bursts->list[bursts->num_listed++] = *cur;
+  }
+  bursts->num_bursts++;
+  cur->overflows = 0;
+}  /* burst_close */
+
+
+/* rtlim_qmodel_t overflow callback. */
+void overflow_cb(rtlim_qmodel_t *qmodel, int stage, unsigned long long ts_ns,
+  int size, void *clientd)
+{
+  bursts_t *bursts = (bursts_t *)clientd;
+  burst_t *cur = &bursts->cur[stage];
+
+  if (cur->overflows > 0 && ts_ns - cur->end_ns >= o_gap_ns) {
+    burst_close(bursts, stage);
+  }
+  if (cur->overflows == 0) {
+    cur->stage = stage;
+    cur->start_ns = ts_ns;
+    cur->overflow_bytes = 0;
+  }
+  cur->end_ns = ts_ns;
+  cur->overflows++;
+  cur->overflow_bytes += size;
+}  /* overflow_cb */
+
+
+int main(int argc, char **argv)
+{
+  unsigned long long windows_ns[NUM_WINDOWS];
+  unsigned long long capacities[MAX_STAGES], drain_rates[MAX_STAGES];
+  unsigned long long ts_ns, first_ns = 0, last_ns = 0, bytes = 0;
+  unsigned long long decade = 1000, start_real_ns, real_ns;
+  rtlim_trace_t *trace;
+  rtlim_peak_t *peak;
+  rtlim_qmodel_t *qmodel = NULL;
+  bursts_t bursts;
+  int size, status, w, s, num_nonconforming = 0;
+  double duration_sec;
+
+  get_my_opts(argc, argv);
+
+  for (w = 0; w < NUM_WINDOWS - 1; w += 3) {
+    windows_ns[w] = decade;
+    windows_ns[w + 1] = decade * 2;
+    windows_ns[w + 2] = decade * 5;
+    decade *= 10;
+  }
+  windows_ns[NUM_WINDOWS - 1] = decade;  /* 10 s. */
+
+  memset(&bursts, 0, sizeof(bursts));
+  if (o_drain_rates != NULL) {
+    int num_stages = rtlim_parse_list(o_buffer_bytes, capacities, MAX_STAGES, "buffer_bytes");
+    if (num_stages < 0) usage(NULL);
+    if (rtlim_parse_list(o_drain_rates, drain_rates, MAX_STAGES, "drain_rate") != num_stages) {
+      usage("Need one drain rate per buffer");
+    }
+    qmodel = rtlim_qmodel_create(num_stages, capacities, drain_rates);
+    rtlim_qmodel_set_overflow_cb(qmodel, overflow_cb, &bursts);
+    bursts.list = (burst_t *)malloc((o_max_bursts + 1) * sizeof(burst_t));
+    if (bursts.list == NULL) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+  }
+
+  trace = rtlim_trace_open(o_trace_path);
+  if (trace == NULL) {
+    fprintf(stderr, "Can't open trace '%s'\n", o_trace_path);
+    exit(1);
+  }
+  peak = rtlim_peak_create(NUM_WINDOWS, windows_ns, o_resolution);
+
+  start_real_ns = current_time_ns();
+  while ((status = rtlim_trace_next(trace, &ts_ns, &size)) == 1) {
+    int tokens = rtlim_msg_tokens(o_bytes_per_token, size);
+
+    if (peak->count == 0) first_ns = ts_ns;
+    last_ns = ts_ns;
+    bytes += size;
+    rtlim_peak_add(peak, ts_ns, tokens, size);
+    if (qmodel != NULL) {
+      (void)rtlim_qmodel_add(qmodel, ts_ns, size);
+    }
+  }
+  if (status == -1) {
+    fprintf(stderr, "Malformed trace record %llu in '%s'\n",
+      trace->line_num, o_trace_path);
+    exit(1);
+  }
+  real_ns = current_time_ns() - start_real_ns;
+  if (last_ns < first_ns) last_ns = first_ns;  /* Out-of-order trace. */
+  duration_sec = (last_ns - first_ns) / 1e9;
+
+  printf("messages,bytes,duration_ns,mean_msg_rate,mean_bit_rate\n");
+  printf("%llu,%llu,%llu,%.0f,%.0f\n", peak->count, bytes, last_ns - first_ns,
+    (duration_sec > 0.0) ? peak->count / duration_sec : 0.0,
+    (duration_sec > 0.0) ? bytes * 8.0 / duration_sec : 0.0);
+
+  printf("\nwindow_ns,quantum_ns,max_msgs,max_bytes,max_tokens,"
+    "peak_msg_rate,peak_bit_rate,limit_tokens,conforms\n");
+  for (w = 0; w < NUM_WINDOWS; w++) {
+    double window_sec = peak->windows_ns[w] / 1e9;
+
+    printf("%llu,%llu,%llu,%llu,%llu,%.0f,%.0f", peak->windows_ns[w],
+      peak->quantum_ns[w], peak->max_count[w], peak->max_bytes[w],
+      peak->max_tokens[w], peak->max_count[w] / window_sec,
+      peak->max_bytes[w] * 8.0 / window_sec);
+    if (o_amount > 0) {
+      /* A window holds at most ceil(window/interval) refills, plus what was
+       * left before the first. Allow for the rounded window length. */
+      unsigned long long span_ns = peak->windows_ns[w] + 2 * peak->quantum_ns[w];
+      unsigned long long limit = (unsigned long long)o_amount *
+        ((span_ns + o_interval_ns - 1) / o_interval_ns + 1);
+      int conforms = (peak->max_tokens[w] <= limit);
+      if (! conforms) num_nonconforming++;
+      printf(",%llu,%d\n", limit, conforms);
+    }
+    else {
+      printf(",,\n");
+    }
+  }
+
+  if (qmodel != NULL) {
+    for (s = 0; s < qmodel->num_stages; s++) {
+      burst_close(&bursts, s);
+    }
+    printf("\nstage,capacity_bytes,drain_rate,max_occupancy,max_fill_pct,"
+      "overflows,overflow_bytes\n");
+    for (s = 0; s < qmodel->num_stages; s++) {
+      rtlim_qstage_t *stage = &qmodel->stages[s];
+      printf("%d,%llu,%llu,%llu,%.1f,%llu,%llu\n", s, stage->capacity_bytes,
+        stage->drain_rate, stage->max_occupancy,
+        100.0 * stage->max_occupancy / stage->capacity_bytes,
+        stage->overflows, stage->overflow_bytes);
+    }
+    printf("\nburst_start_ns,burst_end_ns,stage,overflows,overflow_bytes\n");
+    for (w = 0; w < bursts.num_listed; w++) {
+      burst_t *burst = &bursts.list[w];
+      printf("%llu,%llu,%d,%llu,%llu\n", burst->start_ns, burst->end_ns,
+        burst->stage, burst->overflows, burst->overflow_bytes);
+    }
+  }
+
+  fprintf(stderr, "Analyzed %llu messages in %.3f sec (%.0f ns/message)\n",
+    peak->count, real_ns / 1e9, (peak->count > 0) ? (double)real_ns / peak->count : 0.0);
+  if (o_amount > 0) {
+    fprintf(stderr, "%d of %d window sizes exceed the limit\n",
+      num_nonconforming, NUM_WINDOWS);
+  }
+  if (qmodel != NULL) {
+    fprintf(stderr, "%llu microbursts overflowed the buffer model%s\n",
+      bursts.num_bursts, (bursts.num_bursts > bursts.num_listed) ? " (not all listed)" : "");
+    rtlim_qmodel_delete(qmodel);
+    free(bursts.list);
+  }
+
+  rtlim_peak_delete(peak);
+  rtlim_trace_close(trace);
+
+  return 0;
+}  /* main */
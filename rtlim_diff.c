@@ -0,0 +1,627 @@
+/* rtlim_diff.c - Differential test of limiter engines against a reference model.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Drives a plain reference model of the rtlim algorithm and a limiter
+ * "engine" with the same randomized operation sequences on a virtual
+ * clock, and checks that after every operation they agree on the status,
+ * the time the take was granted, the tokens left and the last refill
+ * time. Each case runs the engine in a child process. One that takes too
+ * long on a case is taken to be stuck in a loop (a common way for a
+ * limiter to be wrong on a virtual clock) and is killed by an alarm;
+ * that, or a crash, is also a difference. A failing sequence is minimized (operations removed and values
+ * shrunk while it still fails) and printed, with the seed to reproduce it.
+ *
+ * Engines are listed in "engines[]". Any faster implementation of
+ * rtlim_take() (or a mode that must not change its decisions) should be
+ * added there before it is adopted. The "mutant" engine is deliberately
+ * wrong, to check that the harness catches and minimizes a difference.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "rtlim.h"
+
+
+/* Command-line options. */
+static char *o_engine = NULL;   /* NULL = all but "mutant". */
+static int o_cases = 2000;
+static int o_ops = 200;
+static unsigned int o_seed = 1;
+
+#define MAX_OPS 10000
+#define MAX_BATCH 64
+/* An engine running a case for longer than this is stuck. */
+#define STUCK_SEC 1
+
+
+/* One operation: let time pass, then take. */
+typedef struct op_s {
+  unsigned long long advance_ns;
+  int take;
+  int block;
+} op_t;
+
+/* A test case: a limiter configuration and a sequence of operations. */
+typedef struct case_s {
+  unsigned long long interval_ns;
+  int amount;
+  unsigned long long start_ns;
+  int num_ops;
+  op_t ops[MAX_OPS];
+} case_t;
+
+/* State after an operation. */
+typedef struct result_s {
+  int status;
+  unsigned long long grant_ns;     /* Clock after the take. */
+  int state_valid;                 /* Tokens and last refill are known. */
+  int tokens;
+  unsigned long long last_refill_ns;
+} result_t;
+
+/* Runs a whole case, filling a result per operation. */
+typedef void (*engine_run_t)(case_t *c, result_t *results);
+
+typedef struct engine_s {
+  char *name;
+  char *desc;
+  engine_run_t run;
+} engine_t;
+
+
+char *usage_str = "Usage: rtlim_diff [-h] [-e engine] [-n cases] [-o ops] [-s seed]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help();
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "he:n:o:s:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'e': o_engine = optarg; break;
+      case 'n': o_cases = atoi(optarg); break;
+      case 'o': o_ops = atoi(optarg); break;
+      case 's': o_seed = (unsigned int)strtoul(optarg, NULL, 10); break;
+      default: usage(NULL);
+    }
+  }
+  if (o_cases < 1) usage("cases must be > 0");
+  if (o_ops < 1 || o_ops > MAX_OPS) usage("ops must be 1..10000");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+/*************************** Reference ***************************/
+
+/* The algorithm as the README describes it, written for clarity. */
+void ref_run(case_t *c, result_t *results)
+{
+  unsigned long long now_ns = c->start_ns;
+  unsigned long long last_refill_ns = c->start_ns;
+  int tokens = c->amount;
+  int i;
+
+  for (i = 0; i < c->num_ops; i++) {
+    op_t *op = &c->ops[i];
+    int need = op->take;
+    int status = 0;
+
+    now_ns += op->advance_ns;
+    if (op->block == RTLIM_NON_BLOCK && need > c->amount) {
+      status = -2;
+      need = 0;
+    }
+    while (need > 0 || status == 0) {
+      if (now_ns >= last_refill_ns + c->interval_ns) {
+        tokens = c->amount;
+        last_refill_ns = now_ns;
+      }
+      if (need <= tokens) {
+        tokens -= need;
+        break;
+      }
+      if (op->block == RTLIM_NON_BLOCK) {
+        status = -1;
+        break;
+      }
+      need -= tokens;
+      tokens = 0;
+      now_ns = last_refill_ns + c->interval_ns;  /* Wait. */
+    }
+
+    results[i].status = status;
+    results[i].grant_ns = now_ns;
+    results[i].state_valid = 1;
+    results[i].tokens = tokens;
+    results[i].last_refill_ns = last_refill_ns;
+  }
+}  /* ref_run */
+
+
+/**************************** Engines ****************************/
+
+/* Written by the engine's child process, read by the harness. */
+typedef struct shared_s {
+  volatile int cur_op;             /* Operation the engine is on. */
+  result_t results[MAX_OPS];
+} shared_t;
+
+static shared_t *shared;         /* Mapped shared by main(). */
+static char *died;               /* How the engine died at cur_op in the
+                                  * last diff_case() ("stuck"), or NULL. */
+
+
+static rtlim_t *engine_create(case_t *c, rtlim_vclock_t *vclock)
+{
+  rtlim_t *rl;
+
+  vclock->now_ns = c->start_ns;
+  rl = rtlim_create(c->interval_ns, c->amount);
+  if (rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, vclock) != 0) {
+    fprintf(stderr, "rtlim_set_clock failed\n");
+    exit(1);
+  }
+  return rl;
+}  /* engine_create */
+
+
+static void engine_result(result_t *result, int status, rtlim_t *rl,
+  rtlim_vclock_t *vclock)
+{
+  result->status = status;
+  result->grant_ns = vclock->now_ns;
+  result->state_valid = 1;
+  result->tokens = rl->current_tokens;
+  result->last_refill_ns = rl->last_refill_ns;
+}  /* engine_result */
+
+
+/* rtlim_take(), as is. */
+void take_run(case_t *c, result_t *results)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl = engine_create(c, &vclock);
+  int i;
+
+  for (i = 0; i < c->num_ops; i++) {
+    int status;
+    shared->cur_op = i;
+    vclock.now_ns += c->ops[i].advance_ns;
+    status = rtlim_take(rl, c->ops[i].take, c->ops[i].block);
+    engine_result(&results[i], status, rl, &vclock);
+  }
+  rtlim_delete(rl);
+}  /* take_run */
+
+
+/* Runs of blocking takes with no time between them go to rtlim_schedule()
+ * as one batch, and each is "sent" at its departure time. */
+void schedule_run(case_t *c, result_t *results)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl = engine_create(c, &vclock);
+  int costs[MAX_BATCH];
+  unsigned long long departures_ns[MAX_BATCH];
+  int i = 0;
+
+  while (i < c->num_ops) {
+    int n = 0;
+    int k;
+
+    shared->cur_op = i;
+    vclock.now_ns += c->ops[i].advance_ns;
+    if (c->ops[i].block == RTLIM_NON_BLOCK) {
+      int status = rtlim_take(rl, c->ops[i].take, c->ops[i].block);
+      engine_result(&results[i++], status, rl, &vclock);
+      continue;
+    }
+
+    do {
+      costs[n] = c->ops[i + n].take;
+      n++;
+    } while (n < MAX_BATCH && i + n < c->num_ops &&
+      c->ops[i + n].block != RTLIM_NON_BLOCK && c->ops[i + n].advance_ns == 0);
+
+    (void)rtlim_schedule(rl, costs, departures_ns, n);
+    for (k = 0; k < n; k++) {
+      results[i + k].status = 0;
+      results[i + k].grant_ns = departures_ns[k];
+      results[i + k].state_valid = 0;  /* Only known at the end of the batch. */
+    }
+    i += n;
+    vclock.now_ns = departures_ns[n - 1];  /* The batch has been sent. */
+    engine_result(&results[i - 1], 0, rl, &vclock);
+  }
+  rtlim_delete(rl);
+}  /* schedule_run */
+
+
+/* rtlim_take() with a spin governor that keeps changing its wait mode
+ * (which must not change its decisions). */
+void gov_run(case_t *c, result_t *results)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl = engine_create(c, &vclock);
+  rtlim_gov_t *gov = rtlim_gov_create(c->interval_ns * 4, c->interval_ns / 2 + 1, NULL, NULL);
+  int i;
+
+  rtlim_set_gov(rl, gov);
+  for (i = 0; i < c->num_ops; i++) {
+    int status;
+    shared->cur_op = i;
+    vclock.now_ns += c->ops[i].advance_ns;
+    status = rtlim_take(rl, c->ops[i].take, c->ops[i].block);
+    engine_result(&results[i], status, rl, &vclock);
+  }
+  rtlim_set_gov(rl, NULL);
+  rtlim_gov_delete(gov);
+  rtlim_delete(rl);
+}  /* gov_run */
+
+
+/* rtlim_take() with a (stricter) shadow limiter attached. */
+void shadow_run(case_t *c, result_t *results)
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl = engine_create(c, &vclock);
+  rtlim_shadow_t *shadow = rtlim_shadow_create(c->interval_ns * 2, c->amount);
+  int i;
+
+  (void)rtlim_set_shadow(rl, shadow);
+  for (i = 0; i < c->num_ops; i++) {
+    int status;
+    shared->cur_op = i;
+    vclock.now_ns += c->ops[i].advance_ns;
+    status = rtlim_take(rl, c->ops[i].take, c->ops[i].block);
+    engine_result(&results[i], status, rl, &vclock);
+  }
+  (void)rtlim_set_shadow(rl, NULL);
+  rtlim_shadow_delete(shadow);
+  rtlim_delete(rl);
+}  /* shadow_run */
+
+
+/* Deliberately wrong: refills one nanosecond late. */
+void mutant_run(case_t *c, result_t *results)
+{
+  case_t *late = (case_t *)malloc(sizeof(case_t));
+
+  if (late == NULL) {
+    fprintf(stderr, "malloc failed\n");
+    exit(1);
+  }
+  *late = *c;
+  late->interval_ns++;
+  ref_run(late, results);
+  free(late);
+}  /* mutant_run */
+
+
+static engine_t engines[] = {
+  { "take", "rtlim_take()", take_run },
+  { "schedule", "rtlim_schedule() for runs of back-to-back blocking takes", schedule_run },
+  { "gov", "rtlim_take() with a spin governor", gov_run },
+  { "shadow", "rtlim_take() with a shadow limiter", shadow_run },
+  { "mutant", "deliberately wrong, to test the harness", mutant_run },
+};
+#define NUM_ENGINES (sizeof(engines) / sizeof(engines[0]))
+
+
+void help() {
+  int e;
+
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -e engine : engine to test (default: all but mutant)\n"
+      "  -n cases : random cases per engine [%d]\n"
+      "  -o ops : operations per case [%d]\n"
+      "  -s seed : random seed of the first case [%u]\n"
+      , o_cases, o_ops, o_seed);
+  fprintf(stderr, "engines:\n");
+  for (e = 0; e < NUM_ENGINES; e++) {
+    fprintf(stderr, "  %s : %s\n", engines[e].name, engines[e].desc);
+  }
+  exit(0);
+}
+
+
+/*************************** Harness ****************************/
+
+static result_t ref_results[MAX_OPS];
+
+
+/* Runs "c" on both, the engine in a child process (so a stuck or
+ * crashed engine leaves the harness as it was). Returns the index of the
+ * first operation they disagree after, or -1. */
+int diff_case(engine_t *engine, case_t *c)
+{
+  pid_t pid;
+  int wstatus;
+  int i;
+
+  ref_run(c, ref_results);
+  shared->cur_op = 0;
+  died = NULL;
+  fflush(stdout);
+  pid = fork();
+  if (pid == -1) {
+    perror("fork");
+    exit(1);
+  }
+  if (pid == 0) {
+    alarm(STUCK_SEC);  /* Default action kills the child. */
+    engine->run(c, shared->results);
+    _exit(0);
+  }
+  if (waitpid(pid, &wstatus, 0) == -1) {
+    perror("waitpid");
+    exit(1);
+  }
+  if (WIFSIGNALED(wstatus) && WTERMSIG(wstatus) == SIGALRM) {
+    died = "stuck";
+  }
+  else if (! WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0) {
+    died = "crashed";
+  }
+  if (died != NULL) {
+    return shared->cur_op;
+  }
+
+  for (i = 0; i < c->num_ops; i++) {
+    result_t *ref = &ref_results[i];
+    result_t *eng = &shared->results[i];
+    if (ref->status != eng->status || ref->grant_ns != eng->grant_ns) {
+      return i;
+    }
+    if (eng->state_valid &&
+      (ref->tokens != eng->tokens || ref->last_refill_ns != eng->last_refill_ns))
+    {
+      return i;
+    }
+  }
+  return -1;
+}  /* diff_case */
+
+
+/* Random case from "seed", like real use: bursts of takes with no time
+ * between them, and all block modes. */
+void gen_case(case_t *c, unsigned int seed, int num_ops)
+{
+  int i;
+
+  srand(seed);
+  c->interval_ns = 1 + rand() % 1000000;
+  c->amount = 1 + rand() % 200;
+  c->start_ns = (unsigned long long)rand() * 1000;
+  c->num_ops = num_ops;
+  for (i = 0; i < num_ops; i++) {
+    op_t *op = &c->ops[i];
+    op->advance_ns = (rand() % 4 == 0) ? 0 : rand() % (c->interval_ns * 3);
+    op->take = rand() % (c->amount * 3 + 1);
+    op->block = 1 + rand() % 4;
+  }
+}  /* gen_case */
+
+
+/* Try "trial" in place of "c": keep it if it still fails. */
+static int try_case(engine_t *engine, case_t *c, case_t *trial)
+{
+  if (diff_case(engine, trial) < 0) {
+    return 0;
+  }
+  *c = *trial;
+  return 1;
+}  /* try_case */
+
+
+/* Shrink a failing case: drop operations after the first difference,
+ * then remove runs of operations (halving the run length), then make
+ * values smaller, until nothing more can go. */
+void minimize(engine_t *engine, case_t *c)
+{
+  case_t *trial = (case_t *)malloc(sizeof(case_t));
+  int progress = 1;
+
+  if (trial == NULL) {
+    fprintf(stderr, "malloc failed\n");
+    exit(1);
+  }
+
+  while (progress) {
+    int chunk, i;
+
+    progress = 0;
+    c->num_ops = diff_case(engine, c) + 1;
+
+    for (chunk = c->num_ops / 2; chunk >= 1; chunk /= 2) {
+      for (i = 0; i + chunk <= c->num_ops; ) {
+        *trial = *c;
+        memmove(&trial->ops[i], &trial->ops[i + chunk],
+          (c->num_ops - i - chunk) * sizeof(op_t));
+        trial->num_ops -= chunk;
+        if (trial->num_ops > 0 && try_case(engine, c, trial)) {
+          progress = 1;
+        }
+        else {
+          i += chunk;
+        }
+      }
+    }
+
+    for (i = 0; i < c->num_ops; i++) {
+      op_t *op = &c->ops[i];
+      if (op->advance_ns > 0) {
+        *trial = *c;
+        trial->ops[i].advance_ns = 0;
+        if (try_case(engine, c, trial)) { progress = 1; continue; }
+        trial->ops[i].advance_ns = op->advance_ns / 2;
+        if (try_case(engine, c, trial)) { progress = 1; continue; }
+      }
+      if (op->take > 0) {
+        *trial = *c;
+        trial->ops[i].take = op->take / 2;
+        if (try_case(engine, c, trial)) { progress = 1; continue; }
+        trial->ops[i].take = op->take - 1;
+        if (try_case(engine, c, trial)) { progress = 1; continue; }
+      }
+      if (op->block != RTLIM_BLOCK_SPIN && op->block != RTLIM_NON_BLOCK) {
+        *trial = *c;
+        trial->ops[i].block = RTLIM_BLOCK_SPIN;
+        if (try_case(engine, c, trial)) { progress = 1; continue; }
+      }
+    }
+
+    if (c->amount > 1) {
+      *trial = *c;
+      trial->amount = c->amount / 2;
+      if (try_case(engine, c, trial)) progress = 1;
+    }
+    if (c->interval_ns > 1) {
+      *trial = *c;
+      trial->interval_ns = c->interval_ns / 2;
+      if (try_case(engine, c, trial)) progress = 1;
+    }
+  }
+
+  free(trial);
+}  /* minimize */
+
+
+static char *block_name(int block)
+{
+  switch (block) {
+    case RTLIM_BLOCK_SPIN: return "spin";
+    case RTLIM_BLOCK_SLEEP: return "sleep";
+    case RTLIM_NON_BLOCK: return "nonblock";
+    case RTLIM_BLOCK_HYBRID: return "hybrid";
+  }
+  return "?";
+}  /* block_name */
+
+
+/* Print a (minimized) failing case, with both sides' results. Times are
+ * relative to the start. */
+void print_case(engine_t *engine, case_t *c, unsigned int seed)
+{
+  int i;
+
+  (void)diff_case(engine, c);
+  printf("Engine %s differs from the reference (seed %u), minimized to:\n",
+    engine->name, seed);
+  printf("  rtlim_create(%llu, %d) at %llu\n", c->interval_ns, c->amount, c->start_ns);
+  for (i = 0; i < c->num_ops; i++) {
+    result_t *ref = &ref_results[i];
+    result_t *eng = &shared->results[i];
+    if (died != NULL && i >= shared->cur_op) {
+      printf("  +%llu ns: take %d %s: ref %d at %llu, %s %s\n",
+        c->ops[i].advance_ns, c->ops[i].take, block_name(c->ops[i].block),
+        ref->status, ref->grant_ns - c->start_ns, engine->name, died);
+      break;
+    }
+    printf("  +%llu ns: take %d %s: ref %d at %llu (tokens %d, refill %llu), "
+      "%s %d at %llu",
+      c->ops[i].advance_ns, c->ops[i].take, block_name(c->ops[i].block),
+      ref->status, ref->grant_ns - c->start_ns, ref->tokens,
+      ref->last_refill_ns - c->start_ns,
+      engine->name, eng->status, eng->grant_ns - c->start_ns);
+    if (eng->state_valid) {
+      printf(" (tokens %d, refill %llu)", eng->tokens, eng->last_refill_ns - c->start_ns);
+    }
+    printf("\n");
+  }
+}  /* print_case */
+
+
+/* Returns 0 if the engine agrees on every case. */
+int test_engine(engine_t *engine)
+{
+  case_t *c = (case_t *)malloc(sizeof(case_t));
+  unsigned long long ops = 0;
+  int n;
+
+  if (c == NULL) {
+    fprintf(stderr, "malloc failed\n");
+    exit(1);
+  }
+
+  for (n = 0; n < o_cases; n++) {
+    gen_case(c, o_seed + n, o_ops);
+    ops += c->num_ops;
+    if (diff_case(engine, c) >= 0) {
+      minimize(engine, c);
+      print_case(engine, c, o_seed + n);
+      free(c);
+      return 1;
+    }
+  }
+  printf("Engine %s: %d cases, %llu operations, no differences\n",
+    engine->name, o_cases, ops);
+
+  free(c);
+  return 0;
+}  /* test_engine */
+
+
+int main(int argc, char **argv)
+{
+  int e, found = 0, failed = 0;
+
+  get_my_opts(argc, argv);
+  shared = (shared_t *)mmap(NULL, sizeof(shared_t), PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    perror("mmap");
+    exit(1);
+  }
+
+  for (e = 0; e < NUM_ENGINES; e++) {
+    if (o_engine == NULL ? strcmp(engines[e].name, "mutant") != 0
+      : strcmp(engines[e].name, o_engine) == 0)
+    {
+      found = 1;
+      failed |= test_engine(&engines[e]);
+    }
+  }
+  if (! found) usage("Unknown engine");
+
+  if (failed) {
+    return 1;
+  }
+  printf("OK\n");
+  return 0;
+}  /* main */
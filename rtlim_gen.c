@@ -0,0 +1,405 @@
+/* rtlim_gen.c - Traffic generator built on rtlim's timing.
+ * See https://github.com/UltraMessaging/rtlim for documentation.
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "rtlim.h"
+#include "rtlim_gen.h"
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+
+/* xorshift64* - fast, and plenty good enough for inter-arrival times. */
+static double gen_exp_variate(rtlim_gen_t *gen)
+{
+  unsigned long long r;
+  double u;
+
+  gen->rng_state ^= gen->rng_state >> 12;
+  gen->rng_state ^= gen->rng_state << 25;
+  gen->rng_state ^= gen->rng_state >> 27;
+  r = gen->rng_state * 0x2545F4914F6CDD1Dull;
+
+  u = (double)(r >> 11) * (1.0 / 9007199254740992.0);  /* [0, 1) */
+  return -log(1.0 - u);
+}  /* gen_exp_variate */
+
+
+/* API to create a generator that releases events following the rate
+ * profile "segs" (copied), starting now on "rtlim"'s clock.
+ * "seed" is only used for RTLIM_GEN_POISSON.
+ * Returns NULL for an invalid profile. */
+rtlim_gen_t *rtlim_gen_create(rtlim_t *rtlim, int spacing,
+  rtlim_gen_seg_t *segs, int num_segs, int repeat, unsigned long long seed)
+{
+  rtlim_gen_t *gen;
+  double cycle_events = 0.0;
+  int s;
+
+  if ((spacing != RTLIM_GEN_EVEN && spacing != RTLIM_GEN_POISSON) || num_segs < 1) {
+    return NULL;
+  }
+  for (s = 0; s < num_segs; s++) {
+    if (segs[s].start_rate < 0.0 || segs[s].end_rate < 0.0) {
+      return NULL;
+    }
+    if (segs[s].duration_ns == 0) {
+      /* "Forever" must be last and constant, and can't repeat. */
+      if (s != num_segs - 1 || repeat || segs[s].start_rate != segs[s].end_rate) {
+        return NULL;
+      }
+    }
+    else {
+      cycle_events += (segs[s].start_rate + segs[s].end_rate) / 2.0 *
+        segs[s].duration_ns / 1e9;
+    }
+  }
+  if (repeat && cycle_events == 0.0) {
+    return NULL;  /* Would never release anything. */
+  }
+
+  gen = (rtlim_gen_t *)malloc(sizeof(rtlim_gen_t));
+  NULLCHK(gen);
+  memset(gen, 0, sizeof(*gen));
+  gen->segs = (rtlim_gen_seg_t *)malloc(num_segs * sizeof(rtlim_gen_seg_t));
+  NULLCHK(gen->segs);
+  memcpy(gen->segs, segs, num_segs * sizeof(rtlim_gen_seg_t));
+  gen->seg_events = (double *)malloc(num_segs * sizeof(double));
+  NULLCHK(gen->seg_events);
+
+  for (s = 0; s < num_segs; s++) {
+    if (segs[s].duration_ns == 0) {
+      gen->seg_events[s] = (segs[s].start_rate > 0.0) ? INFINITY : 0.0;
+    }
+    else {
+      gen->seg_events[s] = (segs[s].start_rate + segs[s].end_rate) / 2.0 *
+        segs[s].duration_ns / 1e9;
+    }
+  }
+
+  gen->rtlim = rtlim;
+  gen->spacing = spacing;
+  gen->repeat = repeat;
+  gen->num_segs = num_segs;
+  gen->seg_start_ns = rtlim_now(rtlim);
+  gen->rng_state = seed * 0x9E3779B97F4A7C15ull + 1;  /* Never 0. */
+  if (gen->rng_state == 0) gen->rng_state = 1;
+  /* An even generator releases its first event right away. */
+  gen->x = (spacing == RTLIM_GEN_POISSON) ? gen_exp_variate(gen) : 0.0;
+
+  return gen;
+}  /* rtlim_gen_create */
+
+
+/* API to delete a generator (not its rtlim object). */
+void rtlim_gen_delete(rtlim_gen_t *gen)
+{
+  free(gen->segs);
+  free(gen->seg_events);
+  free(gen);
+}  /* rtlim_gen_delete */
+
+
+/* API to compute the next "count" release times (ns, on the rtlim
+ * object's clock) into "release_ns", without waiting.
+ * Returns the number computed, which is less than "count" only if a
+ * non-repeating profile has ended. */
+int rtlim_gen_fill(rtlim_gen_t *gen, unsigned long long *release_ns, int count)
+{
+  int i;
+
+  if (gen->ended) {
+    return 0;
+  }
+
+  for (i = 0; i < count; i++) {
+    rtlim_gen_seg_t *seg;
+    double t_ns;
+
+    /* Move to the segment that contains event x. */
+    while (gen->x >= gen->seg_events[gen->seg]) {
+      gen->x -= gen->seg_events[gen->seg];
+      gen->seg_start_ns += gen->segs[gen->seg].duration_ns;
+      gen->seg++;
+      if (gen->seg == gen->num_segs) {
+        if (! gen->repeat) {
+          gen->ended = 1;
+          return i;
+        }
+        gen->seg = 0;
+      }
+    }
+
+    /* Solve for the time within the segment at which the integral of the
+     * rate reaches x. */
+    seg = &gen->segs[gen->seg];
+    if (seg->start_rate == seg->end_rate) {
+      t_ns = gen->x * 1e9 / seg->start_rate;
+    }
+    else if (gen->x == 0.0) {
+      t_ns = 0.0;
+    }
+    else {
+      /* x = b*t + c*t*t/2, for rate b + c*t in events per ns. Solved in a
+       * form that is stable for small c and for decreasing rates. */
+      double b = seg->start_rate / 1e9;
+      double c = (seg->end_rate - seg->start_rate) / 1e9 / seg->duration_ns;
+      double disc = b * b + 2.0 * c * gen->x;
+      if (disc < 0.0) disc = 0.0;
+      t_ns = 2.0 * gen->x / (b + sqrt(disc));
+    }
+    release_ns[i] = gen->seg_start_ns + (unsigned long long)(t_ns + 0.5);
+
+    gen->x += (gen->spacing == RTLIM_GEN_EVEN) ? 1.0 : gen_exp_variate(gen);
+  }
+
+  return count;
+}  /* rtlim_gen_fill */
+
+
+/* API to wait for and release the next event. The "block" parameter must
+ * be one of: RTLIM_BLOCK_SPIN, RTLIM_BLOCK_SLEEP, RTLIM_NON_BLOCK.
+ * If "release_ns" is not NULL, the event's scheduled time is written there.
+ * Events whose time has already passed are released immediately, so a
+ * caller that falls behind catches up and the long-run rate is kept.
+ * Returns:
+ *    0 for success,
+ *   -1 for non-blocking and the next event's time hasn't come yet,
+ *   -2 for a non-repeating profile that has ended.
+ */
+int rtlim_gen_next(rtlim_gen_t *gen, int block, unsigned long long *release_ns)
+{
+  unsigned long long next_ns;
+
+  if (gen->batch_pos == gen->batch_len) {
+    gen->batch_len = rtlim_gen_fill(gen, gen->batch, RTLIM_GEN_BATCH);
+    gen->batch_pos = 0;
+    if (gen->batch_len == 0) {
+      return -2;
+    }
+  }
+  next_ns = gen->batch[gen->batch_pos];
+
+  if (block == RTLIM_NON_BLOCK) {
+    if (rtlim_now(gen->rtlim) < next_ns) {
+      return -1;
+    }
+  }
+  else {
+    rtlim_wait_until(gen->rtlim, next_ns, block);
+  }
+
+  gen->batch_pos++;
+  if (release_ns != NULL) {
+    *release_ns = next_ns;
+  }
+
+  return 0;
+}  /* rtlim_gen_next */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define RANGECHK(val_,lo_,hi_) do { \
+  double inval_ = (double)(val_); \
+  if (inval_ < (double)(lo_) || inval_ > (double)(hi_)) { \
+    fprintf(stderr, "Range check failed at %s:%d, %s=%f\n", \
+      __FILE__, __LINE__, #val_, inval_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define T0 1000000000ull
+
+static unsigned long long times[3000000];
+
+
+void test_even()
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  rtlim_gen_t *gen;
+  rtlim_gen_seg_t seg = { 3000000.0, 3000000.0, 0 };  /* 3M/sec forever. */
+  unsigned long long release_ns;
+  int i;
+
+  vclock.now_ns = T0;
+  rl = rtlim_create(1000, 1);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, &seg, 1, 0, 0);
+  EQUALCHK(rtlim_gen_fill(gen, times, 3000000), 3000000);
+  EQUALCHK(times[0], T0);
+  EQUALCHK(times[1], T0 + 333);
+  EQUALCHK(times[2], T0 + 667);
+  EQUALCHK(times[3], T0 + 1000);
+  EQUALCHK(times[2999999], T0 + 999999667);  /* No drift over a second. */
+  EQUALCHK(rtlim_gen_fill(gen, times, 1), 1);
+  EQUALCHK(times[0], T0 + 1000000000);
+  rtlim_gen_delete(gen);
+
+  /* Waiting releases on the virtual clock. */
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, &seg, 1, 0, 0);
+  EQUALCHK(rtlim_gen_next(gen, RTLIM_NON_BLOCK, &release_ns), 0);
+  EQUALCHK(release_ns, T0);
+  EQUALCHK(rtlim_gen_next(gen, RTLIM_NON_BLOCK, &release_ns), -1);  /* Too soon. */
+  for (i = 0; i < 1000; i++) {
+    EQUALCHK(rtlim_gen_next(gen, RTLIM_BLOCK_SPIN, &release_ns), 0);
+  }
+  EQUALCHK(release_ns, T0 + 333333);
+  EQUALCHK(vclock.now_ns, release_ns);
+  vclock.now_ns += 1000;  /* Fell behind by 3 events. */
+  for (i = 0; i < 3; i++) {
+    EQUALCHK(rtlim_gen_next(gen, RTLIM_NON_BLOCK, NULL), 0);
+  }
+  EQUALCHK(rtlim_gen_next(gen, RTLIM_NON_BLOCK, NULL), -1);
+  rtlim_gen_delete(gen);
+
+  /* Invalid profiles. */
+  seg.duration_ns = 0;
+  EQUALCHK(rtlim_gen_create(rl, RTLIM_GEN_EVEN, &seg, 1, 1, 0), NULL);
+  EQUALCHK(rtlim_gen_create(rl, 99, &seg, 1, 0, 0), NULL);
+  seg.start_rate = -1.0;
+  EQUALCHK(rtlim_gen_create(rl, RTLIM_GEN_EVEN, &seg, 1, 0, 0), NULL);
+
+  rtlim_delete(rl);
+}  /* test_even */
+
+
+void test_profiles()
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  rtlim_gen_t *gen;
+  rtlim_gen_seg_t onoff[2] = {
+    { 1000000.0, 1000000.0, 1000000 }, { 0.0, 0.0, 1000000 } };
+  rtlim_gen_seg_t steps[2] = {
+    { 1000000.0, 1000000.0, 1000000 }, { 2000000.0, 2000000.0, 1000000 } };
+  rtlim_gen_seg_t ramp[2] = {
+    { 0.0, 2000000.0, 1000000 }, { 2000000.0, 2000000.0, 0 } };
+  int i, num;
+
+  vclock.now_ns = T0;
+  rl = rtlim_create(1000, 1);
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+
+  /* On-off: 1000 events in each 1 ms on, none in each 1 ms off. */
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, onoff, 2, 1, 0);
+  EQUALCHK(rtlim_gen_fill(gen, times, 3000), 3000);
+  EQUALCHK(times[999], T0 + 999000);
+  EQUALCHK(times[1000], T0 + 2000000);
+  EQUALCHK(times[2999], T0 + 4999000);
+  rtlim_gen_delete(gen);
+
+  /* Steps, not repeating: 1000 then 2000 events, then the end. */
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, steps, 2, 0, 0);
+  EQUALCHK(rtlim_gen_fill(gen, times, 5000), 3000);
+  EQUALCHK(times[1000], T0 + 1000000);
+  EQUALCHK(times[1001], T0 + 1000500);
+  EQUALCHK(times[2999], T0 + 1999500);
+  EQUALCHK(rtlim_gen_fill(gen, times, 5000), 0);
+  EQUALCHK(rtlim_gen_next(gen, RTLIM_NON_BLOCK, NULL), -2);
+  rtlim_gen_delete(gen);
+
+  /* Ramp from 0 to 2M/sec over 1 ms (1000 events, event k at
+   * sqrt(k) * 1000 / sqrt(1000) us), then constant. */
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, ramp, 2, 0, 0);
+  EQUALCHK(rtlim_gen_fill(gen, times, 1100), 1100);
+  EQUALCHK(times[0], T0);
+  EQUALCHK(times[10], T0 + 100000);
+  EQUALCHK(times[250], T0 + 500000);
+  EQUALCHK(times[1000], T0 + 1000000);
+  EQUALCHK(times[1001], T0 + 1000500);
+  for (i = 1; i < 1100; i++) {
+    if (times[i] < times[i - 1]) EQUALCHK(times[i], times[i - 1]);  /* Fails. */
+  }
+  rtlim_gen_delete(gen);
+
+  /* Decreasing ramp from 2M/sec to 0: also 1000 events. */
+  ramp[0].start_rate = 2000000.0;
+  ramp[0].end_rate = 0.0;
+  gen = rtlim_gen_create(rl, RTLIM_GEN_EVEN, ramp, 1, 0, 0);
+  num = rtlim_gen_fill(gen, times, 2000);
+  EQUALCHK(num, 1000);
+  EQUALCHK(times[750], T0 + 500000);
+  rtlim_gen_delete(gen);
+
+  /* Poisson at 1M/sec: about 1M events in 1 sec, mean gap 1 us, and
+   * the gaps' standard deviation equals their mean. */
+  steps[0].duration_ns = 1000000000;
+  gen = rtlim_gen_create(rl, RTLIM_GEN_POISSON, steps, 1, 0, 12345);
+  num = rtlim_gen_fill(gen, times, 3000000);
+  RANGECHK(num, 997000, 1003000);
+  {
+    double sum = 0.0, sumsq = 0.0, mean;
+    for (i = 1; i < num; i++) {
+      double gap = (double)(times[i] - times[i - 1]);
+      sum += gap;
+      sumsq += gap * gap;
+    }
+    mean = sum / (num - 1);
+    RANGECHK(mean, 997.0, 1003.0);
+    RANGECHK(sqrt(sumsq / (num - 1) - mean * mean), 990.0, 1010.0);
+  }
+  rtlim_gen_delete(gen);
+
+  rtlim_delete(rl);
+}  /* test_profiles */
+
+
+int main(int argc, char **argv)
+{
+  test_even();
+  test_profiles();
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
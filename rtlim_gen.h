@@ -0,0 +1,85 @@
+/* rtlim_gen.h - Traffic generator built on rtlim's timing (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_GEN_H
+#define RTLIM_GEN_H
+
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* One segment of a rate profile. The rate changes linearly from
+ * start_rate to end_rate (events per second) over duration_ns; use equal
+ * rates for a constant segment and 0 for silence. A duration of 0 means
+ * "forever" (last segment only). */
+typedef struct rtlim_gen_seg_s {
+  double start_rate;
+  double end_rate;
+  unsigned long long duration_ns;
+} rtlim_gen_seg_t;
+
+
+/* Number of release times computed per bulk fill by rtlim_gen_next(). */
+#define RTLIM_GEN_BATCH 256
+
+/* Structure for "rtlim_gen" object. App should treat it as opaque.
+ * Event k is released when the integral of the rate profile reaches
+ * x(k), where x(k) = k for evenly spaced events, or the sum of k
+ * exponential variates for Poisson events. Computing each time from the
+ * profile (rather than adding gaps) means rounding never accumulates. */
+typedef struct rtlim_gen_s {
+  rtlim_t *rtlim;                /* Clock and waits (not owned). */
+  int spacing;                   /* RTLIM_GEN_EVEN or RTLIM_GEN_POISSON. */
+  int repeat;                    /* Profile repeats after the last segment. */
+  int num_segs;
+  rtlim_gen_seg_t *segs;
+  double *seg_events;            /* Integral of each segment's rate. */
+  int seg;                       /* Current segment. */
+  unsigned long long seg_start_ns;
+  double x;                      /* Next event, in events since seg start. */
+  unsigned long long rng_state;  /* For Poisson spacing. */
+  int ended;
+  unsigned long long batch[RTLIM_GEN_BATCH];  /* For rtlim_gen_next(). */
+  int batch_len;
+  int batch_pos;
+} rtlim_gen_t;
+
+
+/* Values for rtlim_gen_create() "spacing" parameter. */
+#define RTLIM_GEN_EVEN    1  /* Deterministic, evenly spaced at the rate. */
+#define RTLIM_GEN_POISSON 2  /* Poisson process with the given rate. */
+
+
+rtlim_gen_t *rtlim_gen_create(rtlim_t *rtlim, int spacing,
+  rtlim_gen_seg_t *segs, int num_segs, int repeat, unsigned long long seed);
+void rtlim_gen_delete(rtlim_gen_t *gen);
+int rtlim_gen_fill(rtlim_gen_t *gen, unsigned long long *release_ns, int count);
+int rtlim_gen_next(rtlim_gen_t *gen, int block, unsigned long long *release_ns);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_GEN_H */
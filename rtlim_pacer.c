@@ -0,0 +1,528 @@
+/* rtlim_pacer.c - Inline-or-defer sender with a pacer thread.
+ * See https://github.com/UltraMessaging/rtlim for documentation.
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Application threads that must never block in rtlim_take(), but don't
+ * want every message to go through a queue and another thread, send with
+ * rtlim_pacer_send(). It tries a non-blocking take; if that succeeds the
+ * message is sent inline, on the caller's thread. Otherwise it is queued
+ * for the pacer, which sends queued messages in order, each as soon as
+ * its tokens can be taken. So uncongested traffic has no queue hop, and
+ * congested traffic never blocks the producer.
+ *
+ * A message is never sent inline while older ones are queued (or being
+ * sent), so it can't overtake them, and the pacer waits for an inline
+ * send to finish before sending the next message: messages are sent one
+ * at a time, in the order their tokens were taken. The limiter is only
+ * taken from with the pacer's mutex held, so producers can be on several
+ * threads.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rtlim.h"
+#include "rtlim_pacer.h"
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+
+/* Send the next message. Mutex must be held; it is released around the
+ * send, during which "busy" keeps other sends out. */
+static void send_locked(rtlim_pacer_t *pacer, void *msg, int tokens)
+{
+  pacer->busy = 1;
+  pthread_mutex_unlock(&pacer->mutex);
+  (*pacer->send_cb)(msg, tokens, pacer->send_clientd);
+  pthread_mutex_lock(&pacer->mutex);
+  pacer->busy = 0;
+  pthread_cond_broadcast(&pacer->idle);
+}  /* send_locked */
+
+
+/* Send queued messages, oldest first, while their tokens can be taken.
+ * Mutex must be held; it is released around each send. A message bigger
+ * than the refill amount is taken a refill at a time.
+ * Returns the time the oldest message's tokens are due, or 0 if the
+ * queue is empty. */
+static unsigned long long drain_locked(rtlim_pacer_t *pacer)
+{
+  rtlim_t *rtlim = pacer->rtlim;
+
+  while (pacer->count > 0) {
+    rtlim_pacer_entry_t *entry;
+    int chunk;
+    void *msg;
+    int tokens;
+
+    /* Let an inline send (taken before anything was queued) finish. */
+    while (pacer->busy) {
+      pthread_cond_wait(&pacer->idle, &pacer->mutex);
+    }
+    entry = &pacer->queue[pacer->head];
+    chunk = entry->remaining;
+    if (chunk > rtlim->refill_token_amount) {
+      chunk = (int)rtlim->refill_token_amount;
+    }
+    if (rtlim_take(rtlim, chunk, RTLIM_NON_BLOCK) != 0) {
+      return rtlim->last_refill_ns + rtlim->refill_interval_ns;
+    }
+    entry->remaining -= chunk;
+    if (entry->remaining > 0) {
+      continue;
+    }
+
+    msg = entry->msg;
+    tokens = entry->tokens;
+    pacer->head = (pacer->head + 1) % pacer->queue_size;
+    pacer->count--;
+    pacer->deferred_sends++;
+    send_locked(pacer, msg, tokens);
+  }
+
+  return 0;
+}  /* drain_locked */
+
+
+static void *pacer_thread(void *arg)
+{
+  rtlim_pacer_t *pacer = (rtlim_pacer_t *)arg;
+
+  pthread_mutex_lock(&pacer->mutex);
+  for (;;) {
+    unsigned long long due_ns = drain_locked(pacer);
+
+    if (due_ns == 0) {
+      if (pacer->stop) {
+        break;
+      }
+      pthread_cond_wait(&pacer->cond, &pacer->mutex);
+    }
+    else {
+      /* Wait without the mutex, on a copy (rtlim_wait_until() keeps its
+       * last clock reading in the object). Newer messages queue behind
+       * this one, so there's nothing to wake up for. */
+      rtlim_t waiter = *pacer->rtlim;
+      pthread_mutex_unlock(&pacer->mutex);
+      rtlim_wait_until(&waiter, due_ns, pacer->block);
+      pthread_mutex_lock(&pacer->mutex);
+    }
+  }
+  pthread_mutex_unlock(&pacer->mutex);
+
+  return NULL;
+}  /* pacer_thread */
+
+
+/* API to create a pacer for "rtlim", which from now on must only be
+ * taken from through the pacer. Up to "queue_size" messages can wait.
+ * "block" is how the pacer's thread waits for tokens: RTLIM_BLOCK_SPIN,
+ * RTLIM_BLOCK_SLEEP or RTLIM_BLOCK_HYBRID; or RTLIM_NON_BLOCK for no
+ * thread, in which case the app must call rtlim_pacer_run(). The thread
+ * is pinned to "cpu" (-1 = not pinned). Messages are sent by calling
+ * "send_cb" with "send_clientd".
+ * Returns NULL for an invalid parameter, or if the thread can't be
+ * started. */
+rtlim_pacer_t *rtlim_pacer_create(rtlim_t *rtlim, int queue_size, int block,
+  int cpu, rtlim_pacer_send_cb_t send_cb, void *send_clientd)
+{
+  rtlim_pacer_t *pacer;
+
+  if (queue_size < 1 || send_cb == NULL || rtlim->refill_token_amount == 0) {
+    return NULL;
+  }
+  if (block != RTLIM_BLOCK_SPIN && block != RTLIM_BLOCK_SLEEP &&
+    block != RTLIM_BLOCK_HYBRID && block != RTLIM_NON_BLOCK)
+  {
+    return NULL;
+  }
+
+  pacer = (rtlim_pacer_t *)malloc(sizeof(rtlim_pacer_t));
+  NULLCHK(pacer);
+  memset(pacer, 0, sizeof(*pacer));
+  pacer->rtlim = rtlim;
+  pacer->send_cb = send_cb;
+  pacer->send_clientd = send_clientd;
+  pacer->queue_size = queue_size;
+  pacer->queue = (rtlim_pacer_entry_t *)malloc(queue_size * sizeof(rtlim_pacer_entry_t));
+  NULLCHK(pacer->queue);
+  pacer->block = block;
+  pacer->cpu = cpu;
+
+  pthread_mutex_init(&pacer->mutex, NULL);
+  pthread_cond_init(&pacer->cond, NULL);
+  pthread_cond_init(&pacer->idle, NULL);
+
+  if (block != RTLIM_NON_BLOCK) {
+    pthread_attr_t attr;
+    int status = 0;
+
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      status = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+    }
+    if (status == 0) {
+      status = pthread_create(&pacer->thread_id, &attr, pacer_thread, pacer);
+    }
+    pthread_attr_destroy(&attr);
+    if (status != 0) {
+      pthread_cond_destroy(&pacer->idle);
+      pthread_cond_destroy(&pacer->cond);
+      pthread_mutex_destroy(&pacer->mutex);
+      free(pacer->queue);
+      free(pacer);
+      return NULL;
+    }
+  }
+
+  return pacer;
+}  /* rtlim_pacer_create */
+
+
+/* API to delete a pacer. No thread may be sending. A pacer thread first
+ * sends everything still queued, at the limiter's rate; without a thread,
+ * queued messages are discarded. The limiter is not deleted. */
+void rtlim_pacer_delete(rtlim_pacer_t *pacer)
+{
+  if (pacer->block != RTLIM_NON_BLOCK) {
+    pthread_mutex_lock(&pacer->mutex);
+    pacer->stop = 1;
+    pthread_cond_signal(&pacer->cond);
+    pthread_mutex_unlock(&pacer->mutex);
+    pthread_join(pacer->thread_id, NULL);
+  }
+
+  pthread_cond_destroy(&pacer->idle);
+  pthread_cond_destroy(&pacer->cond);
+  pthread_mutex_destroy(&pacer->mutex);
+  free(pacer->queue);
+  free(pacer);
+}  /* rtlim_pacer_delete */
+
+
+/* API to send "msg", which needs "tokens" tokens, from any thread.
+ * Never blocks (except briefly on the pacer's mutex). While a message is
+ * being sent, by another producer or the pacer, the new one is queued.
+ * Returns:
+ *    0 if sent inline (send_cb has returned),
+ *    1 if queued for the pacer,
+ *   -1 if the queue is full, or "tokens" is not positive (not sent).
+ */
+int rtlim_pacer_send(rtlim_pacer_t *pacer, void *msg, int tokens)
+{
+  rtlim_pacer_entry_t *entry;
+
+  if (tokens <= 0) {
+    return -1;
+  }
+  pthread_mutex_lock(&pacer->mutex);
+  if (pacer->count == 0 && ! pacer->busy &&
+    rtlim_take(pacer->rtlim, tokens, RTLIM_NON_BLOCK) == 0)
+  {
+    pacer->inline_sends++;
+    send_locked(pacer, msg, tokens);
+    pthread_mutex_unlock(&pacer->mutex);
+    return 0;
+  }
+
+  if (pacer->count == pacer->queue_size) {
+    pacer->full_rejects++;
+    pthread_mutex_unlock(&pacer->mutex);
+    return -1;
+  }
+  entry = &pacer->queue[(pacer->head + pacer->count) % pacer->queue_size];
+  entry->msg = msg;
+  entry->tokens = tokens;
+  entry->remaining = tokens;
+  pacer->count++;
+  if (pacer->count > pacer->max_queued) {
+    pacer->max_queued = pacer->count;
+  }
+  if (pacer->count == 1) {
+    pthread_cond_signal(&pacer->cond);
+  }
+  pthread_mutex_unlock(&pacer->mutex);
+
+  return 1;
+}  /* rtlim_pacer_send */
+
+
+/* API for a pacer without a thread (RTLIM_NON_BLOCK): send the queued
+ * messages that can go now. Call again at (or after) the returned time,
+ * on the limiter's clock; 0 means the queue is empty, so there's no need
+ * until rtlim_pacer_send() returns 1. */
+unsigned long long rtlim_pacer_run(rtlim_pacer_t *pacer)
+{
+  unsigned long long due_ns;
+
+  pthread_mutex_lock(&pacer->mutex);
+  due_ns = drain_locked(pacer);
+  pthread_mutex_unlock(&pacer->mutex);
+
+  return due_ns;
+}  /* rtlim_pacer_run */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define RANGECHK(val_,lo_,hi_) do { \
+  double inval_ = (double)(val_); \
+  if (inval_ < (double)(lo_) || inval_ > (double)(hi_)) { \
+    fprintf(stderr, "Range check failed at %s:%d, %s=%f\n", \
+      __FILE__, __LINE__, #val_, inval_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+
+/* Records the order messages were sent in, and when. */
+typedef struct test_sent_s {
+  rtlim_t *rtlim;
+  volatile int in_send;
+  int overlaps;                  /* Sends that started during another. */
+  int count;
+  long ids[1000];
+  unsigned long long times_ns[1000];
+} test_sent_t;
+
+void test_send_cb(void *msg, int tokens, void *send_clientd)
+{
+  test_sent_t *sent = (test_sent_t *)send_clientd;
+
+  if (__sync_lock_test_and_set(&sent->in_send, 1) != 0) {
+    sent->overlaps++;
+  }
+  sent->times_ns[sent->count] = rtlim_now(sent->rtlim);
+  sent->ids[sent->count++] = (long)msg;
+  sched_yield();  /* Give another sender a chance to overlap. */
+  __sync_lock_release(&sent->in_send);
+}  /* test_send_cb */
+
+
+/* No thread, on a virtual clock. */
+void test_manual()
+{
+  rtlim_vclock_t vclock;
+  rtlim_t *rl;
+  rtlim_pacer_t *pacer;
+  test_sent_t sent;
+  unsigned long long t0;
+  long id;
+
+  vclock.now_ns = t0 = 1000000;
+  rl = rtlim_create(1000, 2);  /* 2 per us. */
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  sent.rtlim = rl;
+  sent.count = 0;
+  EQUALCHK(rtlim_pacer_create(rl, 0, RTLIM_NON_BLOCK, -1, test_send_cb, &sent), NULL);
+  EQUALCHK(rtlim_pacer_create(rl, 4, 99, -1, test_send_cb, &sent), NULL);
+  EQUALCHK(rtlim_pacer_create(rl, 4, RTLIM_NON_BLOCK, -1, NULL, &sent), NULL);
+  pacer = rtlim_pacer_create(rl, 4, RTLIM_NON_BLOCK, -1, test_send_cb, &sent);
+  NULLCHK(pacer);
+
+  EQUALCHK(rtlim_pacer_run(pacer), 0);
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)1, 0), -1);
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)1, -5), -1);
+  EQUALCHK(rl->current_tokens, 2);  /* Untouched. */
+  EQUALCHK(pacer->count, 0);
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)1, 1), 0);  /* Inline. */
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)2, 1), 0);
+  EQUALCHK(sent.count, 2);
+  for (id = 3; id <= 6; id++) {
+    EQUALCHK(rtlim_pacer_send(pacer, (void *)id, 1), 1);  /* Queued. */
+  }
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)7, 1), -1);  /* Full. */
+  EQUALCHK(rtlim_pacer_run(pacer), t0 + 1000);
+  EQUALCHK(sent.count, 2);
+
+  vclock.now_ns = t0 + 1000;
+  EQUALCHK(rtlim_pacer_run(pacer), t0 + 2000);
+  EQUALCHK(sent.count, 4);
+  vclock.now_ns = t0 + 2000;
+  EQUALCHK(rtlim_pacer_run(pacer), 0);
+  EQUALCHK(sent.count, 6);
+
+  /* Tokens are available, but an older message is queued. */
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)7, 1), 1);
+  vclock.now_ns = t0 + 3000;
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)8, 1), 1);
+  EQUALCHK(rtlim_pacer_run(pacer), 0);
+  EQUALCHK(sent.count, 8);
+  for (id = 1; id <= 8; id++) {
+    EQUALCHK(sent.ids[id - 1], id);
+  }
+  EQUALCHK(sent.times_ns[6], t0 + 3000);
+  EQUALCHK(pacer->inline_sends, 2);
+  EQUALCHK(pacer->deferred_sends, 6);
+  EQUALCHK(pacer->full_rejects, 1);
+  EQUALCHK(pacer->max_queued, 4);
+
+  /* More than the refill amount goes when a blocking take would. */
+  vclock.now_ns = t0 + 10000;
+  EQUALCHK(rtlim_pacer_send(pacer, (void *)9, 5), 1);
+  while ((vclock.now_ns = rtlim_pacer_run(pacer)) != 0) {
+  }
+  EQUALCHK(sent.count, 9);
+  EQUALCHK(sent.times_ns[8], t0 + 12000);
+
+  rtlim_pacer_delete(pacer);
+  rtlim_delete(rl);
+}  /* test_manual */
+
+
+/* A producer sending faster than the rate, with a pacer thread. */
+void test_thread(int block)
+{
+  rtlim_t *rl;
+  rtlim_pacer_t *pacer;
+  test_sent_t sent;
+  unsigned long long start_ns, elapsed_ns;
+  long id;
+
+  rl = rtlim_create(1000000, 10);  /* 10 per ms. */
+  sent.rtlim = rl;
+  sent.count = 0;
+  pacer = rtlim_pacer_create(rl, 1000, block, -1, test_send_cb, &sent);
+  NULLCHK(pacer);
+
+  start_ns = current_time_ns();
+  for (id = 0; id < 200; id++) {
+    EQUALCHK(rtlim_pacer_send(pacer, (void *)id, 1) >= 0, 1);
+  }
+  RANGECHK(pacer->inline_sends, 1, 10);
+  rtlim_pacer_delete(pacer);  /* Sends the rest. */
+  elapsed_ns = current_time_ns() - start_ns;
+
+  EQUALCHK(sent.count, 200);
+  for (id = 0; id < 200; id++) {
+    EQUALCHK(sent.ids[id], id);
+  }
+  RANGECHK(elapsed_ns, 18000000, 1000000000);
+  rtlim_delete(rl);
+}  /* test_thread */
+
+
+typedef struct test_producer_s {
+  rtlim_pacer_t *pacer;
+  pthread_t thread_id;
+  long first_id;
+} test_producer_t;
+
+void *test_producer_thread(void *arg)
+{
+  test_producer_t *producer = (test_producer_t *)arg;
+  long id;
+
+  for (id = producer->first_id; id < producer->first_id + 100; id++) {
+    EQUALCHK(rtlim_pacer_send(producer->pacer, (void *)id, 1) >= 0, 1);
+    if (id % 10 == 0) {
+      sched_yield();
+    }
+  }
+
+  return NULL;
+}  /* test_producer_thread */
+
+
+/* Several producers, inline and deferred: one send at a time, and each
+ * producer's messages in order. */
+void test_producers()
+{
+  rtlim_t *rl;
+  rtlim_pacer_t *pacer;
+  test_producer_t producers[4];
+  test_sent_t sent;
+  long next_id[4];
+  int p, i;
+
+  rl = rtlim_create(100000, 5);  /* 5 per 100 us. */
+  sent.rtlim = rl;
+  sent.in_send = 0;
+  sent.overlaps = 0;
+  sent.count = 0;
+  pacer = rtlim_pacer_create(rl, 1000, RTLIM_BLOCK_SLEEP, -1, test_send_cb, &sent);
+  NULLCHK(pacer);
+
+  for (p = 0; p < 4; p++) {
+    producers[p].pacer = pacer;
+    producers[p].first_id = p * 1000;
+    next_id[p] = p * 1000;
+    EQUALCHK(pthread_create(&producers[p].thread_id, NULL, test_producer_thread, &producers[p]), 0);
+  }
+  for (p = 0; p < 4; p++) {
+    pthread_join(producers[p].thread_id, NULL);
+  }
+  rtlim_pacer_delete(pacer);  /* Sends the rest. */
+
+  EQUALCHK(sent.count, 400);
+  EQUALCHK(sent.overlaps, 0);
+  for (i = 0; i < 400; i++) {
+    p = (int)(sent.ids[i] / 1000);
+    EQUALCHK(sent.ids[i], next_id[p]);
+    next_id[p]++;
+  }
+  rtlim_delete(rl);
+}  /* test_producers */
+
+
+int main(int argc, char **argv)
+{
+  test_manual();
+  test_thread(RTLIM_BLOCK_SLEEP);
+  test_thread(RTLIM_BLOCK_HYBRID);
+  test_producers();
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
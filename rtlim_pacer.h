@@ -0,0 +1,82 @@
+/* rtlim_pacer.h - Inline-or-defer sender with a pacer thread (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_PACER_H
+#define RTLIM_PACER_H
+
+#include <pthread.h>
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Application's send function, called with the message and its token
+ * amount as given to rtlim_pacer_send(). Called from the sending thread
+ * (inline) or the pacer's thread (deferred), never twice at once, in
+ * the order the messages' tokens were taken. */
+typedef void (*rtlim_pacer_send_cb_t)(void *msg, int tokens, void *send_clientd);
+
+/* A deferred message. */
+typedef struct rtlim_pacer_entry_s {
+  void *msg;
+  int tokens;
+  int remaining;                 /* Tokens still to take. */
+} rtlim_pacer_entry_t;
+
+/* Structure for "rtlim_pacer" object. App should treat it as opaque,
+ * except for the statistics. */
+typedef struct rtlim_pacer_s {
+  rtlim_t *rtlim;                /* Only taken from with the mutex held. */
+  rtlim_pacer_send_cb_t send_cb;
+  void *send_clientd;
+  rtlim_pacer_entry_t *queue;    /* Ring of queue_size entries. */
+  int queue_size;
+  int head;                      /* Oldest entry. */
+  int count;
+  int busy;                      /* In send_cb, inline or deferred. */
+  int block;                     /* Thread's wait; RTLIM_NON_BLOCK = none. */
+  int cpu;                       /* -1 = not pinned. */
+  int stop;
+  pthread_t thread_id;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;           /* Signals the thread that a message is queued. */
+  pthread_cond_t idle;           /* Signals that "busy" was cleared. */
+  unsigned long long inline_sends;
+  unsigned long long deferred_sends;
+  unsigned long long full_rejects;   /* Sends refused, queue full. */
+  int max_queued;
+} rtlim_pacer_t;
+
+
+rtlim_pacer_t *rtlim_pacer_create(rtlim_t *rtlim, int queue_size, int block,
+  int cpu, rtlim_pacer_send_cb_t send_cb, void *send_clientd);
+void rtlim_pacer_delete(rtlim_pacer_t *pacer);
+int rtlim_pacer_send(rtlim_pacer_t *pacer, void *msg, int tokens);
+unsigned long long rtlim_pacer_run(rtlim_pacer_t *pacer);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_PACER_H */
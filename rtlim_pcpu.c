@@ -0,0 +1,646 @@
+/* rtlim_pcpu.c - Per-CPU sharded rate limiter.
+ * See https://github.com/UltraMessaging/rtlim for documentation.
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* A limiter shared by many threads, whose take needs no lock and no atomic
+ * instruction. Each CPU has a shard holding its part of the host-wide
+ * budget, and a take only touches the shard of the CPU it runs on.
+ *
+ * On x86-64 Linux (glibc 2.35 or later, which registers a restartable
+ * sequence area for every thread), a take's update of its shard is a
+ * restartable sequence (rseq): a compare and a plain store, which the
+ * kernel restarts if the thread is preempted or migrated before the store.
+ * Elsewhere (or compiled with -DRTLIM_NO_RSEQ), the update is a
+ * compare-and-swap on the shard found with sched_getcpu(). A plain store
+ * and a compare-and-swap must never race on one shard, so with rseq there
+ * is a shard for every possible CPU id, and a thread without a usable
+ * rseq CPU (e.g. one glibc didn't register) uses an extra shard of its
+ * own, which is only ever updated by compare-and-swap.
+ *
+ * Once per refill interval, the first take to notice that the interval is
+ * over (under a mutex, try-locked so other takes don't wait) starts a new
+ * epoch and splits the budget between the shards in proportion to their
+ * demand in the last interval: tokens taken plus tokens refused. Idle CPUs
+ * thus give their budget to busy ones. Tokens not taken in an epoch are
+ * worthless in the next, as with rtlim's refill. Refills keep to the
+ * schedule set at create (or by rtlim_pcpu_set_clock()), as those of
+ * "rtlim_refill.c" do, however late a take notices them. A take that
+ * read its shard just before a refill can still commit against the old
+ * epoch, so as with rtlim, up to about twice the budget can go out around
+ * a refill.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <pthread.h>
+
+#include "rtlim.h"
+#include "rtlim_pcpu.h"
+
+#if defined(__x86_64__) && defined(__linux__) && !defined(RTLIM_NO_RSEQ)
+#define PCPU_RSEQ
+#include <sys/rseq.h>
+#if (defined(__clang__) && __clang_major__ >= 11) || \
+  (!defined(__clang__) && defined(__GNUC__) && __GNUC__ >= 11)
+#define PCPU_ASM_GOTO_OUTPUT  /* asm goto may have output operands. */
+#endif
+#endif
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+#define EPOCH(v_) ((unsigned int)((v_) >> 32))
+#define COUNT(v_) ((unsigned int)(v_))
+
+
+#if defined(PCPU_RSEQ)
+/* The CPU this thread is on, as kept by the kernel in its rseq area. */
+static inline int rseq_cpu()
+{
+  int cpu;
+
+  __asm__ __volatile__ ("movl %%fs:4(%1), %0" : "=r" (cpu) : "r" (__rseq_offset));
+
+  return cpu;
+}  /* rseq_cpu */
+
+
+/* If "*v" equals "expect", store "newv" in it, as a restartable sequence
+ * on "cpu": the store only happens if the thread is on "cpu" and is not
+ * preempted, interrupted or migrated between the check and the store.
+ * Returns 0 if stored, 1 if "*v" != "expect", -1 if aborted. */
+static inline int rseq_cmpeqv_storev(volatile unsigned long long *v,
+  unsigned long long expect, unsigned long long newv, int cpu)
+{
+  __asm__ __volatile__ goto (
+    /* struct rseq_cs: version, flags, start, post-commit offset, abort. */
+    ".pushsection __rseq_cs, \"aw\"\n\t"
+    ".balign 32\n\t"
+    "3:\n\t"
+    ".long 0x0, 0x0\n\t"
+    ".quad 1f, (2f - 1f), 4f\n\t"
+    ".popsection\n\t"
+    /* Point this thread's rseq area at it (rseq_cs is at offset 8). */
+    "leaq 3b(%%rip), %%rax\n\t"
+    "movq %%rax, %%fs:8(%[rseq_offset])\n\t"
+    "1:\n\t"
+    "cmpl %[cpu], %%fs:4(%[rseq_offset])\n\t"
+    "jnz 4f\n\t"
+    "cmpq %[v], %[expect]\n\t"
+    "jnz %l[cmpfail]\n\t"
+    "movq %[newv], %[v]\n\t"  /* Commit. */
+    "2:\n\t"
+    /* The abort handler must follow the signature the kernel checks. */
+    ".pushsection __rseq_failure, \"ax\"\n\t"
+    ".byte 0x0f, 0xb9, 0x3d\n\t"
+    ".long %c[sig]\n\t"
+    "4:\n\t"
+    "jmp %l[abort]\n\t"
+    ".popsection\n\t"
+#if defined(PCPU_ASM_GOTO_OUTPUT)
+    : [v] "+m" (*v)
+    : [cpu] "r" (cpu), [rseq_offset] "r" (__rseq_offset),
+#else
+    /* Older compilers allow no outputs in asm goto, so "*v" can only be an
+     * input; the "memory" clobber is what tells the compiler it changes. */
+    :
+    : [v] "m" (*v), [cpu] "r" (cpu), [rseq_offset] "r" (__rseq_offset),
+#endif
+      [expect] "r" (expect), [newv] "r" (newv), [sig] "i" (RSEQ_SIG)
+    : "memory", "cc", "rax"
+    : abort, cmpfail);
+
+  return 0;
+abort:
+  return -1;
+cmpfail:
+  return 1;
+}  /* rseq_cmpeqv_storev */
+#endif
+
+
+/* The calling thread's shard, and whether it has the shard to itself
+ * (so may update it with a restartable sequence). */
+static int pcpu_cpu(rtlim_pcpu_t *pcpu, int *exclusive)
+{
+  int cpu;
+
+#if defined(PCPU_RSEQ)
+  if (pcpu->use_rseq) {
+    cpu = rseq_cpu();  /* Negative if this thread isn't registered. */
+    if (cpu >= 0 && cpu < pcpu->num_cpus) {
+      *exclusive = 1;
+      return cpu;
+    }
+    *exclusive = 0;
+    return pcpu->num_cpus;  /* The extra, compare-and-swap only, shard. */
+  }
+#endif
+  cpu = sched_getcpu();
+  *exclusive = 0;
+
+  return (cpu < 0) ? 0 : cpu % pcpu->num_cpus;
+}  /* pcpu_cpu */
+
+
+/* The highest possible CPU id, plus one: CPU ids can have gaps, so the
+ * number of CPUs is not enough. */
+static int possible_cpus()
+{
+  char buf[256];
+  char *p, *end;
+  FILE *fp;
+  long cpu, max_cpu = -1;
+
+  fp = fopen("/sys/devices/system/cpu/possible", "r");  /* E.g. "0-3,8-11". */
+  if (fp != NULL) {
+    if (fgets(buf, sizeof(buf), fp) != NULL) {
+      for (p = buf; *p != '\0'; p = end) {
+        cpu = strtol(p, &end, 10);
+        if (end == p) {
+          end++;  /* Skip a separator. */
+        }
+        else if (cpu > max_cpu) {
+          max_cpu = cpu;
+        }
+      }
+    }
+    fclose(fp);
+  }
+  if (max_cpu < 0) {
+    max_cpu = sysconf(_SC_NPROCESSORS_CONF) - 1;
+  }
+
+  return (max_cpu < 0) ? 1 : (int)(max_cpu + 1);
+}  /* possible_cpus */
+
+
+/* Replace "*v" with "newv" if it is still "expect".
+ * Returns 0 if replaced, else non-zero (try again). */
+static inline int pcpu_update(volatile unsigned long long *v,
+  unsigned long long expect, unsigned long long newv, int cpu, int exclusive)
+{
+#if defined(PCPU_RSEQ)
+  if (exclusive) {
+    return rseq_cmpeqv_storev(v, expect, newv, cpu);
+  }
+#endif
+
+  return __sync_bool_compare_and_swap(v, expect, newv) ? 0 : 1;
+}  /* pcpu_update */
+
+
+/* Take "want" tokens from the calling CPU's shard, or with "partial", as
+ * many as it has, up to "want". Records any shortfall as demand.
+ * Returns the number taken. */
+static int shard_take(rtlim_pcpu_t *pcpu, int want, int partial)
+{
+  rtlim_pcpu_shard_t *shard;
+  unsigned long long denied;
+  int cpu, exclusive, got;
+
+  for (;;) {
+    unsigned long long grant, use, cur;
+    long long avail;
+
+    cpu = pcpu_cpu(pcpu, &exclusive);
+    shard = &pcpu->shards[cpu];
+    grant = shard->grant;
+    use = cur = shard->use;
+    if (EPOCH(use) != EPOCH(grant)) {
+      cur = grant & 0xffffffff00000000ull;  /* New epoch: none taken yet. */
+    }
+    avail = (long long)COUNT(grant) - (long long)COUNT(cur);
+    got = (want <= avail) ? want : (partial && avail > 0 ? (int)avail : 0);
+    if (got == 0) {
+      break;
+    }
+    if (pcpu_update(&shard->use, use, cur + got, cpu, exclusive) == 0) {
+      break;
+    }
+  }
+
+  if (got < want) {
+    do {
+      cpu = pcpu_cpu(pcpu, &exclusive);
+      shard = &pcpu->shards[cpu];
+      denied = shard->denied;
+    } while (pcpu_update(&shard->denied, denied, denied + (want - got), cpu, exclusive) != 0);
+  }
+
+  return got;
+}  /* shard_take */
+
+
+/* Start a new epoch if the interval is over, splitting the budget by
+ * demand. If another thread is already doing it, just return. */
+static void pcpu_refill(rtlim_pcpu_t *pcpu, unsigned long long now_ns)
+{
+  unsigned long long total = 0, granted = 0, busiest = 0;
+  unsigned long long amount = pcpu->refill_token_amount;
+  unsigned int epoch;
+  int s;
+
+  if (pthread_mutex_trylock(&pcpu->refill_mutex) != 0) {
+    return;
+  }
+  if (now_ns < pcpu->next_refill_ns) {
+    pthread_mutex_unlock(&pcpu->refill_mutex);
+    return;
+  }
+
+  for (s = 0; s < pcpu->num_shards; s++) {
+    rtlim_pcpu_shard_t *shard = &pcpu->shards[s];
+    unsigned long long use = shard->use;
+    unsigned long long denied = shard->denied;
+    unsigned long long demand = (EPOCH(use) == pcpu->epoch) ? COUNT(use) : 0;
+
+    demand += denied - shard->prev_denied;
+    shard->prev_denied = denied;
+    if (demand > amount) demand = amount;  /* Keeps the product below in range. */
+    pcpu->demand[s] = demand;
+    total += demand;
+    if (demand > pcpu->demand[busiest]) busiest = s;
+  }
+
+  for (s = 0; s < pcpu->num_shards; s++) {
+    if (total == 0) {  /* No demand anywhere: split evenly. */
+      pcpu->demand[s] = amount / pcpu->num_shards + ((s < amount % pcpu->num_shards) ? 1 : 0);
+    }
+    else {
+      pcpu->demand[s] = amount * pcpu->demand[s] / total;
+    }
+    granted += pcpu->demand[s];
+  }
+  pcpu->demand[busiest] += amount - granted;  /* Rounding. */
+
+  epoch = pcpu->epoch + 1;
+  for (s = 0; s < pcpu->num_shards; s++) {
+    pcpu->shards[s].grant = ((unsigned long long)epoch << 32) | pcpu->demand[s];
+  }
+  pcpu->epoch = epoch;
+  /* Stay in phase: the next refill is due an interval after this one was
+   * due, however late this one is (intervals missed entirely are
+   * skipped), so late refills don't slow the long-run rate. */
+  if (pcpu->refill_interval_ns == 0) {
+    pcpu->next_refill_ns = now_ns;
+  }
+  else {
+    pcpu->next_refill_ns += pcpu->refill_interval_ns *
+      ((now_ns - pcpu->next_refill_ns) / pcpu->refill_interval_ns + 1);
+  }
+  pcpu->refills++;
+
+  pthread_mutex_unlock(&pcpu->refill_mutex);
+}  /* pcpu_refill */
+
+
+/* API to create a per-CPU limiter: refill_token_amount tokens per
+ * refill_interval_ns across all threads on the host. Until the first
+ * refill interval ends, the budget is split evenly between the CPUs. */
+rtlim_pcpu_t *rtlim_pcpu_create(unsigned long long refill_interval_ns,
+  int refill_token_amount)
+{
+  rtlim_pcpu_t *pcpu;
+
+  pcpu = (rtlim_pcpu_t *)malloc(sizeof(rtlim_pcpu_t));
+  NULLCHK(pcpu);
+  memset(pcpu, 0, sizeof(*pcpu));
+  pcpu->refill_interval_ns = refill_interval_ns;
+  pcpu->refill_token_amount = refill_token_amount;
+
+#if defined(PCPU_RSEQ)
+  /* glibc registers rseq for every thread, unless it can't (e.g. an old
+   * kernel, or the glibc.pthread.rseq tunable is 0). */
+  pcpu->use_rseq = (__rseq_size > 0 && rseq_cpu() >= 0);
+#endif
+
+  pcpu->num_cpus = possible_cpus();
+  pcpu->num_shards = pcpu->num_cpus + (pcpu->use_rseq ? 1 : 0);
+  if (posix_memalign((void **)&pcpu->shards, 64,
+    pcpu->num_shards * sizeof(rtlim_pcpu_shard_t)) != 0)
+  {
+    pcpu->shards = NULL;
+  }
+  NULLCHK(pcpu->shards);
+  memset(pcpu->shards, 0, pcpu->num_shards * sizeof(rtlim_pcpu_shard_t));
+  pcpu->demand = (unsigned long long *)malloc(pcpu->num_shards * sizeof(unsigned long long));
+  NULLCHK(pcpu->demand);
+
+  pthread_mutex_init(&pcpu->refill_mutex, NULL);
+  pcpu->clock = rtlim_create(refill_interval_ns, refill_token_amount);
+  pcpu->next_refill_ns = rtlim_now(pcpu->clock);  /* Schedule starts now. */
+  pcpu_refill(pcpu, pcpu->next_refill_ns);
+
+  return pcpu;
+}  /* rtlim_pcpu_create */
+
+
+/* API to delete a per-CPU limiter. No thread may be using it. */
+void rtlim_pcpu_delete(rtlim_pcpu_t *pcpu)
+{
+  rtlim_delete(pcpu->clock);
+  pthread_mutex_destroy(&pcpu->refill_mutex);
+  free(pcpu->demand);
+  free(pcpu->shards);
+  free(pcpu);
+}  /* rtlim_pcpu_delete */
+
+
+/* API to select the clock, as rtlim_set_clock(). Call before any takes.
+ * The current refill interval restarts at the new clock's current time.
+ * Returns 0 for success, -1 for an invalid or unsupported clock. */
+int rtlim_pcpu_set_clock(rtlim_pcpu_t *pcpu, int clock_type,
+  rtlim_clock_cb_t clock_cb, void *clock_clientd)
+{
+  if (rtlim_set_clock(pcpu->clock, clock_type, clock_cb, clock_clientd) != 0) {
+    return -1;
+  }
+  pcpu->next_refill_ns = rtlim_now(pcpu->clock) + pcpu->refill_interval_ns;
+
+  return 0;
+}  /* rtlim_pcpu_set_clock */
+
+
+/* API to request tokens, from any thread. Same parameters and returns as
+ * rtlim_take(). A blocking take of more than the calling CPU's share
+ * takes what there is and waits for the next refill for the rest. */
+int rtlim_pcpu_take(rtlim_pcpu_t *pcpu, int take_token_amount, int block)
+{
+  unsigned long long now_ns;
+
+  if ((block == RTLIM_NON_BLOCK) && take_token_amount > pcpu->refill_token_amount) {
+    return -2;
+  }
+
+  now_ns = rtlim_now(pcpu->clock);
+  if (now_ns >= pcpu->next_refill_ns) {
+    pcpu_refill(pcpu, now_ns);
+  }
+
+  if (block == RTLIM_NON_BLOCK) {
+    return (shard_take(pcpu, take_token_amount, 0) == take_token_amount) ? 0 : -1;
+  }
+
+  for (;;) {
+    rtlim_t waiter;
+
+    take_token_amount -= shard_take(pcpu, take_token_amount, 1);
+    if (take_token_amount == 0) {
+      return 0;
+    }
+    /* rtlim_wait_until() keeps its last clock reading in the object, so
+     * each thread waits on its own copy (sharing the clock). */
+    waiter = *pcpu->clock;
+    rtlim_wait_until(&waiter, pcpu->next_refill_ns, block);
+    pcpu_refill(pcpu, rtlim_now(pcpu->clock));
+  }
+}  /* rtlim_pcpu_take */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define RANGECHK(val_,lo_,hi_) do { \
+  double inval_ = (double)(val_); \
+  if (inval_ < (double)(lo_) || inval_ > (double)(hi_)) { \
+    fprintf(stderr, "Range check failed at %s:%d, %s=%f\n", \
+      __FILE__, __LINE__, #val_, inval_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+
+/* Non-blocking takes until one fails. */
+int take_all(rtlim_pcpu_t *pcpu, int amount)
+{
+  int taken = 0;
+
+  while (rtlim_pcpu_take(pcpu, amount, RTLIM_NON_BLOCK) == 0) {
+    taken += amount;
+  }
+
+  return taken;
+}  /* take_all */
+
+
+/* One thread, on one CPU, on a virtual clock. */
+void test_single()
+{
+  rtlim_pcpu_t *pcpu;
+  rtlim_vclock_t vclock;
+  unsigned long long t0;
+  int share;
+
+  pcpu = rtlim_pcpu_create(1000000, 1000);  /* 1000 per ms. */
+  vclock.now_ns = 1000000000;
+  EQUALCHK(rtlim_pcpu_set_clock(pcpu, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  EQUALCHK(rtlim_pcpu_take(pcpu, 1001, RTLIM_NON_BLOCK), -2);
+
+  /* First interval: an even split. */
+  share = 1000 / pcpu->num_shards;
+  RANGECHK(take_all(pcpu, 1), share, share + 1);
+
+  /* Still the same interval: nothing more. */
+  vclock.now_ns += 999999;
+  EQUALCHK(take_all(pcpu, 1), 0);
+
+  /* Only this CPU had demand, so it gets the whole budget. */
+  vclock.now_ns += 1;
+  EQUALCHK(take_all(pcpu, 1), 1000);
+  EQUALCHK(pcpu->refills, 2);
+
+  /* Idle for a while: still all here (demand was refused takes). */
+  vclock.now_ns += 5000000;
+  EQUALCHK(take_all(pcpu, 10), 1000);
+
+  /* Unused tokens don't carry over. */
+  vclock.now_ns += 1000000;
+  EQUALCHK(rtlim_pcpu_take(pcpu, 600, RTLIM_NON_BLOCK), 0);
+  vclock.now_ns += 1000000;
+  EQUALCHK(take_all(pcpu, 1), 1000);
+
+  /* Blocking for 2500: the rest of this interval (900), then two more
+   * refills (1000 + 600). */
+  vclock.now_ns += 1000000;
+  EQUALCHK(rtlim_pcpu_take(pcpu, 100, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_pcpu_take(pcpu, 2500, RTLIM_BLOCK_SPIN), 0);
+  EQUALCHK(vclock.now_ns, 1000000000ull + 11000000);
+  EQUALCHK(take_all(pcpu, 1), 400);
+
+  /* Late refills stay in phase, skipping intervals missed entirely. */
+  t0 = pcpu->next_refill_ns;
+  vclock.now_ns = t0 + 400000;
+  EQUALCHK(take_all(pcpu, 1), 1000);
+  EQUALCHK(pcpu->next_refill_ns, t0 + 1000000);
+  vclock.now_ns = t0 + 3500000;
+  EQUALCHK(take_all(pcpu, 1), 1000);
+  EQUALCHK(pcpu->next_refill_ns, t0 + 4000000);
+
+  rtlim_pcpu_delete(pcpu);
+}  /* test_single */
+
+
+typedef struct test_worker_s {
+  rtlim_pcpu_t *pcpu;
+  pthread_t thread_id;
+  int block;
+  unsigned long long stop_ns;
+  unsigned long long taken;
+} test_worker_t;
+
+void *test_worker_thread(void *arg)
+{
+  test_worker_t *worker = (test_worker_t *)arg;
+
+  while (current_time_ns() < worker->stop_ns) {
+    if (rtlim_pcpu_take(worker->pcpu, 1, worker->block) == 0) {
+      worker->taken++;
+    }
+  }
+
+  return NULL;
+}  /* test_worker_thread */
+
+
+/* Several threads, free to migrate, in real time: the total never exceeds
+ * the host-wide rate (plus one budget for the refill boundary). */
+void test_threads(int block)
+{
+  rtlim_pcpu_t *pcpu;
+  test_worker_t workers[4];
+  unsigned long long start_ns, end_ns, total = 0;
+  int t;
+
+  pcpu = rtlim_pcpu_create(1000000, 100);  /* 100 per ms. */
+  start_ns = current_time_ns();
+  for (t = 0; t < 4; t++) {
+    workers[t].pcpu = pcpu;
+    workers[t].block = block;
+    workers[t].stop_ns = start_ns + 50000000;  /* 50 ms. */
+    workers[t].taken = 0;
+    EQUALCHK(pthread_create(&workers[t].thread_id, NULL, test_worker_thread, &workers[t]), 0);
+  }
+  for (t = 0; t < 4; t++) {
+    pthread_join(workers[t].thread_id, NULL);
+    total += workers[t].taken;
+  }
+  end_ns = current_time_ns();
+
+  RANGECHK(total, 100, 100 * ((end_ns - start_ns) / 1000000 + 2));
+
+  rtlim_pcpu_delete(pcpu);
+}  /* test_threads */
+
+
+void *test_drain_thread(void *arg)
+{
+  test_worker_t *worker = (test_worker_t *)arg;
+
+  worker->taken = take_all(worker->pcpu, 1);
+
+  return NULL;
+}  /* test_drain_thread */
+
+
+/* Threads racing (and being preempted and migrated) to drain one
+ * interval's budget get exactly all of it: no update is lost. */
+void test_exact()
+{
+  rtlim_pcpu_t *pcpu;
+  test_worker_t workers[4];
+  unsigned long long total = 0, granted = 0;
+  int t;
+
+  pcpu = rtlim_pcpu_create(1000000000000ull, 2000000);  /* Never refills. */
+  for (t = 0; t < pcpu->num_shards; t++) {
+    granted += COUNT(pcpu->shards[t].grant);
+  }
+  EQUALCHK(granted, 2000000);
+  for (t = 0; t < 4; t++) {
+    workers[t].pcpu = pcpu;
+    EQUALCHK(pthread_create(&workers[t].thread_id, NULL, test_drain_thread, &workers[t]), 0);
+  }
+  for (t = 0; t < 4; t++) {
+    pthread_join(workers[t].thread_id, NULL);
+    total += workers[t].taken;
+  }
+  /* Threads that finished early can leave other CPUs' shares behind. */
+  RANGECHK(total, 1, 2000000);
+  for (t = 0; t < pcpu->num_shards; t++) {
+    total += COUNT(pcpu->shards[t].grant) - COUNT(pcpu->shards[t].use);
+  }
+  EQUALCHK(total, 2000000);
+
+  rtlim_pcpu_delete(pcpu);
+}  /* test_exact */
+
+
+int main(int argc, char **argv)
+{
+  cpu_set_t cpu_set;
+  int c;
+
+  /* Keep the single-thread test on one shard. */
+  CPU_ZERO(&cpu_set);
+  CPU_SET(sched_getcpu(), &cpu_set);
+  EQUALCHK(sched_setaffinity(0, sizeof(cpu_set), &cpu_set), 0);
+  test_single();
+  CPU_ZERO(&cpu_set);
+  for (c = 0; c < CPU_SETSIZE; c++) CPU_SET(c, &cpu_set);
+  (void)sched_setaffinity(0, sizeof(cpu_set), &cpu_set);
+
+  test_exact();
+  test_threads(RTLIM_NON_BLOCK);
+  test_threads(RTLIM_BLOCK_SPIN);
+  test_threads(RTLIM_BLOCK_SLEEP);
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
@@ -0,0 +1,78 @@
+/* rtlim_pcpu.h - Per-CPU sharded rate limiter (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_PCPU_H
+#define RTLIM_PCPU_H
+
+#include <pthread.h>
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* One CPU's share of the budget, alone on a cache line. "grant" is
+ * written by whichever thread refills; "use" and "denied" only by threads
+ * running on this CPU (or, for the extra shard, threads without one).
+ * The epoch (refill count) in the upper 32 bits of "grant" and "use"
+ * makes tokens left from earlier refills worthless. */
+typedef struct rtlim_pcpu_shard_s {
+  volatile unsigned long long grant;   /* epoch << 32 | tokens granted. */
+  volatile unsigned long long use;     /* epoch << 32 | tokens taken. */
+  volatile unsigned long long denied;  /* Total tokens refused. */
+  unsigned long long prev_denied;      /* "denied" at the last refill. */
+  char pad[64 - 4 * sizeof(unsigned long long)];
+} __attribute__((aligned(64))) rtlim_pcpu_shard_t;
+
+/* Structure for "rtlim_pcpu" object. App should treat it as opaque.
+ * The host-wide budget, refill_token_amount per refill_interval_ns, is
+ * split between per-CPU shards, in proportion to each shard's demand
+ * (tokens taken plus tokens refused) over the previous interval. */
+typedef struct rtlim_pcpu_s {
+  unsigned long long refill_interval_ns;
+  int refill_token_amount;
+  int num_cpus;                        /* Highest possible CPU id + 1. */
+  int num_shards;                      /* num_cpus, + 1 with rseq. */
+  rtlim_pcpu_shard_t *shards;
+  int use_rseq;                        /* Else compare-and-swap. */
+  rtlim_t *clock;                      /* Just for its clock and waits. */
+  volatile unsigned long long next_refill_ns;
+  unsigned int epoch;
+  pthread_mutex_t refill_mutex;
+  unsigned long long *demand;          /* Refill scratch, per shard. */
+  unsigned long long refills;
+} rtlim_pcpu_t;
+
+
+rtlim_pcpu_t *rtlim_pcpu_create(unsigned long long refill_interval_ns,
+  int refill_token_amount);
+void rtlim_pcpu_delete(rtlim_pcpu_t *pcpu);
+int rtlim_pcpu_set_clock(rtlim_pcpu_t *pcpu, int clock_type,
+  rtlim_clock_cb_t clock_cb, void *clock_clientd);
+int rtlim_pcpu_take(rtlim_pcpu_t *pcpu, int take_token_amount, int block);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_PCPU_H */
@@ -0,0 +1,399 @@
+/* rtlim_rate.c - Exact fractional-rate limiter.
+ * See https://github.com/UltraMessaging/rtlim for documentation.
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* A limiter configured by a rate (tokens per second, or an exact ratio)
+ * and a burst size, instead of an interval and an amount. With integer
+ * interval and amount, many rates can only be approximated at short
+ * intervals: e.g. 33,333 per second in 1 us steps. Here credit is earned
+ * continuously in fixed-point units (1/per_ns of a token), so the rate is
+ * exact over any run, and a burst can be as small as one token.
+ *
+ * The take is a multiply, a compare and a subtract; division is only
+ * needed to work out how long a blocking take must wait.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
+#include "rtlim.h"
+#include "rtlim_rate.h"
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+/* Keeps credit + elapsed * tokens within 64 bits. */
+#define RATE_MAX (1ull << 60)
+/* Largest denominator tried when converting a double rate. */
+#define RATE_MAX_DEN 1000000
+
+
+static unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+  while (b != 0) {
+    unsigned long long t = a % b;
+    a = b;
+    b = t;
+  }
+  return a;
+}  /* gcd */
+
+
+/* API to create a rate limiter of exactly "tokens" per "per_ns"
+ * nanoseconds, holding at most "burst_tokens". It starts full.
+ * Returns NULL for a zero rate or burst, or one too large to represent
+ * (burst_tokens * per_ns, reduced, must be under 2^60). */
+rtlim_rate_t *rtlim_rate_create_ratio(unsigned long long tokens,
+  unsigned long long per_ns, int burst_tokens)
+{
+  rtlim_rate_t *rate;
+  unsigned long long div;
+
+  if (tokens == 0 || per_ns == 0 || burst_tokens < 1) {
+    return NULL;
+  }
+  div = gcd(tokens, per_ns);
+  tokens /= div;
+  per_ns /= div;
+  if (tokens >= RATE_MAX || per_ns >= RATE_MAX / burst_tokens) {
+    return NULL;
+  }
+
+  rate = (rtlim_rate_t *)malloc(sizeof(rtlim_rate_t));
+  NULLCHK(rate);
+  memset(rate, 0, sizeof(*rate));
+
+  rate->tokens = tokens;
+  rate->per_ns = per_ns;
+  rate->burst_tokens = burst_tokens;
+  rate->max_credit = burst_tokens * per_ns;
+  rate->fill_ns = (rate->max_credit + tokens - 1) / tokens;
+  rate->credit = rate->max_credit;  /* Fill rate limiter. */
+  rate->clock = rtlim_create(1, 1);
+  rate->credit_ns = rtlim_now(rate->clock);
+
+  return rate;
+}  /* rtlim_rate_create_ratio */
+
+
+/* API to create a rate limiter of "tokens_per_sec" (need not be whole),
+ * holding at most "burst_tokens". The rate is taken as the nearest ratio
+ * with a denominator up to a million (so 33333.33 is 3333333/100 per
+ * second, and 1e5/3 is exactly a token per 30 us).
+ * Returns NULL as for rtlim_rate_create_ratio(), or for a rate that
+ * isn't positive. */
+rtlim_rate_t *rtlim_rate_create(double tokens_per_sec, int burst_tokens)
+{
+  /* Continued fraction convergents h/k of tokens_per_sec. */
+  unsigned long long h0 = 0, h1 = 1, k0 = 1, k1 = 0;
+  double x = tokens_per_sec;
+  int i;
+
+  if (! (tokens_per_sec > 0.0 && tokens_per_sec < (double)RATE_MAX)) {
+    return NULL;  /* Also NaN. */
+  }
+
+  for (i = 0; i < 64; i++) {
+    unsigned long long a = (unsigned long long)x;
+    unsigned long long h2 = a * h1 + h0;
+    unsigned long long k2 = a * k1 + k0;
+    double err;
+
+    if (k2 > RATE_MAX_DEN || h2 >= RATE_MAX) {
+      break;
+    }
+    h0 = h1; h1 = h2;
+    k0 = k1; k1 = k2;
+    err = (double)h1 / k1 - tokens_per_sec;
+    if (err < 0) err = -err;
+    if (err <= tokens_per_sec * 1e-15 || x == (double)a) {
+      break;
+    }
+    x = 1.0 / (x - a);
+  }
+
+  if (h1 == 0 || k1 == 0) {
+    return NULL;  /* Under one per RATE_MAX_DEN seconds. */
+  }
+  return rtlim_rate_create_ratio(h1, k1 * 1000000000ull, burst_tokens);
+}  /* rtlim_rate_create */
+
+
+/* API to delete a rate limiter. */
+void rtlim_rate_delete(rtlim_rate_t *rate)
+{
+  rtlim_delete(rate->clock);
+  free(rate);
+}  /* rtlim_rate_delete */
+
+
+/* API to select the clock, as rtlim_set_clock(). Credit is kept, and
+ * starts earning at the new clock's current time.
+ * Returns 0 for success, -1 for an invalid or unsupported clock. */
+int rtlim_rate_set_clock(rtlim_rate_t *rate, int clock_type,
+  rtlim_clock_cb_t clock_cb, void *clock_clientd)
+{
+  if (rtlim_set_clock(rate->clock, clock_type, clock_cb, clock_clientd) != 0) {
+    return -1;
+  }
+  rate->credit_ns = rtlim_now(rate->clock);
+
+  return 0;
+}  /* rtlim_rate_set_clock */
+
+
+/* Add the credit earned up to "now_ns", up to "limit" (at most twice
+ * max_credit). */
+static void rate_earn(rtlim_rate_t *rate, unsigned long long now_ns,
+  unsigned long long limit)
+{
+  unsigned long long elapsed_ns;
+
+  if (now_ns <= rate->credit_ns) {
+    return;
+  }
+  elapsed_ns = now_ns - rate->credit_ns;
+  rate->credit_ns = now_ns;
+  if (elapsed_ns >= 2 * rate->fill_ns) {
+    rate->credit = limit;
+  }
+  else {
+    rate->credit += elapsed_ns * rate->tokens;
+    if (rate->credit > limit) {
+      rate->credit = limit;
+    }
+  }
+}  /* rate_earn */
+
+
+/* API to request tokens. Same parameters and returns as rtlim_take(),
+ * with burst_tokens in place of refill_token_amount. A blocking take
+ * of more than burst_tokens takes them a burst at a time. */
+int rtlim_rate_take(rtlim_rate_t *rate, int take_token_amount, int block)
+{
+  unsigned long long cost;
+
+  if ((block == RTLIM_NON_BLOCK) && take_token_amount > rate->burst_tokens) {
+    return -2;
+  }
+
+  while (take_token_amount > 0) {
+    int chunk = (take_token_amount < rate->burst_tokens) ? take_token_amount : rate->burst_tokens;
+
+    cost = (unsigned long long)chunk * rate->per_ns;
+    rate_earn(rate, rtlim_now(rate->clock), rate->max_credit);
+    if (rate->credit < cost) {
+      unsigned long long wait_ns;
+
+      if (block == RTLIM_NON_BLOCK) {
+        return -1;
+      }
+      /* Earliest time that the credit covers the cost. The clock's
+       * resolution makes that up to a nanosecond late; what's earned
+       * meanwhile is kept, even past the burst, so it isn't lost. */
+      wait_ns = (cost - rate->credit + rate->tokens - 1) / rate->tokens;
+      rtlim_wait_until(rate->clock, rate->credit_ns + wait_ns, block);
+      rate_earn(rate, rate->clock->cur_ns, rate->max_credit + cost);
+    }
+    rate->credit -= cost;
+    take_token_amount -= chunk;
+  }
+
+  return 0;
+}  /* rtlim_rate_take */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+
+void test_create()
+{
+  rtlim_rate_t *rate;
+
+  EQUALCHK(rtlim_rate_create(0.0, 1), NULL);
+  EQUALCHK(rtlim_rate_create(-5.0, 1), NULL);
+  EQUALCHK(rtlim_rate_create(1000.0, 0), NULL);
+  EQUALCHK(rtlim_rate_create_ratio(0, 1000, 1), NULL);
+  EQUALCHK(rtlim_rate_create_ratio(1, 0, 1), NULL);
+  EQUALCHK(rtlim_rate_create_ratio(1, RATE_MAX, 1), NULL);
+
+  rate = rtlim_rate_create(33333.0, 1);
+  EQUALCHK(rate->tokens, 33333);
+  EQUALCHK(rate->per_ns, 1000000000);
+  rtlim_rate_delete(rate);
+
+  rate = rtlim_rate_create(100000.0 / 3.0, 1);  /* One per 30 us. */
+  EQUALCHK(rate->tokens, 1);
+  EQUALCHK(rate->per_ns, 30000);
+  rtlim_rate_delete(rate);
+
+  rate = rtlim_rate_create(0.5, 1);
+  EQUALCHK(rate->tokens, 1);
+  EQUALCHK(rate->per_ns, 2000000000);
+  rtlim_rate_delete(rate);
+
+  rate = rtlim_rate_create(33333.33, 10);
+  EQUALCHK(rate->tokens, 3333333);
+  EQUALCHK(rate->per_ns, 100000000000ull);
+  EQUALCHK(rate->max_credit, 1000000000000ull);
+  rtlim_rate_delete(rate);
+
+  rate = rtlim_rate_create_ratio(4000, 2000000, 3);  /* Reduced. */
+  EQUALCHK(rate->tokens, 1);
+  EQUALCHK(rate->per_ns, 500);
+  EQUALCHK(rate->fill_ns, 1500);
+  rtlim_rate_delete(rate);
+}  /* test_create */
+
+
+void test_nonblock()
+{
+  rtlim_vclock_t vclock;
+  rtlim_rate_t *rate;
+  unsigned long long t0;
+
+  vclock.now_ns = t0 = 1000000000;
+  rate = rtlim_rate_create_ratio(1, 1000, 5);  /* 1 per us. */
+  EQUALCHK(rtlim_rate_set_clock(rate, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+  EQUALCHK(rtlim_rate_set_clock(rate, RTLIM_CLOCK_VIRTUAL, NULL, NULL), -1);
+
+  EQUALCHK(rtlim_rate_take(rate, 6, RTLIM_NON_BLOCK), -2);
+  EQUALCHK(rtlim_rate_take(rate, 5, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), -1);
+  vclock.now_ns += 999;
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), -1);
+  vclock.now_ns += 1;
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rate->credit, 0);
+
+  /* Partial credit carries over. */
+  vclock.now_ns += 1500;
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rate->credit, 500);
+  vclock.now_ns += 500;
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), -1);
+
+  /* Credit stops at the burst. */
+  vclock.now_ns += 1000000000;
+  EQUALCHK(rtlim_rate_take(rate, 5, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_NON_BLOCK), -1);
+  vclock.now_ns += 4000;
+  EQUALCHK(rate->credit, 0);
+  EQUALCHK(rtlim_rate_take(rate, 4, RTLIM_NON_BLOCK), 0);
+
+  EQUALCHK(vclock.now_ns, t0 + 1000000000 + 7000);  /* Never waited. */
+  rtlim_rate_delete(rate);
+}  /* test_nonblock */
+
+
+/* Back-to-back blocking takes of one token at 33,333 per second with a
+ * burst of one: take k (after the first) must be granted at exactly the
+ * first nanosecond by which k tokens have been earned. */
+void test_exact(int block)
+{
+  rtlim_vclock_t vclock;
+  rtlim_rate_t *rate;
+  unsigned long long t0, k;
+
+  vclock.now_ns = t0 = 5000000000;
+  rate = rtlim_rate_create(33333.0, 1);
+  EQUALCHK(rtlim_rate_set_clock(rate, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+
+  EQUALCHK(rtlim_rate_take(rate, 1, block), 0);
+  EQUALCHK(vclock.now_ns, t0);
+  for (k = 1; k <= 333330; k++) {
+    EQUALCHK(rtlim_rate_take(rate, 1, block), 0);
+    EQUALCHK(vclock.now_ns, t0 + (k * 1000000000 + 33332) / 33333);
+  }
+  EQUALCHK(vclock.now_ns, t0 + 10000000000ull);  /* No drift. */
+
+  rtlim_rate_delete(rate);
+}  /* test_exact */
+
+
+/* A blocking take bigger than the burst goes a burst at a time, and
+ * takes exactly as long as the tokens it's short. */
+void test_big()
+{
+  rtlim_vclock_t vclock;
+  rtlim_rate_t *rate;
+  unsigned long long t0;
+
+  vclock.now_ns = t0 = 1000000;
+  rate = rtlim_rate_create_ratio(1, 1000, 2);
+  EQUALCHK(rtlim_rate_set_clock(rate, RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+
+  EQUALCHK(rtlim_rate_take(rate, 7, RTLIM_BLOCK_SPIN), 0);
+  EQUALCHK(vclock.now_ns, t0 + 5000);
+  EQUALCHK(rtlim_rate_take(rate, 1, RTLIM_BLOCK_SLEEP), 0);
+  EQUALCHK(vclock.now_ns, t0 + 6000);
+
+  rtlim_rate_delete(rate);
+}  /* test_big */
+
+
+int main(int argc, char **argv)
+{
+  rtlim_rate_t *rate;
+  unsigned long long start_ns;
+
+  test_create();
+  test_nonblock();
+  test_exact(RTLIM_BLOCK_SPIN);
+  test_exact(RTLIM_BLOCK_SLEEP);
+  test_big();
+
+  /* Real clock: 2,000 tokens at 100,000 per second, burst 1. */
+  rate = rtlim_rate_create(100000.0, 1);
+  start_ns = current_time_ns();
+  (void)rtlim_rate_take(rate, 2001, RTLIM_BLOCK_SPIN);
+  EQUALCHK(current_time_ns() - start_ns >= 20000000, 1);
+  rtlim_rate_delete(rate);
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
@@ -0,0 +1,62 @@
+/* rtlim_rate.h - Exact fractional-rate limiter (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_RATE_H
+#define RTLIM_RATE_H
+
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Structure for "rtlim_rate" object. App should treat it as opaque.
+ * The rate is "tokens" tokens per "per_ns" nanoseconds (in lowest terms).
+ * Credit is counted in units of 1/per_ns of a token, so each nanosecond
+ * earns exactly "tokens" units and a token costs "per_ns" units: no
+ * rounding, so no error accumulates. */
+typedef struct rtlim_rate_s {
+  unsigned long long tokens;           /* Set by rtlim_rate_create() */
+  unsigned long long per_ns;           /* Set by rtlim_rate_create() */
+  int burst_tokens;                    /* Set by rtlim_rate_create() */
+  unsigned long long max_credit;       /* burst_tokens * per_ns */
+  unsigned long long fill_ns;          /* Time to fill from empty. */
+  unsigned long long credit;
+  unsigned long long credit_ns;        /* When credit was last earned. */
+  rtlim_t *clock;                      /* Just for its clock and waits. */
+} rtlim_rate_t;
+
+
+rtlim_rate_t *rtlim_rate_create(double tokens_per_sec, int burst_tokens);
+rtlim_rate_t *rtlim_rate_create_ratio(unsigned long long tokens,
+  unsigned long long per_ns, int burst_tokens);
+void rtlim_rate_delete(rtlim_rate_t *rate);
+int rtlim_rate_set_clock(rtlim_rate_t *rate, int clock_type,
+  rtlim_clock_cb_t clock_cb, void *clock_clientd);
+int rtlim_rate_take(rtlim_rate_t *rate, int take_token_amount, int block);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_RATE_H */
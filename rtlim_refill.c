@@ -0,0 +1,641 @@
+/* rtlim_refill.c - Background refill of rtlim objects.
+ * See https://github.com/UltraMessaging/rtlim for documentation.
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Normally rtlim_take() refills the tokens itself, which costs it a clock
+ * read and a check on every call. A refiller instead refills its limiters
+ * on schedule, from its own thread (or from the app's timer, calling
+ * rtlim_refiller_run()), and their takes become a compare-and-swap on the
+ * token count, with no clock read (see background_take() in "rtlim.c").
+ *
+ * Limiters are kept in a min-heap on next refill time, so a refill costs
+ * O(log n) and one thread can serve thousands of limiters. Refills are
+ * phase-correct: each happens at last_refill_ns + refill_interval_ns on
+ * the original schedule, however late the refiller gets to it; a refill
+ * that is more than an interval late resets the tokens once (as rtlim's
+ * own refill does) and skips to the schedule's latest point.
+ *
+ * The refiller owns its limiters' schedules, so rtlim.c refuses calls
+ * that would move one (rtlim_set_clock(), rtlim_schedule()) behind its
+ * back and out of heap order, or run it in debt (rtlim_duty_begin()),
+ * which a refill would reset away. A shadow limiter, which is not
+ * thread-safe, can't be attached to one either.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rtlim.h"
+#include "rtlim_refill.h"
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+#define DUE_NS(rtlim_) ((rtlim_)->last_refill_ns + (rtlim_)->refill_interval_ns)
+
+
+static void heap_set(rtlim_refiller_t *refiller, int i, rtlim_t *rtlim)
+{
+  refiller->heap[i] = rtlim;
+  rtlim->refiller_index = i;
+}  /* heap_set */
+
+
+static void heap_sift_up(rtlim_refiller_t *refiller, int i)
+{
+  rtlim_t *rtlim = refiller->heap[i];
+
+  while (i > 0) {
+    int parent = (i - 1) / 2;
+    if (DUE_NS(refiller->heap[parent]) <= DUE_NS(rtlim)) {
+      break;
+    }
+    heap_set(refiller, i, refiller->heap[parent]);
+    i = parent;
+  }
+  heap_set(refiller, i, rtlim);
+}  /* heap_sift_up */
+
+
+static void heap_sift_down(rtlim_refiller_t *refiller, int i)
+{
+  rtlim_t *rtlim = refiller->heap[i];
+
+  for (;;) {
+    int child = 2 * i + 1;
+    if (child >= refiller->num_limiters) {
+      break;
+    }
+    if (child + 1 < refiller->num_limiters &&
+      DUE_NS(refiller->heap[child + 1]) < DUE_NS(refiller->heap[child]))
+    {
+      child++;
+    }
+    if (DUE_NS(rtlim) <= DUE_NS(refiller->heap[child])) {
+      break;
+    }
+    heap_set(refiller, i, refiller->heap[child]);
+    i = child;
+  }
+  heap_set(refiller, i, rtlim);
+}  /* heap_sift_down */
+
+
+/* Lock the mutex from an API call, making a spinning thread yield it. */
+static void refiller_lock(rtlim_refiller_t *refiller)
+{
+  __sync_fetch_and_add(&refiller->lockers, 1);
+  pthread_mutex_lock(&refiller->mutex);
+  __sync_fetch_and_sub(&refiller->lockers, 1);
+}  /* refiller_lock */
+
+
+/* Do the refills due by "now_ns". Mutex must be held.
+ * Returns the next refill time, or 0 if there are no limiters. */
+static unsigned long long run_locked(rtlim_refiller_t *refiller,
+  unsigned long long now_ns)
+{
+  while (refiller->num_limiters > 0 && DUE_NS(refiller->heap[0]) <= now_ns) {
+    rtlim_t *rtlim = refiller->heap[0];
+    unsigned long long due_ns = DUE_NS(rtlim);
+    unsigned long long missed = (now_ns - due_ns) / rtlim->refill_interval_ns;
+
+    if (now_ns - due_ns > refiller->max_late_ns) {
+      refiller->max_late_ns = now_ns - due_ns;
+    }
+    *(volatile int *)&rtlim->current_tokens = (int)rtlim->refill_token_amount;
+    *(volatile unsigned long long *)&rtlim->last_refill_ns =
+      due_ns + missed * rtlim->refill_interval_ns;
+    refiller->refills++;
+    heap_sift_down(refiller, 0);
+  }
+
+  return (refiller->num_limiters > 0) ? DUE_NS(refiller->heap[0]) : 0;
+}  /* run_locked */
+
+
+static void *refiller_thread(void *arg)
+{
+  rtlim_refiller_t *refiller = (rtlim_refiller_t *)arg;
+
+  pthread_mutex_lock(&refiller->mutex);
+  while (! refiller->stop) {
+    unsigned long long now_ns = current_time_ns();
+    unsigned long long next_ns = run_locked(refiller, now_ns);
+
+    if (refiller->block == RTLIM_BLOCK_SLEEP) {
+      struct timespec ts;
+      if (next_ns == 0) {
+        next_ns = now_ns + 1000000000;  /* Nothing to do; check back. */
+      }
+      ts.tv_sec = next_ns / 1000000000;
+      ts.tv_nsec = next_ns % 1000000000;
+      (void)pthread_cond_timedwait(&refiller->cond, &refiller->mutex, &ts);
+    }
+    else {
+      /* Let rtlim_refiller_add() and _remove() in. A mutex doesn't hand
+       * over to a waiter, so without the yield this loop could take it
+       * straight back, forever. */
+      pthread_mutex_unlock(&refiller->mutex);
+      while (refiller->lockers > 0) {
+        sched_yield();
+      }
+      pthread_mutex_lock(&refiller->mutex);
+    }
+  }
+  pthread_mutex_unlock(&refiller->mutex);
+
+  return NULL;
+}  /* refiller_thread */
+
+
+/* API to create a refiller. "block" is how its thread waits between
+ * refills: RTLIM_BLOCK_SPIN (dedicates a core) or RTLIM_BLOCK_SLEEP; or
+ * RTLIM_NON_BLOCK for no thread, in which case the app must call
+ * rtlim_refiller_run() on schedule. The thread is pinned to "cpu"
+ * (-1 = not pinned).
+ * Returns NULL for an invalid "block", or if the thread can't be started. */
+rtlim_refiller_t *rtlim_refiller_create(int block, int cpu)
+{
+  rtlim_refiller_t *refiller;
+  pthread_condattr_t cond_attr;
+
+  if (block != RTLIM_BLOCK_SPIN && block != RTLIM_BLOCK_SLEEP && block != RTLIM_NON_BLOCK) {
+    return NULL;
+  }
+
+  refiller = (rtlim_refiller_t *)malloc(sizeof(rtlim_refiller_t));
+  NULLCHK(refiller);
+  memset(refiller, 0, sizeof(*refiller));
+  refiller->block = block;
+  refiller->cpu = cpu;
+  refiller->heap_size = 64;
+  refiller->heap = (rtlim_t **)malloc(refiller->heap_size * sizeof(rtlim_t *));
+  NULLCHK(refiller->heap);
+
+  pthread_mutex_init(&refiller->mutex, NULL);
+  pthread_condattr_init(&cond_attr);
+  pthread_condattr_setclock(&cond_attr, CLOCK_MONOTONIC);  /* current_time_ns() */
+  pthread_cond_init(&refiller->cond, &cond_attr);
+  pthread_condattr_destroy(&cond_attr);
+
+  if (block != RTLIM_NON_BLOCK) {
+    pthread_attr_t attr;
+    int status = 0;
+
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+      cpu_set_t cpu_set;
+      CPU_ZERO(&cpu_set);
+      CPU_SET(cpu, &cpu_set);
+      status = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+    }
+    if (status == 0) {
+      status = pthread_create(&refiller->thread_id, &attr, refiller_thread, refiller);
+    }
+    pthread_attr_destroy(&attr);
+    if (status != 0) {
+      pthread_cond_destroy(&refiller->cond);
+      pthread_mutex_destroy(&refiller->mutex);
+      free(refiller->heap);
+      free(refiller);
+      return NULL;
+    }
+  }
+
+  return refiller;
+}  /* rtlim_refiller_create */
+
+
+/* API to stop a refiller's thread and delete it. Its limiters are
+ * removed first, and go back to refilling in rtlim_take(). */
+void rtlim_refiller_delete(rtlim_refiller_t *refiller)
+{
+  if (refiller->block != RTLIM_NON_BLOCK) {
+    refiller_lock(refiller);
+    refiller->stop = 1;
+    pthread_cond_signal(&refiller->cond);
+    pthread_mutex_unlock(&refiller->mutex);
+    pthread_join(refiller->thread_id, NULL);
+  }
+  while (refiller->num_limiters > 0) {
+    rtlim_refiller_remove(refiller, refiller->heap[0]);
+  }
+
+  pthread_cond_destroy(&refiller->cond);
+  pthread_mutex_destroy(&refiller->mutex);
+  free(refiller->heap);
+  free(refiller);
+}  /* rtlim_refiller_delete */
+
+
+/* API to have "refiller" refill "rtlim" from now on. Its schedule
+ * continues from its last refill, on its clock, which must be the
+ * refiller's (CLOCK_MONOTONIC, the default, for a refiller thread).
+ * Returns:
+ *    0 for success,
+ *   -1 if "rtlim" already has a refiller or a shadow, or its refill
+ *      interval is 0.
+ */
+int rtlim_refiller_add(rtlim_refiller_t *refiller, rtlim_t *rtlim)
+{
+  if (rtlim->refiller != NULL || rtlim->shadow != NULL ||
+    rtlim->refill_interval_ns == 0)
+  {
+    return -1;
+  }
+
+  refiller_lock(refiller);
+  if (refiller->num_limiters == refiller->heap_size) {
+    refiller->heap_size *= 2;
+    refiller->heap = (rtlim_t **)realloc(refiller->heap,
+      refiller->heap_size * sizeof(rtlim_t *));
+    NULLCHK(refiller->heap);
+  }
+  refiller->heap[refiller->num_limiters] = rtlim;
+  heap_sift_up(refiller, refiller->num_limiters++);
+  rtlim->refiller = refiller;
+  if (rtlim->refiller_index == 0) {
+    pthread_cond_signal(&refiller->cond);  /* New first refill. */
+  }
+  pthread_mutex_unlock(&refiller->mutex);
+
+  return 0;
+}  /* rtlim_refiller_add */
+
+
+/* API to stop refilling "rtlim" in the background. No thread may be
+ * taking from it. */
+void rtlim_refiller_remove(rtlim_refiller_t *refiller, rtlim_t *rtlim)
+{
+  int i;
+
+  refiller_lock(refiller);
+  i = rtlim->refiller_index;
+  refiller->num_limiters--;
+  if (i < refiller->num_limiters) {
+    /* Fill the hole with the last entry, and move that to its place. */
+    rtlim_t *moved = refiller->heap[refiller->num_limiters];
+    heap_set(refiller, i, moved);
+    heap_sift_up(refiller, i);
+    heap_sift_down(refiller, moved->refiller_index);
+  }
+  rtlim->refiller = NULL;
+  rtlim->refiller_index = -1;
+  pthread_mutex_unlock(&refiller->mutex);
+}  /* rtlim_refiller_remove */
+
+
+/* API to do the refills due by "now_ns", for a refiller without a
+ * thread (or to force one early).
+ * Returns the time of the next refill, or 0 if there are no limiters. */
+unsigned long long rtlim_refiller_run(rtlim_refiller_t *refiller,
+  unsigned long long now_ns)
+{
+  unsigned long long next_ns;
+
+  refiller_lock(refiller);
+  next_ns = run_locked(refiller, now_ns);
+  pthread_mutex_unlock(&refiller->mutex);
+
+  return next_ns;
+}  /* rtlim_refiller_run */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define RANGECHK(val_,lo_,hi_) do { \
+  double inval_ = (double)(val_); \
+  if (inval_ < (double)(lo_) || inval_ > (double)(hi_)) { \
+    fprintf(stderr, "Range check failed at %s:%d, %s=%f\n", \
+      __FILE__, __LINE__, #val_, inval_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define T0 1000000000ull
+#define NUM_LIMITERS 1000
+
+
+/* The heap is ordered and its back-pointers are right. */
+void check_heap(rtlim_refiller_t *refiller)
+{
+  int i;
+
+  for (i = 0; i < refiller->num_limiters; i++) {
+    EQUALCHK(refiller->heap[i]->refiller_index, i);
+    EQUALCHK(refiller->heap[i]->refiller, refiller);
+    if (i > 0 && DUE_NS(refiller->heap[(i - 1) / 2]) > DUE_NS(refiller->heap[i])) {
+      EQUALCHK(i, 0);  /* Fails. */
+    }
+  }
+}  /* check_heap */
+
+
+/* Many limiters, refilled by hand at chosen times. */
+void test_manual()
+{
+  static rtlim_t *limiters[NUM_LIMITERS];
+  rtlim_refiller_t *refiller;
+  rtlim_vclock_t vclock;
+  unsigned long long now_ns;
+  int i;
+
+  EQUALCHK(rtlim_refiller_create(99, -1), NULL);
+  refiller = rtlim_refiller_create(RTLIM_NON_BLOCK, -1);
+  NULLCHK(refiller);
+  EQUALCHK(rtlim_refiller_run(refiller, T0), 0);
+
+  vclock.now_ns = T0;
+  for (i = 0; i < NUM_LIMITERS; i++) {
+    /* Intervals 1000..1999 ns; "amount" is the limiter's number. */
+    limiters[i] = rtlim_create(1000 + (i * 7919) % 1000, i + 1);
+    EQUALCHK(rtlim_set_clock(limiters[i], RTLIM_CLOCK_VIRTUAL, NULL, &vclock), 0);
+    limiters[i]->current_tokens = 0;
+    EQUALCHK(rtlim_refiller_add(refiller, limiters[i]), 0);
+  }
+  EQUALCHK(rtlim_refiller_add(refiller, limiters[0]), -1);  /* Already. */
+  check_heap(refiller);
+
+  /* Nothing else may move a limiter's schedule. */
+  {
+    int cost = 1;
+    unsigned long long depart_ns;
+    vclock.now_ns = T0 + 100000;
+    EQUALCHK(rtlim_schedule(limiters[0], &cost, &depart_ns, 1), -1);
+    EQUALCHK(rtlim_set_clock(limiters[0], RTLIM_CLOCK_VIRTUAL, NULL, &vclock), -1);
+    EQUALCHK(rtlim_duty_begin(limiters[0], RTLIM_NON_BLOCK), -2);
+  }
+
+  /* Shadows aren't thread-safe: not for background-refilled limiters. */
+  {
+    rtlim_shadow_t *shadow = rtlim_shadow_create(1000, 1);
+    rtlim_t *rl = rtlim_create(1000, 1);
+    EQUALCHK(rtlim_set_shadow(limiters[0], shadow), -1);
+    EQUALCHK(limiters[0]->shadow, NULL);
+    EQUALCHK(rtlim_set_shadow(limiters[0], NULL), 0);
+    EQUALCHK(rtlim_set_shadow(rl, shadow), 0);
+    EQUALCHK(rtlim_refiller_add(refiller, rl), -1);
+    EQUALCHK(rl->refiller, NULL);
+    EQUALCHK(rtlim_set_shadow(rl, NULL), 0);
+    rtlim_delete(rl);
+    rtlim_shadow_delete(shadow);
+    EQUALCHK(limiters[0]->last_refill_ns, T0);
+    EQUALCHK(limiters[0]->current_tokens, 0);
+  }
+
+  /* Takes don't refill, even after the interval. */
+  vclock.now_ns = T0 + 5000;
+  EQUALCHK(rtlim_take(limiters[0], 1, RTLIM_NON_BLOCK), -1);
+
+  /* Before any refill is due: nothing. */
+  EQUALCHK(rtlim_refiller_run(refiller, T0 + 999), T0 + 1000);
+  EQUALCHK(refiller->refills, 0);
+
+  /* 2.5 intervals late: one refill each, on the original phase. */
+  now_ns = T0 + 5000;
+  RANGECHK(rtlim_refiller_run(refiller, now_ns), now_ns + 1, now_ns + 2000);
+  EQUALCHK(refiller->refills, NUM_LIMITERS);
+  RANGECHK(refiller->max_late_ns, 3000, 4000);
+  check_heap(refiller);
+  for (i = 0; i < NUM_LIMITERS; i++) {
+    rtlim_t *rl = limiters[i];
+    unsigned long long intervals = (now_ns - T0) / rl->refill_interval_ns;
+    EQUALCHK(rl->current_tokens, i + 1);
+    EQUALCHK(rl->last_refill_ns, T0 + intervals * rl->refill_interval_ns);
+  }
+
+  /* Takes are a decrement; the tokens don't come back by themselves. */
+  EQUALCHK(rtlim_take(limiters[9], 6, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_take(limiters[9], 6, RTLIM_NON_BLOCK), -1);
+  EQUALCHK(rtlim_take(limiters[9], 4, RTLIM_NON_BLOCK), 0);
+  EQUALCHK(rtlim_take(limiters[9], 11, RTLIM_NON_BLOCK), -2);
+  vclock.now_ns += 1000000;
+  EQUALCHK(rtlim_take(limiters[9], 1, RTLIM_NON_BLOCK), -1);
+  EQUALCHK(rtlim_refiller_run(refiller, T0 + 5000 + 2000) != 0, 1);
+  EQUALCHK(rtlim_take(limiters[9], 10, RTLIM_NON_BLOCK), 0);
+
+  /* Remove every other limiter: the rest are still refilled. */
+  for (i = 0; i < NUM_LIMITERS; i += 2) {
+    rtlim_refiller_remove(refiller, limiters[i]);
+    EQUALCHK(limiters[i]->refiller, NULL);
+  }
+  EQUALCHK(refiller->num_limiters, NUM_LIMITERS / 2);
+  check_heap(refiller);
+  for (i = 0; i < NUM_LIMITERS; i++) {
+    limiters[i]->current_tokens = 0;
+  }
+  now_ns = T0 + 100000;
+  (void)rtlim_refiller_run(refiller, now_ns);
+  for (i = 0; i < NUM_LIMITERS; i++) {
+    EQUALCHK(limiters[i]->current_tokens, (i % 2) ? i + 1 : 0);
+  }
+
+  rtlim_refiller_delete(refiller);
+  for (i = 0; i < NUM_LIMITERS; i++) {
+    EQUALCHK(limiters[i]->refiller, NULL);
+    rtlim_delete(limiters[i]);
+  }
+}  /* test_manual */
+
+
+typedef struct test_worker_s {
+  rtlim_t *rtlim;
+  pthread_t thread_id;
+  unsigned long long taken;
+  unsigned long long cpu_ns;
+} test_worker_t;
+
+void *test_worker_thread(void *arg)
+{
+  test_worker_t *worker = (test_worker_t *)arg;
+  int i;
+
+  for (i = 0; i < 50; i++) {
+    EQUALCHK(rtlim_take(worker->rtlim, 1, RTLIM_BLOCK_SLEEP), 0);
+    worker->taken++;
+  }
+
+  return NULL;
+}  /* test_worker_thread */
+
+
+/* A refiller thread, and several threads taking from one limiter. */
+void test_thread()
+{
+  rtlim_refiller_t *refiller;
+  rtlim_t *rl;
+  test_worker_t workers[4];
+  unsigned long long start_ns, elapsed_ns;
+  int t;
+
+  refiller = rtlim_refiller_create(RTLIM_BLOCK_SLEEP, -1);
+  NULLCHK(refiller);
+  rl = rtlim_create(1000000, 10);  /* 10 per ms. */
+  rl->current_tokens = 0;
+  start_ns = current_time_ns();
+  EQUALCHK(rtlim_refiller_add(refiller, rl), 0);
+
+  for (t = 0; t < 4; t++) {
+    workers[t].rtlim = rl;
+    workers[t].taken = 0;
+    EQUALCHK(pthread_create(&workers[t].thread_id, NULL, test_worker_thread, &workers[t]), 0);
+  }
+  for (t = 0; t < 4; t++) {
+    pthread_join(workers[t].thread_id, NULL);
+  }
+  elapsed_ns = current_time_ns() - start_ns;
+
+  /* 200 tokens, none at the start: at least 20 refills. */
+  RANGECHK(elapsed_ns, 19000000, 1000000000);
+  RANGECHK(refiller->refills, 20, 1000);
+  EQUALCHK(rl->refiller, refiller);
+
+  rtlim_refiller_delete(refiller);
+  EQUALCHK(rl->refiller, NULL);
+  rtlim_delete(rl);
+}  /* test_thread */
+
+
+/* The refiller thread spins, while limiters are added and removed. */
+void test_spin()
+{
+  static rtlim_t *limiters[100];
+  rtlim_refiller_t *refiller;
+  unsigned long long start_ns;
+  int i, round;
+
+  refiller = rtlim_refiller_create(RTLIM_BLOCK_SPIN, -1);
+  NULLCHK(refiller);
+  for (i = 0; i < 100; i++) {
+    limiters[i] = rtlim_create(100000 + i * 1000, 10);
+  }
+
+  start_ns = current_time_ns();
+  for (round = 0; round < 100; round++) {
+    for (i = 0; i < 100; i++) {
+      EQUALCHK(rtlim_refiller_add(refiller, limiters[i]), 0);
+    }
+    for (i = 99; i >= 0; i -= 2) {
+      rtlim_refiller_remove(refiller, limiters[i]);
+    }
+    for (i = 0; i < 100; i += 2) {
+      rtlim_refiller_remove(refiller, limiters[i]);
+    }
+  }
+  EQUALCHK(refiller->num_limiters, 0);
+  RANGECHK(current_time_ns() - start_ns, 0, 2000000000);
+
+  /* And it still refills. */
+  limiters[0]->current_tokens = 0;
+  EQUALCHK(rtlim_refiller_add(refiller, limiters[0]), 0);
+  EQUALCHK(rtlim_take(limiters[0], 25, RTLIM_BLOCK_SLEEP), 0);
+  RANGECHK(refiller->refills, 3, 1000000);
+
+  rtlim_refiller_delete(refiller);
+  for (i = 0; i < 100; i++) {
+    EQUALCHK(limiters[i]->refiller, NULL);
+    rtlim_delete(limiters[i]);
+  }
+}  /* test_spin */
+
+
+void *test_late_thread(void *arg)
+{
+  test_worker_t *worker = (test_worker_t *)arg;
+  struct timespec ts;
+
+  EQUALCHK(rtlim_take(worker->rtlim, 1, RTLIM_BLOCK_SLEEP), 0);
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  worker->cpu_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+  return NULL;
+}  /* test_late_thread */
+
+
+/* A sleeping take whose refill is overdue sleeps, rather than busy
+ * looping, until the (late) refiller gets to it. */
+void test_late()
+{
+  rtlim_refiller_t *refiller;
+  rtlim_t *rl;
+  test_worker_t worker;
+
+  refiller = rtlim_refiller_create(RTLIM_NON_BLOCK, -1);
+  NULLCHK(refiller);
+  rl = rtlim_create(1000000, 10);
+  rl->current_tokens = 0;
+  EQUALCHK(rtlim_refiller_add(refiller, rl), 0);
+
+  worker.rtlim = rl;
+  EQUALCHK(pthread_create(&worker.thread_id, NULL, test_late_thread, &worker), 0);
+  usleep(50000);  /* 49 ms overdue. */
+  (void)rtlim_refiller_run(refiller, current_time_ns());
+  pthread_join(worker.thread_id, NULL);
+
+  RANGECHK(worker.cpu_ns, 0, 25000000);
+
+  rtlim_refiller_delete(refiller);
+  rtlim_delete(rl);
+}  /* test_late */
+
+
+int main(int argc, char **argv)
+{
+  test_manual();
+  test_thread();
+  test_spin();
+  test_late();
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
@@ -0,0 +1,71 @@
+/* rtlim_refill.h - Background refill of rtlim objects (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_REFILL_H
+#define RTLIM_REFILL_H
+
+#include <pthread.h>
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Structure for "rtlim_refiller" object. App should treat it as opaque,
+ * except for the statistics.
+ * Limiters are kept in a binary min-heap ordered by next refill time. */
+typedef struct rtlim_refiller_s {
+  rtlim_t **heap;
+  int num_limiters;
+  int heap_size;                 /* Allocated entries. */
+  int block;                     /* Thread's wait; RTLIM_NON_BLOCK = none. */
+  int cpu;                       /* -1 = not pinned. */
+  volatile int stop;
+  volatile int lockers;          /* Waiting for the mutex; spinner yields. */
+  pthread_t thread_id;
+  pthread_mutex_t mutex;         /* Protects the heap. */
+  pthread_cond_t cond;           /* Signals a sleeping thread. */
+  unsigned long long refills;
+  unsigned long long max_late_ns;  /* Most a refill was behind schedule. */
+} rtlim_refiller_t;
+
+/* While a limiter belongs to a refiller, the refiller alone owns its
+ * last_refill_ns (the heap's key) and resets its current_tokens, from its
+ * own thread. So the limiter may only be taken from: rtlim_set_clock(),
+ * rtlim_schedule() and rtlim_set_shadow() (whose shadow is not
+ * thread-safe) return -1 for it, and rtlim_duty_begin() -2. Remove it
+ * from the refiller first to use them. Likewise, rtlim_refiller_add()
+ * refuses a limiter with a shadow attached. */
+
+rtlim_refiller_t *rtlim_refiller_create(int block, int cpu);
+void rtlim_refiller_delete(rtlim_refiller_t *refiller);
+int rtlim_refiller_add(rtlim_refiller_t *refiller, rtlim_t *rtlim);
+void rtlim_refiller_remove(rtlim_refiller_t *refiller, rtlim_t *rtlim);
+unsigned long long rtlim_refiller_run(rtlim_refiller_t *refiller,
+  unsigned long long now_ns);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_REFILL_H */
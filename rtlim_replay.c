@@ -0,0 +1,233 @@
+/* rtlim_replay.c - Replay a send trace through an rtlim configuration.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Reads a trace of send times and sizes (pcap or "timestamp_ns,size"
+ * text, see rtlim_sim.h) and replays it on virtual time through a limiter
+ * with the given configuration, as a single FIFO sender. The trace is
+ * streamed, and peak windows use timestamps rounded to 1/resolution of
+ * the window (see rtlim_peak_t), so memory use depends on neither its
+ * length nor its rate.
+ *
+ * Writes to stdout a CSV summary of the added delay, followed by a CSV
+ * table of the peak activity per window size, for both the original
+ * (arrival) process and the resulting departure process. With "-o", the
+ * per-message results are also written as CSV.
+ *
+ * With "-r", departures also feed a model of the downstream buffers (see
+ * rtlim_qmodel_t), and a third CSV table gives each buffer's predicted
+ * high-water mark and overflows.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "rtlim.h"
+#include "rtlim_sim.h"
+
+
+/* Command-line options. */
+static unsigned long long o_interval_ns = 1000000;
+static int o_amount = 50;
+static int o_bytes_per_token = 0;
+static char *o_out_path = NULL;
+static char *o_trace_path = NULL;
+static char *o_buffer_bytes = "131072";
+static char *o_drain_rates = NULL;
+static unsigned long long o_resolution = 1000;
+
+#define MAX_STAGES 16
+
+static unsigned long long windows_ns[] = {
+  1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000 };
+#define NUM_WINDOWS (int)(sizeof(windows_ns) / sizeof(windows_ns[0]))
+
+
+char *usage_str = "Usage: rtlim_replay [-h] [-i interval_ns] [-a amount] [-p bytes_per_token] [-o out_file] [-b buffer_bytes] [-r drain_rates] [-R resolution] trace_file";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -i interval_ns : limiter refill interval [%llu]\n"
+      "  -a amount : limiter refill token amount [%d]\n"
+      "  -p bytes_per_token : message cost is size/bytes_per_token+1 tokens\n"
+      "                       (0 = one token per message) [%d]\n"
+      "  -o out_file : write per-message results (CSV) to this file\n"
+      "  -b buffer_bytes : comma-separated downstream buffer sizes [%s]\n"
+      "  -r drain_rates : comma-separated downstream drain rates (bytes/sec),\n"
+      "                   one per buffer, first to last (default: no model)\n"
+      "  -R resolution : minimum timestamp quanta per peak window (0 = exact) [%llu]\n"
+      "  trace_file : pcap or text trace ('-' = standard input)\n"
+      , o_interval_ns, o_amount, o_bytes_per_token, o_buffer_bytes, o_resolution);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hi:a:p:o:b:r:R:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'i': o_interval_ns = strtoull(optarg, NULL, 10); break;
+      case 'a': o_amount = atoi(optarg); break;
+      case 'p': o_bytes_per_token = atoi(optarg); break;
+      case 'o': o_out_path = optarg; break;
+      case 'b': o_buffer_bytes = optarg; break;
+      case 'r': o_drain_rates = optarg; break;
+      case 'R': o_resolution = strtoull(optarg, NULL, 10); break;
+      default: usage(NULL);
+    }
+  }
+  if (o_amount < 1) usage("amount must be > 0");
+  if (o_bytes_per_token < 0) usage("bytes_per_token must be >= 0");
+  if (optind != argc - 1) usage("Need exactly one trace file");
+  o_trace_path = argv[optind];
+}  /* get_my_opts */
+
+
+int main(int argc, char **argv)
+{
+  rtlim_trace_t *trace;
+  rtlim_t *rl;
+  rtlim_replay_t *replay;
+  rtlim_peak_t *in_peak, *out_peak;
+  rtlim_qmodel_t *qmodel = NULL;
+  unsigned long long capacities[MAX_STAGES], drain_rates[MAX_STAGES];
+  FILE *out_fp = NULL;
+  unsigned long long arrival_ns, departure_ns, bytes = 0, tokens = 0;
+  unsigned long long start_real_ns, real_ns, trace_ns;
+  rtlim_hist_t *hist;
+  int size, status, w;
+
+  get_my_opts(argc, argv);
+  if (o_drain_rates != NULL) {
+    int num_stages = rtlim_parse_list(o_buffer_bytes, capacities, MAX_STAGES, "buffer_bytes");
+    if (num_stages < 0) usage(NULL);
+    if (rtlim_parse_list(o_drain_rates, drain_rates, MAX_STAGES, "drain_rate") != num_stages) {
+      usage("Need one drain rate per buffer");
+    }
+    qmodel = rtlim_qmodel_create(num_stages, capacities, drain_rates);
+  }
+
+  trace = rtlim_trace_open(o_trace_path);
+  if (trace == NULL) {
+    fprintf(stderr, "Can't open trace '%s'\n", o_trace_path);
+    exit(1);
+  }
+  if (o_out_path != NULL) {
+    out_fp = fopen(o_out_path, "w");
+    if (out_fp == NULL) {
+      fprintf(stderr, "Can't open output '%s'\n", o_out_path);
+      exit(1);
+    }
+    fprintf(out_fp, "arrival_ns,size,tokens,departure_ns,delay_ns\n");
+  }
+
+  rl = rtlim_create(o_interval_ns, o_amount);
+  replay = rtlim_replay_create(rl, o_bytes_per_token);
+  in_peak = rtlim_peak_create(NUM_WINDOWS, windows_ns, o_resolution);
+  out_peak = rtlim_peak_create(NUM_WINDOWS, windows_ns, o_resolution);
+
+  start_real_ns = current_time_ns();
+  while ((status = rtlim_trace_next(trace, &arrival_ns, &size)) == 1) {
+    int msg_tokens = rtlim_replay_tokens(replay, size);
+
+    departure_ns = rtlim_replay_msg(replay, arrival_ns, msg_tokens);
+    rtlim_peak_add(in_peak, arrival_ns, msg_tokens, size);
+    rtlim_peak_add(out_peak, departure_ns, msg_tokens, size);
+    if (qmodel != NULL) {
+      (void)rtlim_qmodel_add(qmodel, departure_ns, size);
+    }
+    bytes += size;
+    tokens += msg_tokens;
+
+    if (out_fp != NULL) {
+      fprintf(out_fp, "%llu,%d,%d,%llu,%llu\n", arrival_ns, size, msg_tokens,
+        departure_ns, departure_ns - arrival_ns);
+    }
+  }
+  if (status == -1) {
+    fprintf(stderr, "Malformed trace record %llu in '%s'\n",
+      trace->line_num, o_trace_path);
+    exit(1);
+  }
+  real_ns = current_time_ns() - start_real_ns;
+  trace_ns = replay->last_departure_ns - replay->first_arrival_ns;
+
+  hist = &replay->delay_hist;
+  printf("interval_ns,amount,bytes_per_token,messages,bytes,tokens,trace_ns,"
+    "delayed,delay_mean,delay_p50,delay_p90,delay_p99,delay_p999,delay_max\n");
+  printf("%llu,%d,%d,%llu,%llu,%llu,%llu,%llu,%.0f,%llu,%llu,%llu,%llu,%llu\n",
+    o_interval_ns, o_amount, o_bytes_per_token, replay->messages, bytes, tokens,
+    trace_ns, replay->delayed_messages,
+    (hist->count > 0) ? hist->sum / hist->count : 0.0,
+    rtlim_hist_quantile(hist, 0.5), rtlim_hist_quantile(hist, 0.9),
+    rtlim_hist_quantile(hist, 0.99), rtlim_hist_quantile(hist, 0.999),
+    hist->max);
+
+  printf("\nwindow_ns,in_max_msgs,in_max_tokens,in_max_bytes,"
+    "out_max_msgs,out_max_tokens,out_max_bytes\n");
+  for (w = 0; w < NUM_WINDOWS; w++) {
+    printf("%llu,%llu,%llu,%llu,%llu,%llu,%llu\n", in_peak->windows_ns[w],
+      in_peak->max_count[w], in_peak->max_tokens[w], in_peak->max_bytes[w],
+      out_peak->max_count[w], out_peak->max_tokens[w], out_peak->max_bytes[w]);
+  }
+
+  if (qmodel != NULL) {
+    printf("\nstage,capacity_bytes,drain_rate,messages,max_occupancy,"
+      "max_fill_pct,overflows,overflow_bytes,last_overflow_ns\n");
+    for (w = 0; w < qmodel->num_stages; w++) {
+      rtlim_qstage_t *stage = &qmodel->stages[w];
+      printf("%d,%llu,%llu,%llu,%llu,%.1f,%llu,%llu,%llu\n", w,
+        stage->capacity_bytes, stage->drain_rate, stage->messages,
+        stage->max_occupancy, 100.0 * stage->max_occupancy / stage->capacity_bytes,
+        stage->overflows, stage->overflow_bytes, stage->last_overflow_ns);
+    }
+  }
+
+  fprintf(stderr, "Replayed %llu messages in %.3f sec (%.0fx real time)\n",
+    replay->messages, real_ns / 1e9, (real_ns > 0) ? (double)trace_ns / real_ns : 0.0);
+
+  if (out_fp != NULL) {
+    fclose(out_fp);
+  }
+  rtlim_peak_delete(in_peak);
+  rtlim_peak_delete(out_peak);
+  if (qmodel != NULL) {
+    rtlim_qmodel_delete(qmodel);
+  }
+  rtlim_replay_delete(replay);
+  rtlim_delete(rl);
+  rtlim_trace_close(trace);
+
+  return 0;
+}  /* main */
@@ -0,0 +1,986 @@
+/* rtlim_sim.c - Offline evaluation of rtlim configurations.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "rtlim.h"
+#include "rtlim_sim.h"
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+
+/************************ Trace reader *************************/
+
+/* pcap magic numbers, as read little-endian. */
+#define PCAP_MAGIC_US_LE 0xa1b2c3d4
+#define PCAP_MAGIC_NS_LE 0xa1b23c4d
+#define PCAP_MAGIC_US_BE 0xd4c3b2a1
+#define PCAP_MAGIC_NS_BE 0x4d3cb2a1
+
+
+static unsigned int get_u32(unsigned char *bytes, int big_endian)
+{
+  if (big_endian) {
+    return ((unsigned int)bytes[0] << 24) | ((unsigned int)bytes[1] << 16) |
+      ((unsigned int)bytes[2] << 8) | (unsigned int)bytes[3];
+  }
+  return ((unsigned int)bytes[3] << 24) | ((unsigned int)bytes[2] << 16) |
+    ((unsigned int)bytes[1] << 8) | (unsigned int)bytes[0];
+}  /* get_u32 */
+
+
+/* API to open a trace file ("-" for standard input).
+ * Returns NULL if the file can't be opened or has a bad pcap header. */
+rtlim_trace_t *rtlim_trace_open(char *path)
+{
+  rtlim_trace_t *trace;
+  unsigned char hdr[24];
+  unsigned int magic;
+  int num_read;
+
+  trace = (rtlim_trace_t *)malloc(sizeof(rtlim_trace_t));
+  NULLCHK(trace);
+  memset(trace, 0, sizeof(*trace));
+
+  if (strcmp(path, "-") == 0) {
+    trace->fp = stdin;
+  }
+  else {
+    trace->fp = fopen(path, "rb");
+    if (trace->fp == NULL) {
+      free(trace);
+      return NULL;
+    }
+  }
+  /* Big buffer: traces are read sequentially and can be huge. */
+  (void)setvbuf(trace->fp, NULL, _IOFBF, 1024 * 1024);
+
+  num_read = (int)fread(hdr, 1, 4, trace->fp);
+  magic = (num_read == 4) ? get_u32(hdr, 0) : 0;
+  if (magic == PCAP_MAGIC_US_LE || magic == PCAP_MAGIC_NS_LE ||
+      magic == PCAP_MAGIC_US_BE || magic == PCAP_MAGIC_NS_BE) {
+    trace->format = RTLIM_TRACE_PCAP;
+    trace->big_endian = (magic == PCAP_MAGIC_US_BE || magic == PCAP_MAGIC_NS_BE);
+    trace->nanosec = (magic == PCAP_MAGIC_NS_LE || magic == PCAP_MAGIC_NS_BE);
+    if (fread(&hdr[4], 1, 20, trace->fp) != 20) {
+      rtlim_trace_close(trace);
+      return NULL;
+    }
+  }
+  else {
+    /* Text. The bytes already read are the start of the first line. */
+    trace->format = RTLIM_TRACE_CSV;
+    memcpy(trace->pending, hdr, num_read);
+    trace->num_pending = num_read;
+  }
+
+  return trace;
+}  /* rtlim_trace_open */
+
+
+/* API to close a trace. */
+void rtlim_trace_close(rtlim_trace_t *trace)
+{
+  if (trace->fp != stdin) {
+    fclose(trace->fp);
+  }
+  free(trace);
+}  /* rtlim_trace_close */
+
+
+static int trace_getc(rtlim_trace_t *trace)
+{
+  if (trace->num_pending > 0) {
+    int c = (unsigned char)trace->pending[0];
+    trace->num_pending--;
+    memmove(trace->pending, &trace->pending[1], trace->num_pending);
+    return c;
+  }
+  return getc_unlocked(trace->fp);
+}  /* trace_getc */
+
+
+/* Read one text line (without the newline). Returns its length, or -1
+ * at end of file. Overlong lines are truncated. */
+static int trace_read_line(rtlim_trace_t *trace, char *line, int max_len)
+{
+  int len = 0;
+  int c;
+
+  while ((c = trace_getc(trace)) != EOF && c != '\n') {
+    if (len < max_len - 1) {
+      line[len++] = (char)c;
+    }
+  }
+  line[len] = '\0';
+  if (c == EOF && len == 0) {
+    return -1;
+  }
+  trace->line_num++;
+
+  return len;
+}  /* trace_read_line */
+
+
+static int trace_next_csv(rtlim_trace_t *trace, unsigned long long *ts_ns, int *size)
+{
+  char line[256];
+  char *p, *end;
+
+  for (;;) {
+    if (trace_read_line(trace, line, sizeof(line)) < 0) {
+      return 0;  /* End of file. */
+    }
+    p = line;
+    while (isspace((unsigned char)*p)) p++;
+    if (*p == '\0' || *p == '#' || isalpha((unsigned char)*p)) {
+      continue;  /* Blank, comment or header. */
+    }
+
+    *ts_ns = strtoull(p, &end, 10);
+    if (end == p || *end != ',') {
+      return -1;
+    }
+    p = end + 1;
+    *size = (int)strtol(p, &end, 10);
+    if (end == p || *size < 0) {
+      return -1;
+    }
+    return 1;
+  }
+}  /* trace_next_csv */
+
+
+static int trace_next_pcap(rtlim_trace_t *trace, unsigned long long *ts_ns, int *size)
+{
+  unsigned char rec[16];
+  unsigned int ts_sec, ts_frac, incl_len, orig_len;
+  size_t num_read;
+
+  num_read = fread(rec, 1, sizeof(rec), trace->fp);
+  if (num_read == 0) {
+    return 0;  /* End of file. */
+  }
+  if (num_read != sizeof(rec)) {
+    return -1;  /* Truncated. */
+  }
+  trace->line_num++;
+
+  ts_sec = get_u32(&rec[0], trace->big_endian);
+  ts_frac = get_u32(&rec[4], trace->big_endian);
+  incl_len = get_u32(&rec[8], trace->big_endian);
+  orig_len = get_u32(&rec[12], trace->big_endian);
+
+  *ts_ns = (unsigned long long)ts_sec * 1000000000ull +
+    (trace->nanosec ? ts_frac : (unsigned long long)ts_frac * 1000);
+  *size = (int)orig_len;
+
+  /* Skip the captured data (read it if the input isn't seekable). */
+  if (fseek(trace->fp, incl_len, SEEK_CUR) != 0) {
+    char discard[4096];
+    while (incl_len > 0) {
+      size_t chunk = (incl_len < sizeof(discard)) ? incl_len : sizeof(discard);
+      if (fread(discard, 1, chunk, trace->fp) != chunk) {
+        return -1;
+      }
+      incl_len -= chunk;
+    }
+  }
+
+  return 1;
+}  /* trace_next_pcap */
+
+
+/* API to read the next record from a trace.
+ * Returns:
+ *    1 for a record (timestamp and size filled in),
+ *    0 for end of trace,
+ *   -1 for a malformed record (see trace->line_num).
+ */
+int rtlim_trace_next(rtlim_trace_t *trace, unsigned long long *ts_ns, int *size)
+{
+  if (trace->format == RTLIM_TRACE_PCAP) {
+    return trace_next_pcap(trace, ts_ns, size);
+  }
+  return trace_next_csv(trace, ts_ns, size);
+}  /* rtlim_trace_next */
+
+
+/************************ Peak per window *************************/
+
+static int ull_cmp(const void *a, const void *b)
+{
+  unsigned long long ua = *(const unsigned long long *)a;
+  unsigned long long ub = *(const unsigned long long *)b;
+
+  return (ua > ub) - (ua < ub);
+}  /* ull_cmp */
+
+
+/* API to create a peak tracker for "num_windows" window sizes (each > 0).
+ * "resolution" is the minimum number of timestamp quanta per window, or 0
+ * for exact results. */
+rtlim_peak_t *rtlim_peak_create(int num_windows, unsigned long long *windows_ns,
+  unsigned long long resolution)
+{
+  rtlim_peak_t *peak;
+  int w;
+
+  peak = (rtlim_peak_t *)malloc(sizeof(rtlim_peak_t));
+  NULLCHK(peak);
+  memset(peak, 0, sizeof(*peak));
+
+  peak->num_windows = num_windows;
+  peak->windows_ns = (unsigned long long *)malloc(num_windows * sizeof(unsigned long long));
+  NULLCHK(peak->windows_ns);
+  memcpy(peak->windows_ns, windows_ns, num_windows * sizeof(unsigned long long));
+  qsort(peak->windows_ns, num_windows, sizeof(unsigned long long), ull_cmp);
+
+  peak->quantum_ns = (unsigned long long *)calloc(num_windows, sizeof(unsigned long long));
+  NULLCHK(peak->quantum_ns);
+  peak->max_count = (unsigned long long *)calloc(num_windows, sizeof(unsigned long long));
+  NULLCHK(peak->max_count);
+  peak->max_tokens = (unsigned long long *)calloc(num_windows, sizeof(unsigned long long));
+  NULLCHK(peak->max_tokens);
+  peak->max_bytes = (unsigned long long *)calloc(num_windows, sizeof(unsigned long long));
+  NULLCHK(peak->max_bytes);
+  peak->wins = (rtlim_peak_win_t *)calloc(num_windows, sizeof(rtlim_peak_win_t));
+  NULLCHK(peak->wins);
+
+  for (w = 0; w < num_windows; w++) {
+    rtlim_peak_win_t *win = &peak->wins[w];
+
+    /* Largest power of 2 quantum with at least "resolution" per window. */
+    win->shift = 0;
+    if (resolution > 0) {
+      while ((2ull << win->shift) <= peak->windows_ns[w] / resolution) {
+        win->shift++;
+      }
+    }
+    peak->quantum_ns[w] = 1ull << win->shift;
+    win->window_q = peak->windows_ns[w] >> win->shift;
+
+    win->ring_size = 64;
+    win->ring = (rtlim_peak_entry_t *)malloc(win->ring_size * sizeof(rtlim_peak_entry_t));
+    NULLCHK(win->ring);
+  }
+
+  return peak;
+}  /* rtlim_peak_create */
+
+
+/* API to delete a peak tracker. */
+void rtlim_peak_delete(rtlim_peak_t *peak)
+{
+  int w;
+
+  for (w = 0; w < peak->num_windows; w++) {
+    free(peak->wins[w].ring);
+  }
+  free(peak->wins);
+  free(peak->windows_ns);
+  free(peak->quantum_ns);
+  free(peak->max_count);
+  free(peak->max_tokens);
+  free(peak->max_bytes);
+  free(peak);
+}  /* rtlim_peak_delete */
+
+
+/* Double a window's ring, keeping each live entry at index (seq & mask). */
+static void peak_grow(rtlim_peak_win_t *win)
+{
+  unsigned long long new_size = win->ring_size * 2;
+  rtlim_peak_entry_t *new_ring;
+  unsigned long long seq;
+
+  new_ring = (rtlim_peak_entry_t *)malloc(new_size * sizeof(rtlim_peak_entry_t));
+  NULLCHK(new_ring);
+  for (seq = win->tail_seq; seq < win->head_seq; seq++) {
+    new_ring[seq & (new_size - 1)] = win->ring[seq & (win->ring_size - 1)];
+  }
+  free(win->ring);
+  win->ring = new_ring;
+  win->ring_size = new_size;
+}  /* peak_grow */
+
+
+/* API to add an event (e.g. a departure). Timestamps must not decrease;
+ * one that does is treated as equal to the previous one. */
+void rtlim_peak_add(rtlim_peak_t *peak, unsigned long long ts_ns, int tokens, int bytes)
+{
+  unsigned long long count, cum_tokens, cum_bytes;
+  int w;
+
+  if (ts_ns < peak->last_ts_ns) {
+    ts_ns = peak->last_ts_ns;
+  }
+  peak->last_ts_ns = ts_ns;
+
+  /* Totals including this event. */
+  count = peak->count + 1;
+  cum_tokens = peak->cum_tokens + tokens;
+  cum_bytes = peak->cum_bytes + bytes;
+
+  for (w = 0; w < peak->num_windows; w++) {
+    rtlim_peak_win_t *win = &peak->wins[w];
+    unsigned long long mask = win->ring_size - 1;
+    unsigned long long qts = ts_ns >> win->shift;
+    rtlim_peak_entry_t *tail;
+
+    /* Start a new entry unless this event shares the newest one's quantum. */
+    if (win->head_seq == win->tail_seq ||
+        win->ring[(win->head_seq - 1) & mask].qts != qts) {
+      rtlim_peak_entry_t *entry;
+      if (win->head_seq - win->tail_seq == win->ring_size) {
+        peak_grow(win);
+        mask = win->ring_size - 1;
+      }
+      entry = &win->ring[win->head_seq & mask];
+      entry->qts = qts;
+      entry->cum_count = peak->count;
+      entry->cum_tokens = peak->cum_tokens;
+      entry->cum_bytes = peak->cum_bytes;
+      win->head_seq++;
+    }
+
+    /* Drop entries that are too old for a window ending now, then see if
+     * what remains is a new maximum. The newest entry always remains. */
+    tail = &win->ring[win->tail_seq & mask];
+    while (qts - tail->qts >= win->window_q) {
+      win->tail_seq++;
+      tail = &win->ring[win->tail_seq & mask];
+    }
+    if (count - tail->cum_count > peak->max_count[w]) {
+      peak->max_count[w] = count - tail->cum_count;
+    }
+    if (cum_tokens - tail->cum_tokens > peak->max_tokens[w]) {
+      peak->max_tokens[w] = cum_tokens - tail->cum_tokens;
+    }
+    if (cum_bytes - tail->cum_bytes > peak->max_bytes[w]) {
+      peak->max_bytes[w] = cum_bytes - tail->cum_bytes;
+    }
+  }
+
+  peak->count = count;
+  peak->cum_tokens = cum_tokens;
+  peak->cum_bytes = cum_bytes;
+}  /* rtlim_peak_add */
+
+
+/************************ Histogram *************************/
+
+static int hist_index(unsigned long long value)
+{
+  int msb;
+
+  if (value < (2 << RTLIM_HIST_SUB_BITS)) {
+    return (int)value;  /* Exact for small values. */
+  }
+  msb = 63 - __builtin_clzll(value);
+
+  return ((msb - RTLIM_HIST_SUB_BITS) << RTLIM_HIST_SUB_BITS) +
+    (int)(value >> (msb - RTLIM_HIST_SUB_BITS));
+}  /* hist_index */
+
+
+/* Lowest value that maps to bucket "index". */
+static unsigned long long hist_value(int index)
+{
+  int msb;
+  unsigned long long mantissa;
+
+  if (index < (2 << RTLIM_HIST_SUB_BITS)) {
+    return index;
+  }
+  msb = (index >> RTLIM_HIST_SUB_BITS) + RTLIM_HIST_SUB_BITS - 1;
+  mantissa = (index & ((1 << RTLIM_HIST_SUB_BITS) - 1)) | (1 << RTLIM_HIST_SUB_BITS);
+
+  return mantissa << (msb - RTLIM_HIST_SUB_BITS);
+}  /* hist_value */
+
+
+/* API to initialize (empty) a histogram. */
+void rtlim_hist_init(rtlim_hist_t *hist)
+{
+  memset(hist, 0, sizeof(*hist));
+}  /* rtlim_hist_init */
+
+
+/* API to add a value to a histogram. */
+void rtlim_hist_add(rtlim_hist_t *hist, unsigned long long value)
+{
+  hist->buckets[hist_index(value)]++;
+  hist->count++;
+  hist->sum += (double)value;
+  if (value > hist->max) {
+    hist->max = value;
+  }
+}  /* rtlim_hist_add */
+
+
+/* API to get the value at quantile "q" (0.0 .. 1.0). Returns the lower
+ * bound of the bucket holding it (exact below 64), or 0 if empty. */
+unsigned long long rtlim_hist_quantile(rtlim_hist_t *hist, double q)
+{
+  unsigned long long rank, seen = 0;
+  int i;
+
+  if (hist->count == 0) {
+    return 0;
+  }
+  rank = (unsigned long long)(q * hist->count + 0.999999);
+  if (rank < 1) rank = 1;
+  if (rank >= hist->count) {
+    return hist->max;
+  }
+  for (i = 0; i < RTLIM_HIST_BUCKETS; i++) {
+    seen += hist->buckets[i];
+    if (seen >= rank) {
+      return hist_value(i);
+    }
+  }
+
+  return hist->max;
+}  /* rtlim_hist_quantile */
+
+
+/************************ Replay *************************/
+
+/* API to create a replay that sends through "rtlim". */
+rtlim_replay_t *rtlim_replay_create(rtlim_t *rtlim, int bytes_per_token)
+{
+  rtlim_replay_t *replay;
+
+  replay = (rtlim_replay_t *)malloc(sizeof(rtlim_replay_t));
+  NULLCHK(replay);
+  memset(replay, 0, sizeof(*replay));
+
+  replay->rtlim = rtlim;
+  replay->bytes_per_token = bytes_per_token;
+  rtlim_hist_init(&replay->delay_hist);
+
+  return replay;
+}  /* rtlim_replay_create */
+
+
+/* API to delete a replay (not its limiter). */
+void rtlim_replay_delete(rtlim_replay_t *replay)
+{
+  free(replay);
+}  /* rtlim_replay_delete */
+
+
+/* API to get the number of tokens a message of "size" bytes costs. Uses
+ * the README's "(message_size / 1300) + 1" rule with "bytes_per_token",
+ * or 1 per message if that is 0. Every tool's token accounting goes
+ * through here. */
+int rtlim_msg_tokens(int bytes_per_token, int size)
+{
+  if (bytes_per_token == 0) {
+    return 1;
+  }
+  return size / bytes_per_token + 1;
+}  /* rtlim_msg_tokens */
+
+
+/* API to get the number of tokens a message of "size" bytes costs, with
+ * the replay's bytes per token (see rtlim_msg_tokens()). */
+int rtlim_replay_tokens(rtlim_replay_t *replay, int size)
+{
+  return rtlim_msg_tokens(replay->bytes_per_token, size);
+}  /* rtlim_replay_tokens */
+
+
+/* API to send one message that became ready at "arrival_ns".
+ * Returns its departure time. */
+unsigned long long rtlim_replay_msg(rtlim_replay_t *replay,
+  unsigned long long arrival_ns, int tokens)
+{
+  unsigned long long departure_ns;
+
+  if (! replay->started) {
+    /* Start the limiter (full) at the first arrival. */
+    replay->vclock.now_ns = arrival_ns;
+    (void)rtlim_set_clock(replay->rtlim, RTLIM_CLOCK_VIRTUAL, NULL, &replay->vclock);
+    replay->first_arrival_ns = arrival_ns;
+    replay->started = 1;
+  }
+
+  /* Sender is idle until the message arrives. */
+  if (replay->vclock.now_ns < arrival_ns) {
+    replay->vclock.now_ns = arrival_ns;
+  }
+  (void)rtlim_take(replay->rtlim, tokens, RTLIM_BLOCK_SPIN);
+  departure_ns = replay->vclock.now_ns;
+
+  rtlim_hist_add(&replay->delay_hist, departure_ns - arrival_ns);
+  if (departure_ns > arrival_ns) {
+    replay->delayed_messages++;
+  }
+  replay->messages++;
+  replay->last_departure_ns = departure_ns;
+
+  return departure_ns;
+}  /* rtlim_replay_msg */
+
+
+/************************ Queue model *************************/
+
+/* API to create a queue model with "num_stages" stages in series. */
+rtlim_qmodel_t *rtlim_qmodel_create(int num_stages,
+  unsigned long long *capacity_bytes, unsigned long long *drain_rates)
+{
+  rtlim_qmodel_t *qmodel;
+  int s;
+
+  qmodel = (rtlim_qmodel_t *)malloc(sizeof(rtlim_qmodel_t));
+  NULLCHK(qmodel);
+  memset(qmodel, 0, sizeof(*qmodel));
+
+  qmodel->num_stages = num_stages;
+  qmodel->stages = (rtlim_qstage_t *)calloc(num_stages, sizeof(rtlim_qstage_t));
+  NULLCHK(qmodel->stages);
+  for (s = 0; s < num_stages; s++) {
+    qmodel->stages[s].capacity_bytes = capacity_bytes[s];
+    qmodel->stages[s].drain_rate = drain_rates[s];
+  }
+
+  return qmodel;
+}  /* rtlim_qmodel_create */
+
+
+/* API to delete a queue model. */
+void rtlim_qmodel_delete(rtlim_qmodel_t *qmodel)
+{
+  free(qmodel->stages);
+  free(qmodel);
+}  /* rtlim_qmodel_delete */
+
+
+/* API to register a function to be called for each overflow. */
+void rtlim_qmodel_set_overflow_cb(rtlim_qmodel_t *qmodel,
+  rtlim_qmodel_cb_t overflow_cb, void *clientd)
+{
+  qmodel->overflow_cb = overflow_cb;
+  qmodel->overflow_clientd = clientd;
+}  /* rtlim_qmodel_set_overflow_cb */
+
+
+/* Bytes not yet drained from a stage at "now_ns". Exact, and can't
+ * overflow for drain rates below about 18 GB/sec. */
+static unsigned long long qstage_occupancy(rtlim_qstage_t *stage,
+  unsigned long long now_ns)
+{
+  unsigned long long backlog_ns;
+
+  if (now_ns >= stage->busy_until_ns) {
+    return 0;
+  }
+  backlog_ns = stage->busy_until_ns - now_ns;
+
+  return (backlog_ns / 1000000000) * stage->drain_rate +
+    ((backlog_ns % 1000000000) * stage->drain_rate + stage->busy_rem) / 1000000000;
+}  /* qstage_occupancy */
+
+
+/* API to get a stage's occupancy (bytes) at "now_ns". */
+unsigned long long rtlim_qmodel_occupancy(rtlim_qmodel_t *qmodel, int stage,
+  unsigned long long now_ns)
+{
+  return qstage_occupancy(&qmodel->stages[stage], now_ns);
+}  /* rtlim_qmodel_occupancy */
+
+
+/* API to feed a message of "size" bytes to the first stage at "ts_ns".
+ * Times must not decrease. Returns 0 if the model predicts it is
+ * delivered through every stage, -1 if it overflows one. */
+int rtlim_qmodel_add(rtlim_qmodel_t *qmodel, unsigned long long ts_ns, int size)
+{
+  int s;
+
+  for (s = 0; s < qmodel->num_stages; s++) {
+    rtlim_qstage_t *stage = &qmodel->stages[s];
+    unsigned long long occupancy = qstage_occupancy(stage, ts_ns);
+    unsigned long long drain_num;
+
+    if (occupancy + size > stage->capacity_bytes) {
+      stage->overflows++;
+      stage->overflow_bytes += size;
+      stage->last_overflow_ns = ts_ns;
+      if (qmodel->overflow_cb != NULL) {
+        (*qmodel->overflow_cb)(qmodel, s, ts_ns, size, qmodel->overflow_clientd);
+      }
+      return -1;
+    }
+
+    stage->messages++;
+    if (occupancy + size > stage->max_occupancy) {
+      stage->max_occupancy = occupancy + size;
+    }
+    if (ts_ns >= stage->busy_until_ns) {  /* Queue was empty. */
+      stage->busy_until_ns = ts_ns;
+      stage->busy_rem = 0;
+    }
+    /* Time to drain this message, kept exact with the remainder. */
+    drain_num = (unsigned long long)size * 1000000000 + stage->busy_rem;
+    stage->busy_until_ns += drain_num / stage->drain_rate;
+    stage->busy_rem = drain_num % stage->drain_rate;
+
+    /* Store and forward: it reaches the next stage once drained. */
+    ts_ns = stage->busy_until_ns;
+  }
+
+  return 0;
+}  /* rtlim_qmodel_add */
+
+
+/************************ Options *************************/
+
+/* API to parse a comma-separated list of positive numbers (a tool's
+ * command-line option) into "values", which has room for "max_values".
+ * "what" names the list in the error message.
+ * Returns the count, or -1 (after printing why on stderr) if the list is
+ * empty, too long, or has a value that is not a positive number. */
+int rtlim_parse_list(const char *str, unsigned long long *values,
+  int max_values, const char *what)
+{
+  const char *p = str;
+  int count = 0;
+
+  while (*p != '\0') {
+    char *end;
+    if (count == max_values) {
+      fprintf(stderr, "Too many values in %s list (max %d)\n", what, max_values);
+      return -1;
+    }
+    values[count] = strtoull(p, &end, 10);
+    if (end == p || values[count] == 0 || (*end != ',' && *end != '\0')) {
+      fprintf(stderr, "Bad %s list '%s'\n", what, str);
+      return -1;
+    }
+    count++;
+    p = (*end == ',') ? end + 1 : end;
+  }
+  if (count == 0) {
+    fprintf(stderr, "Empty %s list\n", what);
+    return -1;
+  }
+
+  return count;
+}  /* rtlim_parse_list */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+
+void put_u32_be(FILE *fp, unsigned int val)
+{
+  fputc((val >> 24) & 0xff, fp);
+  fputc((val >> 16) & 0xff, fp);
+  fputc((val >> 8) & 0xff, fp);
+  fputc(val & 0xff, fp);
+}  /* put_u32_be */
+
+
+void test_trace()
+{
+  char *csv_path = "rtlim_sim_test.csv";
+  char *pcap_path = "rtlim_sim_test.pcap";
+  rtlim_trace_t *trace;
+  unsigned long long ts_ns;
+  int size;
+  FILE *fp;
+
+  fp = fopen(csv_path, "w");
+  NULLCHK(fp);
+  fprintf(fp, "timestamp_ns,size\n# comment\n\n1000,50\n  2000,1300\n3000,0");
+  fclose(fp);
+
+  trace = rtlim_trace_open(csv_path);
+  NULLCHK(trace);
+  EQUALCHK(trace->format, RTLIM_TRACE_CSV);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 1);
+  EQUALCHK(ts_ns, 1000);  EQUALCHK(size, 50);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 1);
+  EQUALCHK(ts_ns, 2000);  EQUALCHK(size, 1300);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 1);  /* No final newline. */
+  EQUALCHK(ts_ns, 3000);  EQUALCHK(size, 0);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 0);
+  rtlim_trace_close(trace);
+
+  /* Short file (less than 4 bytes) and a malformed line. */
+  fp = fopen(csv_path, "w");
+  NULLCHK(fp);
+  fprintf(fp, "5,6\n7;8\n");
+  fclose(fp);
+  trace = rtlim_trace_open(csv_path);
+  NULLCHK(trace);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 1);
+  EQUALCHK(ts_ns, 5);  EQUALCHK(size, 6);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), -1);
+  EQUALCHK(trace->line_num, 2);
+  rtlim_trace_close(trace);
+
+  /* Big-endian nanosecond pcap with two records. */
+  fp = fopen(pcap_path, "wb");
+  NULLCHK(fp);
+  put_u32_be(fp, 0xa1b23c4d);
+  put_u32_be(fp, 0x00020004);  /* Version 2.4. */
+  put_u32_be(fp, 0);  put_u32_be(fp, 0);  put_u32_be(fp, 65535);  put_u32_be(fp, 1);
+  put_u32_be(fp, 3);  put_u32_be(fp, 500);  put_u32_be(fp, 4);  put_u32_be(fp, 1514);
+  fwrite("abcd", 1, 4, fp);
+  put_u32_be(fp, 4);  put_u32_be(fp, 7);  put_u32_be(fp, 0);  put_u32_be(fp, 60);
+  fclose(fp);
+
+  trace = rtlim_trace_open(pcap_path);
+  NULLCHK(trace);
+  EQUALCHK(trace->format, RTLIM_TRACE_PCAP);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 1);
+  EQUALCHK(ts_ns, 3000000500ull);  EQUALCHK(size, 1514);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 1);
+  EQUALCHK(ts_ns, 4000000007ull);  EQUALCHK(size, 60);
+  EQUALCHK(rtlim_trace_next(trace, &ts_ns, &size), 0);
+  rtlim_trace_close(trace);
+
+  EQUALCHK(rtlim_trace_open("rtlim_sim_test.nonexistent"), NULL);
+  remove(csv_path);
+  remove(pcap_path);
+}  /* test_trace */
+
+
+void test_peak()
+{
+  unsigned long long windows_ns[] = { 1000, 10 };
+  rtlim_peak_t *peak;
+  int i;
+
+  peak = rtlim_peak_create(2, windows_ns, 0);
+  EQUALCHK(peak->windows_ns[0], 10);  /* Sorted. */
+
+  /* 5 events 1 ns apart (window 10 sees all 5), then a gap. */
+  for (i = 0; i < 5; i++) {
+    rtlim_peak_add(peak, 100 + i, 2, 100);
+  }
+  /* Exactly 10 ns after the last: first window must not include it. */
+  rtlim_peak_add(peak, 114, 1, 1);
+  EQUALCHK(peak->max_count[0], 5);
+  EQUALCHK(peak->max_tokens[0], 10);
+  EQUALCHK(peak->max_bytes[0], 500);
+  EQUALCHK(peak->max_count[1], 6);
+  EQUALCHK(peak->max_tokens[1], 11);
+
+  /* Enough events to force the ring to grow several times. */
+  for (i = 0; i < 5000; i++) {
+    rtlim_peak_add(peak, 200 + i / 10, 1, 1);  /* 10 per ns. */
+  }
+  EQUALCHK(peak->max_count[0], 100);   /* 10 ns * 10 per ns. */
+  EQUALCHK(peak->max_count[1], 5006);  /* All within 1000 ns. */
+  rtlim_peak_delete(peak);
+
+  /* Quantized: 1 ms window, at least 16 quanta -> 32768 ns quantum, and
+   * the window is 30 quanta. One event per us for 10 ms. */
+  windows_ns[0] = 1000000;
+  peak = rtlim_peak_create(1, windows_ns, 16);
+  EQUALCHK(peak->quantum_ns[0], 32768);
+  EQUALCHK(peak->wins[0].window_q, 30);
+  for (i = 0; i < 10000; i++) {
+    rtlim_peak_add(peak, 5000000 + i * 1000, 1, 1);
+  }
+  /* Between 29 and 31 quanta's worth of events. */
+  if (peak->max_count[0] < 29 * 32768 / 1000 || peak->max_count[0] > 31 * 32768 / 1000 + 1) {
+    EQUALCHK(peak->max_count[0], 1000);  /* Fails. */
+  }
+  EQUALCHK(peak->wins[0].ring_size, 64);  /* Bounded memory. */
+  rtlim_peak_delete(peak);
+}  /* test_peak */
+
+
+void test_hist()
+{
+  rtlim_hist_t hist;
+  int i;
+
+  rtlim_hist_init(&hist);
+  EQUALCHK(rtlim_hist_quantile(&hist, 0.5), 0);
+  for (i = 1; i <= 100; i++) {
+    rtlim_hist_add(&hist, i);
+  }
+  EQUALCHK(rtlim_hist_quantile(&hist, 0.5), 50);   /* Exact below 64. */
+  EQUALCHK(rtlim_hist_quantile(&hist, 1.0), 100);  /* Max. */
+  EQUALCHK(rtlim_hist_quantile(&hist, 0.99), 98);  /* 99 is in [98,100). */
+
+  for (i = 0; i < 64; i++) {
+    unsigned long long v = 1ull << i;
+    EQUALCHK(hist_value(hist_index(v)), v);
+    EQUALCHK(hist_index(v + v / 2) < RTLIM_HIST_BUCKETS, 1);
+  }
+  EQUALCHK(hist_index(~0ull), RTLIM_HIST_BUCKETS - 1);
+}  /* test_hist */
+
+
+void test_replay()
+{
+  rtlim_t *rl;
+  rtlim_replay_t *replay;
+
+  rl = rtlim_create(1000000, 2);  /* 2 tokens per ms. */
+  replay = rtlim_replay_create(rl, 1300);
+  EQUALCHK(rtlim_replay_tokens(replay, 100), 1);
+  EQUALCHK(rtlim_replay_tokens(replay, 1300), 2);
+  EQUALCHK(rtlim_msg_tokens(0, 1300), 1);
+  EQUALCHK(rtlim_msg_tokens(1300, 2600), 3);
+
+  EQUALCHK(rtlim_replay_msg(replay, 5000000, 1), 5000000);
+  EQUALCHK(rtlim_replay_msg(replay, 5000000, 1), 5000000);
+  EQUALCHK(rtlim_replay_msg(replay, 5000000, 1), 6000000);  /* Next refill. */
+  EQUALCHK(rtlim_replay_msg(replay, 5500000, 1), 6000000);
+  EQUALCHK(rtlim_replay_msg(replay, 5600000, 3), 8000000);  /* Two refills. */
+  EQUALCHK(rtlim_replay_msg(replay, 20000000, 1), 20000000);  /* Idle. */
+
+  EQUALCHK(replay->messages, 6);
+  EQUALCHK(replay->delayed_messages, 3);
+  EQUALCHK(replay->delay_hist.max, 2400000);
+  EQUALCHK(replay->last_departure_ns, 20000000);
+
+  rtlim_replay_delete(replay);
+  rtlim_delete(rl);
+}  /* test_replay */
+
+
+static int overflow_cb_stage = -1;
+static unsigned long long overflow_cb_ts = 0;
+
+void test_overflow_cb(rtlim_qmodel_t *qmodel, int stage,
+  unsigned long long ts_ns, int size, void *clientd)
+{
+  EQUALCHK(clientd, &overflow_cb_stage);
+  overflow_cb_stage = stage;
+  overflow_cb_ts = ts_ns;
+}  /* test_overflow_cb */
+
+
+void test_qmodel()
+{
+  unsigned long long capacity[2] = {3000, 2000};
+  unsigned long long rate[2] = {1000000, 300000};  /* 1 and 0.3 bytes/us. */
+  rtlim_qmodel_t *qmodel;
+
+  /* Single stage. */
+  qmodel = rtlim_qmodel_create(1, capacity, rate);
+  rtlim_qmodel_set_overflow_cb(qmodel, test_overflow_cb, &overflow_cb_stage);
+
+  EQUALCHK(rtlim_qmodel_add(qmodel, 1000000, 1000), 0);
+  EQUALCHK(rtlim_qmodel_occupancy(qmodel, 0, 1000000), 1000);
+  EQUALCHK(rtlim_qmodel_occupancy(qmodel, 0, 1400000), 600);
+  EQUALCHK(rtlim_qmodel_add(qmodel, 1400000, 2000), 0);  /* 600+2000 fits. */
+  EQUALCHK(qmodel->stages[0].max_occupancy, 2600);
+  EQUALCHK(rtlim_qmodel_add(qmodel, 1400000, 500), -1);  /* 2600+500 doesn't. */
+  EQUALCHK(overflow_cb_stage, 0);
+  EQUALCHK(overflow_cb_ts, 1400000);
+  EQUALCHK(rtlim_qmodel_add(qmodel, 1500000, 500), 0);   /* 2500+500 does. */
+  EQUALCHK(qmodel->stages[0].busy_until_ns, 4500000);
+  EQUALCHK(rtlim_qmodel_occupancy(qmodel, 0, 4500000), 0);
+  EQUALCHK(rtlim_qmodel_occupancy(qmodel, 0, 9000000), 0);
+  EQUALCHK(qmodel->stages[0].messages, 3);
+  EQUALCHK(qmodel->stages[0].overflows, 1);
+  EQUALCHK(qmodel->stages[0].overflow_bytes, 500);
+  rtlim_qmodel_delete(qmodel);
+
+  /* Two stages, the second slower; fractional drain times. */
+  qmodel = rtlim_qmodel_create(2, capacity, rate);
+  rtlim_qmodel_set_overflow_cb(qmodel, test_overflow_cb, &overflow_cb_stage);
+  EQUALCHK(rtlim_qmodel_add(qmodel, 0, 1000), 0);
+  /* Reaches stage 1 at 1 ms; drains there in 3333333.33 ns. */
+  EQUALCHK(qmodel->stages[1].busy_until_ns, 1000000 + 3333333);
+  EQUALCHK(rtlim_qmodel_occupancy(qmodel, 1, 1000000), 1000);
+  EQUALCHK(rtlim_qmodel_add(qmodel, 0, 1000), 0);
+  /* Reaches stage 1 at 2 ms, 700 bytes still there. */
+  EQUALCHK(qmodel->stages[1].max_occupancy, 1700);
+  EQUALCHK(qmodel->stages[1].busy_until_ns, 1000000 + 6666666);
+  EQUALCHK(qmodel->stages[1].busy_rem, 200000);  /* 2/3 ns. */
+  EQUALCHK(rtlim_qmodel_add(qmodel, 0, 1000), -1);
+  EQUALCHK(overflow_cb_stage, 1);
+  EQUALCHK(overflow_cb_ts, 3000000);
+  EQUALCHK(qmodel->stages[0].overflows, 0);
+  EQUALCHK(qmodel->stages[0].messages, 3);
+  EQUALCHK(qmodel->stages[1].messages, 2);
+  rtlim_qmodel_delete(qmodel);
+}  /* test_qmodel */
+
+void test_parse_list()
+{
+  unsigned long long values[3];
+
+  EQUALCHK(rtlim_parse_list("5", values, 3, "test"), 1);
+  EQUALCHK(values[0], 5);
+  EQUALCHK(rtlim_parse_list("1,20,300", values, 3, "test"), 3);
+  EQUALCHK(values[2], 300);
+  EQUALCHK(rtlim_parse_list("1,2,3,4", values, 3, "test"), -1);
+  EQUALCHK(rtlim_parse_list("", values, 3, "test"), -1);
+  EQUALCHK(rtlim_parse_list("1,,2", values, 3, "test"), -1);
+  EQUALCHK(rtlim_parse_list("1,0", values, 3, "test"), -1);
+  EQUALCHK(rtlim_parse_list("1,x", values, 3, "test"), -1);
+  EQUALCHK(rtlim_parse_list("1,", values, 3, "test"), 1);
+}  /* test_parse_list */
+
+
+int main(int argc, char **argv)
+{
+  test_parse_list();
+  test_trace();
+  test_peak();
+  test_hist();
+  test_replay();
+  test_qmodel();
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
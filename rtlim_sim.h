@@ -0,0 +1,191 @@
+/* rtlim_sim.h - Offline evaluation of rtlim configurations (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_SIM_H
+#define RTLIM_SIM_H
+
+#include <stdio.h>
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Streaming reader for captured send traces. App should treat it as
+ * opaque. Supported formats (detected from the first bytes):
+ *   - classic pcap (microsecond or nanosecond, either byte order); the
+ *     message size is the packet's original length on the wire.
+ *   - text, one "timestamp_ns,size" per line. Blank lines, lines starting
+ *     with '#', and a header line starting with a letter are skipped.
+ */
+typedef struct rtlim_trace_s {
+  FILE *fp;
+  int format;                  /* RTLIM_TRACE_PCAP or RTLIM_TRACE_CSV. */
+  int big_endian;              /* pcap file byte order. */
+  int nanosec;                 /* pcap timestamps are ns, not us. */
+  char pending[4];             /* Bytes read while detecting the format. */
+  int num_pending;
+  unsigned long long line_num; /* CSV line (or pcap record) number. */
+} rtlim_trace_t;
+
+#define RTLIM_TRACE_PCAP 1
+#define RTLIM_TRACE_CSV  2
+
+
+/* Peak activity over sliding windows of several sizes. Each window keeps
+ * its own ring of event totals, with timestamps rounded down to a
+ * power-of-2 quantum of at most window/resolution ns; events in the same
+ * quantum share an entry. Resolution 0 means exact (1 ns quantum), with
+ * memory proportional to the events within the largest window. Otherwise
+ * memory is bounded by about 2*resolution entries per window, and each
+ * window's length is accurate to within about 2/resolution. */
+typedef struct rtlim_peak_entry_s {
+  unsigned long long qts;          /* Timestamp, in quanta. */
+  unsigned long long cum_count;    /* Totals *before* this entry. */
+  unsigned long long cum_tokens;
+  unsigned long long cum_bytes;
+} rtlim_peak_entry_t;
+
+typedef struct rtlim_peak_win_s {
+  int shift;                       /* Quantum is 2^shift ns. */
+  unsigned long long window_q;     /* Window length, in quanta. */
+  rtlim_peak_entry_t *ring;
+  unsigned long long ring_size;    /* Power of 2. */
+  unsigned long long head_seq;     /* Sequence number of next entry. */
+  unsigned long long tail_seq;     /* Oldest entry inside the window. */
+} rtlim_peak_win_t;
+
+typedef struct rtlim_peak_s {
+  int num_windows;
+  unsigned long long *windows_ns;  /* Sorted ascending. */
+  unsigned long long *quantum_ns;  /* Timestamp resolution, per window. */
+  unsigned long long *max_count;   /* Results, per window. */
+  unsigned long long *max_tokens;
+  unsigned long long *max_bytes;
+  rtlim_peak_win_t *wins;
+  unsigned long long last_ts_ns;
+  unsigned long long count;
+  unsigned long long cum_tokens;
+  unsigned long long cum_bytes;
+} rtlim_peak_t;
+
+
+/* Log-linear histogram of non-negative values (e.g. nanoseconds), within
+ * about 3% relative error, in constant memory. */
+#define RTLIM_HIST_SUB_BITS 5
+#define RTLIM_HIST_BUCKETS ((65 - RTLIM_HIST_SUB_BITS) << RTLIM_HIST_SUB_BITS)
+
+typedef struct rtlim_hist_s {
+  unsigned long long count;
+  unsigned long long max;
+  double sum;
+  unsigned long long buckets[RTLIM_HIST_BUCKETS];
+} rtlim_hist_t;
+
+
+/* A FIFO sender replaying a trace through a limiter on virtual time: a
+ * message can't depart before it arrives, nor before the previous message
+ * departs, nor before the limiter grants its tokens. The limiter belongs
+ * to the caller; the replay switches it to its own virtual clock. */
+typedef struct rtlim_replay_s {
+  rtlim_vclock_t vclock;
+  rtlim_t *rtlim;
+  int bytes_per_token;         /* 0 = one token per message. */
+  int started;
+  rtlim_hist_t delay_hist;     /* Added delay per message. */
+  unsigned long long messages;
+  unsigned long long delayed_messages;
+  unsigned long long first_arrival_ns;
+  unsigned long long last_departure_ns;
+} rtlim_replay_t;
+
+
+/* Model of the buffers downstream of the limiter (e.g. a switch port and
+ * then a receiver's socket buffer): one or more finite FIFO queues in
+ * series, each draining at a constant rate. A message enters the first
+ * stage when it departs the limiter, and enters the next stage once it
+ * has drained from the previous one. A message that doesn't fit in a
+ * stage's free space is an overflow (it is lost, as it would be there).
+ * Can be fed departure times from a replay, or from rtlim_now() after
+ * each rtlim_take() in a live application. */
+struct rtlim_qmodel_s;
+typedef void (*rtlim_qmodel_cb_t)(struct rtlim_qmodel_s *qmodel, int stage,
+  unsigned long long ts_ns, int size, void *clientd);
+
+typedef struct rtlim_qstage_s {
+  unsigned long long capacity_bytes;
+  unsigned long long drain_rate;      /* Bytes per second. */
+  unsigned long long busy_until_ns;   /* When the queue will be empty. */
+  unsigned long long busy_rem;        /* Fraction of a ns, times drain_rate. */
+  unsigned long long messages;        /* Accepted. */
+  unsigned long long overflows;
+  unsigned long long overflow_bytes;
+  unsigned long long max_occupancy;   /* Bytes, including the new message. */
+  unsigned long long last_overflow_ns;
+} rtlim_qstage_t;
+
+typedef struct rtlim_qmodel_s {
+  int num_stages;
+  rtlim_qstage_t *stages;
+  rtlim_qmodel_cb_t overflow_cb;      /* Optional, called per overflow. */
+  void *overflow_clientd;
+} rtlim_qmodel_t;
+
+
+rtlim_trace_t *rtlim_trace_open(char *path);
+int rtlim_trace_next(rtlim_trace_t *trace, unsigned long long *ts_ns, int *size);
+void rtlim_trace_close(rtlim_trace_t *trace);
+
+rtlim_peak_t *rtlim_peak_create(int num_windows, unsigned long long *windows_ns,
+  unsigned long long resolution);
+void rtlim_peak_delete(rtlim_peak_t *peak);
+void rtlim_peak_add(rtlim_peak_t *peak, unsigned long long ts_ns, int tokens, int bytes);
+
+void rtlim_hist_init(rtlim_hist_t *hist);
+void rtlim_hist_add(rtlim_hist_t *hist, unsigned long long value);
+unsigned long long rtlim_hist_quantile(rtlim_hist_t *hist, double q);
+
+rtlim_replay_t *rtlim_replay_create(rtlim_t *rtlim, int bytes_per_token);
+void rtlim_replay_delete(rtlim_replay_t *replay);
+int rtlim_msg_tokens(int bytes_per_token, int size);
+int rtlim_replay_tokens(rtlim_replay_t *replay, int size);
+unsigned long long rtlim_replay_msg(rtlim_replay_t *replay,
+  unsigned long long arrival_ns, int tokens);
+
+rtlim_qmodel_t *rtlim_qmodel_create(int num_stages,
+  unsigned long long *capacity_bytes, unsigned long long *drain_rates);
+void rtlim_qmodel_delete(rtlim_qmodel_t *qmodel);
+void rtlim_qmodel_set_overflow_cb(rtlim_qmodel_t *qmodel,
+  rtlim_qmodel_cb_t overflow_cb, void *clientd);
+int rtlim_qmodel_add(rtlim_qmodel_t *qmodel, unsigned long long ts_ns, int size);
+unsigned long long rtlim_qmodel_occupancy(rtlim_qmodel_t *qmodel, int stage,
+  unsigned long long now_ns);
+
+int rtlim_parse_list(const char *str, unsigned long long *values,
+  int max_values, const char *what);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_SIM_H */
@@ -0,0 +1,455 @@
+/* rtlim_sweep.c - Search for rtlim settings that suit a recorded trace.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* Replays a trace (see rtlim_sim.h) through many limiter configurations,
+ * each on virtual time with the unmodified rtlim_take(), in parallel on
+ * worker threads. The departures of each configuration feed a model of
+ * the downstream buffers (see rtlim_qmodel_t): queues in series, given by
+ * the "-b" capacities and "-r" drain rates, where a message that doesn't
+ * fit is counted as an overflow (lost).
+ *
+ * The configurations are either a grid (every interval with every amount),
+ * or, with "-A", for each interval a binary search for the largest amount
+ * with no overflow (fewer refills to wait for means less added delay).
+ * Note that rtlim's burst size is its refill amount, so "burst" is not a
+ * separate dimension.
+ *
+ * One line of CSV per configuration evaluated. "pareto" is 1 for the
+ * configurations with no overflow that are not beaten on both p99 added
+ * delay and peak burst (bytes departing within "-w" ns) by another such
+ * configuration. The recommended configuration (no overflow, lowest p99
+ * delay) is printed on standard error.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "rtlim.h"
+#include "rtlim_sim.h"
+
+
+/* Primitive error handling - exit on error. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+/* For pthread functions, which return an error number. */
+#define PTHCHK(status_) do { \
+  int err_ = (status_); \
+  if (err_ != 0) { \
+    fprintf(stderr, "Failure at %s:%d '%s': %s\n", \
+      __FILE__, __LINE__, #status_, strerror(err_)); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define MAX_LIST 64
+/* Enough for a binary search over any int amount. */
+#define MAX_JOB_CONFIGS 40
+
+
+/* Command-line options. */
+static char *o_intervals = "10000,100000,1000000,10000000";
+static char *o_amounts = "1,2,5,10,20,50,100,200,500,1000,2000,5000";
+static int o_adaptive = 0;
+static int o_bytes_per_token = 0;
+static char *o_buffer_bytes = "131072";
+static char *o_drain_rates = NULL;
+static unsigned long long o_burst_window_ns = 1000000;
+static int o_threads = 0;
+static unsigned long long o_resolution = 1000;
+static char *o_trace_path = NULL;
+
+
+typedef struct config_s {
+  const char *algorithm;
+  unsigned long long interval_ns;
+  int amount;
+  /* Results. */
+  unsigned long long messages;
+  unsigned long long delayed;
+  double delay_mean;
+  unsigned long long delay_p50;
+  unsigned long long delay_p99;
+  unsigned long long delay_max;
+  unsigned long long peak_tokens;   /* In the burst window. */
+  unsigned long long peak_bytes;
+  double max_fill_pct;   /* Fullest any stage got. */
+  unsigned long long overflows;
+  int pareto;
+} config_t;
+
+/* A unit of work for one thread: one grid point, or one binary search. */
+typedef struct job_s {
+  unsigned long long interval_ns;
+  int amount;          /* Grid point, or the search's upper bound. */
+  int num_configs;
+  config_t configs[MAX_JOB_CONFIGS];
+} job_t;
+
+static job_t *jobs;
+static int num_jobs;
+static int next_job;   /* Claimed with an atomic increment. */
+
+/* Downstream queue stages. */
+static unsigned long long capacities[MAX_LIST], drain_rates[MAX_LIST];
+static int num_stages;
+
+
+char *usage_str = "Usage: rtlim_sweep [-h] [-i intervals] [-a amounts] [-A] [-p bytes_per_token] [-b buffer_bytes] -r drain_rates [-w burst_window_ns] [-R resolution] [-T threads] trace_file";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -i intervals : comma-separated refill intervals (ns) [%s]\n"
+      "  -a amounts : comma-separated refill amounts [%s]\n"
+      "  -A : adaptive; per interval, binary search for the largest amount\n"
+      "       (up to the largest in '-a') with no overflow\n"
+      "  -p bytes_per_token : message cost is size/bytes_per_token+1 tokens\n"
+      "                       (0 = one token per message) [%d]\n"
+      "  -b buffer_bytes : comma-separated downstream buffer sizes [%s]\n"
+      "  -r drain_rates : comma-separated downstream drain rates (bytes/sec),\n"
+      "                   one per buffer, first to last\n"
+      "  -w burst_window_ns : window for measuring peak burst [%llu]\n"
+      "  -R resolution : minimum timestamp quanta per burst window (0 = exact) [%llu]\n"
+      "  -T threads : worker threads (0 = one per online CPU) [%d]\n"
+      "  trace_file : pcap or text trace\n"
+      , o_intervals, o_amounts, o_bytes_per_token, o_buffer_bytes,
+      o_burst_window_ns, o_resolution, o_threads);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hi:a:Ap:b:r:w:R:T:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'i': o_intervals = optarg; break;
+      case 'a': o_amounts = optarg; break;
+      case 'A': o_adaptive = 1; break;
+      case 'p': o_bytes_per_token = atoi(optarg); break;
+      case 'b': o_buffer_bytes = optarg; break;
+      case 'r': o_drain_rates = optarg; break;
+      case 'w': o_burst_window_ns = strtoull(optarg, NULL, 10); break;
+      case 'R': o_resolution = strtoull(optarg, NULL, 10); break;
+      case 'T': o_threads = atoi(optarg); break;
+      default: usage(NULL);
+    }
+  }
+  if (o_drain_rates == NULL) usage("Must supply drain rates (-r)");
+  if (o_bytes_per_token < 0) usage("bytes_per_token must be >= 0");
+  if (o_burst_window_ns == 0) usage("burst_window_ns must be > 0");
+  if (optind != argc - 1) usage("Need exactly one trace file");
+  o_trace_path = argv[optind];
+  /* Each configuration re-reads the trace. */
+  if (strcmp(o_trace_path, "-") == 0) usage("Trace can't be standard input");
+}  /* get_my_opts */
+
+
+/* Replay the whole trace through one configuration. */
+void evaluate(config_t *config)
+{
+  rtlim_trace_t *trace;
+  rtlim_t *rl;
+  rtlim_replay_t *replay;
+  rtlim_peak_t *peak;
+  rtlim_qmodel_t *qmodel;
+  unsigned long long arrival_ns, departure_ns;
+  int size, status, s;
+
+  trace = rtlim_trace_open(o_trace_path);
+  if (trace == NULL) {
+    fprintf(stderr, "Can't open trace '%s'\n", o_trace_path);
+    exit(1);
+  }
+  rl = rtlim_create(config->interval_ns, config->amount);
+  replay = rtlim_replay_create(rl, o_bytes_per_token);
+  peak = rtlim_peak_create(1, &o_burst_window_ns, o_resolution);
+  qmodel = rtlim_qmodel_create(num_stages, capacities, drain_rates);
+
+  while ((status = rtlim_trace_next(trace, &arrival_ns, &size)) == 1) {
+    int tokens = rtlim_replay_tokens(replay, size);
+
+    departure_ns = rtlim_replay_msg(replay, arrival_ns, tokens);
+    rtlim_peak_add(peak, departure_ns, tokens, size);
+    (void)rtlim_qmodel_add(qmodel, departure_ns, size);
+  }
+  if (status == -1) {
+    fprintf(stderr, "Malformed trace record %llu in '%s'\n",
+      trace->line_num, o_trace_path);
+    exit(1);
+  }
+
+  config->messages = replay->messages;
+  config->delayed = replay->delayed_messages;
+  config->delay_mean = (replay->delay_hist.count > 0) ?
+    replay->delay_hist.sum / replay->delay_hist.count : 0.0;
+  config->delay_p50 = rtlim_hist_quantile(&replay->delay_hist, 0.5);
+  config->delay_p99 = rtlim_hist_quantile(&replay->delay_hist, 0.99);
+  config->delay_max = replay->delay_hist.max;
+  config->peak_tokens = peak->max_tokens[0];
+  config->peak_bytes = peak->max_bytes[0];
+  config->max_fill_pct = 0.0;
+  config->overflows = 0;
+  for (s = 0; s < num_stages; s++) {
+    rtlim_qstage_t *stage = &qmodel->stages[s];
+    double fill_pct = 100.0 * stage->max_occupancy / stage->capacity_bytes;
+    if (fill_pct > config->max_fill_pct) config->max_fill_pct = fill_pct;
+    config->overflows += stage->overflows;
+  }
+
+  rtlim_qmodel_delete(qmodel);
+  rtlim_peak_delete(peak);
+  rtlim_replay_delete(replay);
+  rtlim_delete(rl);
+  rtlim_trace_close(trace);
+}  /* evaluate */
+
+
+/* Evaluate (interval, amount) as the job's next config. */
+config_t *job_eval(job_t *job, int amount)
+{
+  config_t *config = &job->configs[job->num_configs++];
+
+  config->algorithm = "rtlim";
+  config->interval_ns = job->interval_ns;
+  config->amount = amount;
+  evaluate(config);
+
+  return config;
+}  /* job_eval */
+
+
+void run_job(job_t *job)
+{
+  int lo, hi;
+
+  if (! o_adaptive) {
+    (void)job_eval(job, job->amount);
+    return;
+  }
+
+  /* Overflow grows with burst size, so find the largest amount in
+   * [1, job->amount] with none. */
+  hi = job->amount;
+  if (job_eval(job, hi)->overflows == 0) return;
+  lo = 1;
+  if (hi == 1 || job_eval(job, lo)->overflows > 0) return;
+  /* Invariant: lo has no overflow, hi does. */
+  while (hi - lo > 1) {
+    int mid = lo + (hi - lo) / 2;
+    if (job_eval(job, mid)->overflows == 0) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+}  /* run_job */
+
+
+void *worker_thread(void *arg)
+{
+  int j;
+
+  while ((j = __sync_fetch_and_add(&next_job, 1)) < num_jobs) {
+    run_job(&jobs[j]);
+  }
+
+  return NULL;
+}  /* worker_thread */
+
+
+int config_cmp(const void *a, const void *b)
+{
+  const config_t *ca = *(const config_t **)a;
+  const config_t *cb = *(const config_t **)b;
+
+  if (ca->interval_ns != cb->interval_ns) {
+    return (ca->interval_ns < cb->interval_ns) ? -1 : 1;
+  }
+  return (ca->amount > cb->amount) - (ca->amount < cb->amount);
+}  /* config_cmp */
+
+
+/* Orders by p99 delay, then peak burst. */
+int delay_cmp(const void *a, const void *b)
+{
+  const config_t *ca = *(const config_t **)a;
+  const config_t *cb = *(const config_t **)b;
+
+  if (ca->delay_p99 != cb->delay_p99) {
+    return (ca->delay_p99 < cb->delay_p99) ? -1 : 1;
+  }
+  if (ca->peak_bytes != cb->peak_bytes) {
+    return (ca->peak_bytes < cb->peak_bytes) ? -1 : 1;
+  }
+  return config_cmp(a, b);
+}  /* delay_cmp */
+
+
+int main(int argc, char **argv)
+{
+  unsigned long long intervals[MAX_LIST], amounts[MAX_LIST];
+  int num_intervals, num_amounts, num_configs, num_feasible;
+  unsigned long long best_peak;
+  config_t **configs, **feasible;
+  pthread_t *threads;
+  unsigned long long start_ns, end_ns;
+  int i, a, j, c, t;
+
+  get_my_opts(argc, argv);
+  num_intervals = rtlim_parse_list(o_intervals, intervals, MAX_LIST, "interval");
+  if (num_intervals < 0) usage(NULL);
+  num_amounts = rtlim_parse_list(o_amounts, amounts, MAX_LIST, "amount");
+  if (num_amounts < 0) usage(NULL);
+  num_stages = rtlim_parse_list(o_buffer_bytes, capacities, MAX_LIST, "buffer_bytes");
+  if (num_stages < 0) usage(NULL);
+  if (rtlim_parse_list(o_drain_rates, drain_rates, MAX_LIST, "drain_rate") != num_stages) {
+    usage("Need one drain rate per buffer");
+  }
+
+  if (o_adaptive) {
+    unsigned long long max_amount = 0;
+    for (a = 0; a < num_amounts; a++) {
+      if (amounts[a] > max_amount) max_amount = amounts[a];
+    }
+    num_jobs = num_intervals;
+    jobs = (job_t *)calloc(num_jobs, sizeof(job_t));
+    NULLCHK(jobs);
+    for (i = 0; i < num_intervals; i++) {
+      jobs[i].interval_ns = intervals[i];
+      jobs[i].amount = (int)max_amount;
+    }
+  } else {
+    num_jobs = num_intervals * num_amounts;
+    jobs = (job_t *)calloc(num_jobs, sizeof(job_t));
+    NULLCHK(jobs);
+    for (i = 0; i < num_intervals; i++) {
+      for (a = 0; a < num_amounts; a++) {
+        jobs[i * num_amounts + a].interval_ns = intervals[i];
+        jobs[i * num_amounts + a].amount = (int)amounts[a];
+      }
+    }
+  }
+
+  if (o_threads <= 0) {
+    o_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (o_threads < 1) o_threads = 1;
+  }
+  if (o_threads > num_jobs) o_threads = num_jobs;
+
+  start_ns = current_time_ns();
+  threads = (pthread_t *)malloc(o_threads * sizeof(pthread_t));
+  NULLCHK(threads);
+  for (t = 0; t < o_threads; t++) {
+    PTHCHK(pthread_create(&threads[t], NULL, worker_thread, NULL));
+  }
+  for (t = 0; t < o_threads; t++) {
+    pthread_join(threads[t], NULL);
+  }
+  end_ns = current_time_ns();
+
+  /* Collect results in (interval, amount) order. */
+  num_configs = 0;
+  for (j = 0; j < num_jobs; j++) {
+    num_configs += jobs[j].num_configs;
+  }
+  configs = (config_t **)malloc(num_configs * sizeof(config_t *));
+  NULLCHK(configs);
+  feasible = (config_t **)malloc(num_configs * sizeof(config_t *));
+  NULLCHK(feasible);
+  num_configs = 0;
+  num_feasible = 0;
+  for (j = 0; j < num_jobs; j++) {
+    for (c = 0; c < jobs[j].num_configs; c++) {
+      configs[num_configs++] = &jobs[j].configs[c];
+      if (jobs[j].configs[c].overflows == 0) {
+        feasible[num_feasible++] = &jobs[j].configs[c];
+      }
+    }
+  }
+  qsort(configs, num_configs, sizeof(config_t *), config_cmp);
+
+  /* Pareto frontier: walking in order of increasing delay, a config is on
+   * it if its peak burst is lower than every config before it. */
+  qsort(feasible, num_feasible, sizeof(config_t *), delay_cmp);
+  best_peak = ~0ULL;
+  for (c = 0; c < num_feasible; c++) {
+    if (feasible[c]->peak_bytes < best_peak) {
+      feasible[c]->pareto = 1;
+      best_peak = feasible[c]->peak_bytes;
+    }
+  }
+
+  printf("algorithm,interval_ns,amount,rate_per_sec,messages,delayed,"
+    "delay_mean,delay_p50,delay_p99,delay_max,peak_tokens,peak_bytes,"
+    "max_fill_pct,overflows,pareto\n");
+  for (c = 0; c < num_configs; c++) {
+    config_t *config = configs[c];
+    printf("%s,%llu,%d,%.0f,%llu,%llu,%.0f,%llu,%llu,%llu,%llu,%llu,%.1f,%llu,%d\n",
+      config->algorithm, config->interval_ns, config->amount,
+      config->amount * 1e9 / config->interval_ns, config->messages,
+      config->delayed, config->delay_mean, config->delay_p50,
+      config->delay_p99, config->delay_max, config->peak_tokens,
+      config->peak_bytes, config->max_fill_pct, config->overflows,
+      config->pareto);
+  }
+
+  fprintf(stderr, "Evaluated %d configurations on %d threads in %.3f sec\n",
+    num_configs, o_threads, (end_ns - start_ns) / 1e9);
+  if (num_feasible > 0) {
+    config_t *best = feasible[0];
+    fprintf(stderr, "Recommended: %s interval_ns=%llu amount=%d "
+      "(p99 delay %llu ns, peak burst %llu bytes per %llu ns)\n",
+      best->algorithm, best->interval_ns, best->amount, best->delay_p99,
+      best->peak_bytes, o_burst_window_ns);
+  } else {
+    fprintf(stderr, "No configuration avoided overflow\n");
+  }
+
+  free(configs);
+  free(feasible);
+  free(threads);
+  free(jobs);
+
+  return 0;
+}  /* main */
@@ -0,0 +1,252 @@
+/* rtlim_tk.c - Timekeeper thread for a shared rtlim clock.
+ * See https://github.com/UltraMessaging/rtlim for documentation.
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* A timekeeper thread keeps an rtlim_tkclock_t current, so that limiters
+ * using it (RTLIM_CLOCK_TIMEKEEPER) read the time with a single load
+ * instead of a clock_gettime() call. Useful where clock_gettime() is
+ * expensive (no usable TSC, so no vDSO fast path) and a core can be
+ * dedicated to the thread.
+ *
+ * Accuracy: the shared clock is never ahead of CLOCK_MONOTONIC, and is
+ * behind it by at most resolution_ns plus the longest time the thread goes
+ * between clock reads (max_gap_ns), plus a cache line transfer. Spinning
+ * alone on an isolated core, max_gap_ns is about one clock read; any
+ * preemption or interrupt of the thread widens it, and max_gap_ns records
+ * that. Sleeping, it is the resolution plus the wakeup latency (tens of
+ * microseconds). Since the clock is late, a limiter refills late, so the
+ * configured rate is never exceeded; messages are delayed instead.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
+#include <sched.h>
+
+#include "rtlim.h"
+#include "rtlim_tk.h"
+
+
+/* Primitive error handling - exit on error, which is rude for a
+ * library function. */
+#define NULLCHK(ptr_) do { \
+  if ((ptr_) == NULL) { \
+    fprintf(stderr, "Null pointer error at %s:%d '%s'\n", \
+      __FILE__, __LINE__, #ptr_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0);
+
+
+static void *tk_thread(void *arg)
+{
+  rtlim_tk_t *tk = (rtlim_tk_t *)arg;
+  unsigned long long prev_ns = current_time_ns();
+
+  while (! tk->stop) {
+    unsigned long long now_ns;
+
+    if (tk->block == RTLIM_BLOCK_SLEEP) {
+      struct timespec ts;
+      ts.tv_sec = tk->resolution_ns / 1000000000;
+      ts.tv_nsec = tk->resolution_ns % 1000000000;
+      (void)nanosleep(&ts, NULL);
+    }
+
+    now_ns = current_time_ns();
+    if (now_ns - prev_ns > tk->max_gap_ns) {
+      tk->max_gap_ns = now_ns - prev_ns;
+    }
+    prev_ns = now_ns;
+    /* Only store when it has moved far enough, so readers' copies of the
+     * cache line stay valid in between. */
+    if (now_ns - tk->clock.now_ns >= tk->resolution_ns) {
+      tk->clock.now_ns = now_ns;
+      tk->updates++;
+    }
+  }
+
+  return NULL;
+}  /* tk_thread */
+
+
+/* API to create a timekeeper and start its thread, pinned to "cpu"
+ * (-1 = not pinned). "block" is RTLIM_BLOCK_SPIN (dedicates a core) or
+ * RTLIM_BLOCK_SLEEP (wakes every "resolution_ns").
+ * The clock is valid on return.
+ * Returns NULL for an invalid "block", or if the thread can't be started
+ * (e.g. no such CPU). */
+rtlim_tk_t *rtlim_tk_create(unsigned long long resolution_ns, int block, int cpu)
+{
+  rtlim_tk_t *tk;
+  pthread_attr_t attr;
+  int status;
+
+  if (block != RTLIM_BLOCK_SPIN && block != RTLIM_BLOCK_SLEEP) {
+    return NULL;
+  }
+  if (block == RTLIM_BLOCK_SLEEP && resolution_ns == 0) {
+    return NULL;
+  }
+
+  /* The clock's cache line must not be shared with anything else. */
+  if (posix_memalign((void **)&tk, 64, sizeof(rtlim_tk_t)) != 0) {
+    tk = NULL;
+  }
+  NULLCHK(tk);
+  memset(tk, 0, sizeof(*tk));
+  tk->resolution_ns = resolution_ns;
+  tk->block = block;
+  tk->cpu = cpu;
+  tk->clock.now_ns = current_time_ns();
+
+  pthread_attr_init(&attr);
+  status = 0;
+  if (cpu >= 0) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(cpu, &cpu_set);
+    status = pthread_attr_setaffinity_np(&attr, sizeof(cpu_set), &cpu_set);
+  }
+  if (status == 0) {
+    status = pthread_create(&tk->thread_id, &attr, tk_thread, tk);
+  }
+  pthread_attr_destroy(&attr);
+  if (status != 0) {
+    free(tk);
+    return NULL;
+  }
+
+  return tk;
+}  /* rtlim_tk_create */
+
+
+/* API to stop a timekeeper's thread and delete it. Limiters must stop
+ * using its clock first. */
+void rtlim_tk_delete(rtlim_tk_t *tk)
+{
+  tk->stop = 1;
+  pthread_join(tk->thread_id, NULL);
+  free(tk);
+}  /* rtlim_tk_delete */
+
+
+#ifdef SELFTEST
+/************************ Test code *************************/
+
+#include <unistd.h>
+
+#define EQUALCHK(val_,chk_) do { \
+  unsigned long long inval_ = (unsigned long long)(val_); \
+  unsigned long long inchk_ = (unsigned long long)(chk_); \
+  if (inval_ != inchk_) { \
+    fprintf(stderr, "Equal check failed at %s:%d, %s=%llu, %s=%llu\n", \
+      __FILE__, __LINE__, #val_, inval_, #chk_, inchk_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+#define RANGECHK(val_,lo_,hi_) do { \
+  double inval_ = (double)(val_); \
+  if (inval_ < (double)(lo_) || inval_ > (double)(hi_)) { \
+    fprintf(stderr, "Range check failed at %s:%d, %s=%f\n", \
+      __FILE__, __LINE__, #val_, inval_); \
+    fflush(stderr); \
+    exit(1); \
+  } \
+} while (0)
+
+
+/* The shared clock never goes backwards, is never ahead of
+ * CLOCK_MONOTONIC, and keeps moving. */
+void test_clock(int block, unsigned long long resolution_ns)
+{
+  rtlim_tk_t *tk;
+  unsigned long long prev_ns, start_ns;
+  int i;
+
+  tk = rtlim_tk_create(resolution_ns, block, -1);
+  NULLCHK(tk);
+  EQUALCHK((unsigned long long)&tk->clock % 64, 0);
+
+  start_ns = prev_ns = tk->clock.now_ns;
+  for (i = 0; i < 200; i++) {
+    unsigned long long tk_ns = tk->clock.now_ns;
+    unsigned long long now_ns = current_time_ns();
+    RANGECHK(tk_ns, prev_ns, now_ns);
+    prev_ns = tk_ns;
+    usleep(100);
+  }
+  RANGECHK(prev_ns - start_ns, 1, 1000000000);
+  RANGECHK(tk->updates, 1, 1000000000000ull);
+  RANGECHK(tk->max_gap_ns, 1, 1000000000);
+
+  rtlim_tk_delete(tk);
+}  /* test_clock */
+
+
+/* A limiter on the shared clock is never faster than configured. */
+void test_limiter()
+{
+  rtlim_tk_t *tk;
+  rtlim_t *rl;
+  unsigned long long start_ns, elapsed_ns;
+  int i;
+
+  tk = rtlim_tk_create(100000, RTLIM_BLOCK_SLEEP, -1);  /* 100 us. */
+  NULLCHK(tk);
+  rl = rtlim_create(1000000, 1);  /* 1 per ms. */
+  EQUALCHK(rtlim_set_clock(rl, RTLIM_CLOCK_TIMEKEEPER, NULL, &tk->clock), 0);
+
+  start_ns = current_time_ns();
+  for (i = 0; i < 20; i++) {
+    EQUALCHK(rtlim_take(rl, 1, RTLIM_BLOCK_SLEEP), 0);
+  }
+  elapsed_ns = current_time_ns() - start_ns;
+  /* 19 refill intervals, less the clock's lag at the start. */
+  RANGECHK(elapsed_ns, 18000000, 1000000000);
+
+  rtlim_delete(rl);
+  rtlim_tk_delete(tk);
+}  /* test_limiter */
+
+
+int main(int argc, char **argv)
+{
+  EQUALCHK(rtlim_tk_create(1000, RTLIM_NON_BLOCK, -1), NULL);
+  EQUALCHK(rtlim_tk_create(0, RTLIM_BLOCK_SLEEP, -1), NULL);
+  EQUALCHK(rtlim_tk_create(1000, RTLIM_BLOCK_SPIN, CPU_SETSIZE - 1), NULL);
+
+  test_clock(RTLIM_BLOCK_SLEEP, 1000000);
+  test_clock(RTLIM_BLOCK_SPIN, 1000);
+  test_limiter();
+
+  printf("OK\n");
+
+  return 0;
+}  /* main */
+
+#endif
@@ -0,0 +1,58 @@
+/* rtlim_tk.h - Timekeeper thread for a shared rtlim clock (header file).
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+#ifndef RTLIM_TK_H
+#define RTLIM_TK_H
+
+#include <pthread.h>
+#include "rtlim.h"
+
+#if defined(__cplusplus)
+extern "C" {
+#endif /* __cplusplus */
+
+
+/* Structure for "rtlim_tk" (timekeeper) object. App should treat it as
+ * opaque, except for "clock", which is passed to rtlim_set_clock() with
+ * RTLIM_CLOCK_TIMEKEEPER, and the statistics.
+ * The timekeeper thread reads CLOCK_MONOTONIC and stores it in "clock"
+ * whenever it has advanced by at least "resolution_ns". */
+typedef struct rtlim_tk_s {
+  rtlim_tkclock_t clock;           /* Must be first (alignment). */
+  unsigned long long resolution_ns;
+  int block;                       /* RTLIM_BLOCK_SPIN or RTLIM_BLOCK_SLEEP. */
+  int cpu;                         /* -1 = not pinned. */
+  volatile int stop;
+  pthread_t thread_id;
+  unsigned long long updates;      /* Times "clock" was stored. */
+  unsigned long long max_gap_ns;   /* Longest time between clock reads. */
+} rtlim_tk_t;
+
+
+rtlim_tk_t *rtlim_tk_create(unsigned long long resolution_ns, int block, int cpu);
+void rtlim_tk_delete(rtlim_tk_t *tk);
+
+#if defined(__cplusplus)
+}
+#endif /* __cplusplus */
+
+#endif  /* RTLIM_TK_H */
@@ -5,3 +5,81 @@ gcc -Wall -DSELFTEST -o rtlim rtlim.c
 if [ $? -ne 0 ]; then exit 1; fi
 
 ./rtlim
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -c -o rtlim.o rtlim.c
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -o rtlim_sim rtlim_sim.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_sim
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -o rtlim_gen rtlim_gen.c rtlim.o -lm
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_gen
+if [ $? -ne 0 ]; then exit 1; fi
+
+# Small text trace (timestamp_ns,size) for smoke runs of the trace tools.
+awk 'BEGIN { for (i = 0; i < 200; i++) printf("%d,%d\n", i * 20000, 100 + (i % 7) * 100) }' >tst_trace.csv
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -pthread -o rtlim_sweep rtlim_sweep.c rtlim_sim.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_sweep -i 100000,1000000 -a 10,50 -r 50000000 tst_trace.csv >/dev/null
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -o rtlim_analyze rtlim_analyze.c rtlim_sim.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_analyze -i 100000 -a 10 -r 50000000 tst_trace.csv >/dev/null
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -o rtlim_replay rtlim_replay.c rtlim_sim.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_replay -i 100000 -a 10 -r 50000000 tst_trace.csv >/dev/null
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -pthread -o rtlim_tk rtlim_tk.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_tk
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -pthread -o rtlim_pcpu rtlim_pcpu.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_pcpu
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -pthread -o rtlim_refill rtlim_refill.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_refill
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -o rtlim_rate rtlim_rate.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_rate
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -DSELFTEST -pthread -o rtlim_pacer rtlim_pacer.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_pacer
+if [ $? -ne 0 ]; then exit 1; fi
+
+gcc -Wall -o rtlim_diff rtlim_diff.c rtlim.o
+if [ $? -ne 0 ]; then exit 1; fi
+
+./rtlim_diff
+if [ $? -ne 0 ]; then exit 1; fi
+
+# The harness must catch a deliberately wrong engine.
+./rtlim_diff -e mutant -n 10 >/dev/null
+if [ $? -ne 1 ]; then echo "rtlim_diff missed the mutant"; exit 1; fi
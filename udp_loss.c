@@ -0,0 +1,598 @@
+/* udp_loss.c - End-to-end UDP loopback loss harness for rtlim.
+ * Project home: https://github.com/UltraMessaging/rtlim
+ *
+ * Copyright (c) 2020 Informatica Corporation. All Rights Reserved.
+ * Permission is granted to licensees to use
+ * or alter this software for any purpose, including commercial applications,
+ * according to the terms laid out in the Software License Agreement.
+ *
+ * This source code example is provided by Informatica for educational
+ * and evaluation purposes only.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES
+ * EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF
+ * NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR
+ * PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE
+ * UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+ * BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR
+ * INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE
+ * TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF
+ * THE LIKELIHOOD OF SUCH DAMAGES.
+ */
+
+/* A sender thread sends UDP datagrams over loopback, paced by rtlim, to a
+ * receiver thread whose socket has a deliberately small SO_RCVBUF and
+ * which busy-loops for a configurable "processing" time per datagram.
+ * The receiver's capacity is therefore about 1e9/proc_ns datagrams per
+ * second, and a burst larger than the socket buffer can absorb is lost.
+ *
+ * Drops are taken from the kernel two ways: the SO_RXQ_OVFL control message
+ * (cumulative drop count for the socket, delivered with each datagram) and
+ * the "drops" column of /proc/net/udp. Sender CPU is the sender thread's
+ * CPU time over the send phase, as a percentage of elapsed time.
+ *
+ * One line of CSV per configuration. The "unlimited" line (interval 0) is
+ * a baseline with no rate limiting.
+ *
+ * With "-T", the sender also asks the kernel for a software transmit
+ * timestamp of each datagram (SO_TIMESTAMPING, read back from the socket's
+ * error queue) and splits each datagram's path into three stages:
+ *   - limiter: when the tokens were due, to when rtlim_take() granted them
+ *     (wakeup lateness),
+ *   - app: grant to the sendto() call,
+ *   - kernel: sendto() call to the transmit timestamp.
+ * It reports the lag added by each stage, the actual spacing of departures,
+ * and the most datagrams that left each stage within one ideal gap
+ * (interval / amount). The stage that adds most to that peak is named as
+ * the cause of bursts.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "rtlim.h"
+#include "bench_util.h"
+
+
+/* Command-line options. */
+static int o_duration_ms = 500;
+static int o_proc_ns = 5000;
+static int o_rcvbuf = 65536;
+static int o_msg_size = 1000;
+static int o_sender_cpu = -1;
+static int o_receiver_cpu = -1;
+static int o_tx_stamps = 0;
+static char *o_tag = "dev";
+
+/* Most datagrams per configuration analyzed with "-T". */
+#define MAX_STAMPS 1000000
+
+
+char *usage_str = "Usage: udp_loss [-h] [-d duration_ms] [-p proc_ns] [-r rcvbuf] [-m msg_size] [-S sender_cpu] [-R receiver_cpu] [-T] [-t tag]";
+
+void usage(char *msg) {
+  if (msg) fprintf(stderr, "%s\n", msg);
+  fprintf(stderr, "%s\n", usage_str);
+  exit(1);
+}
+
+void help() {
+  fprintf(stderr, "%s\n", usage_str);
+  fprintf(stderr, "where:\n"
+      "  -h : print help\n"
+      "  -d duration_ms : send time per configuration [%d]\n"
+      "  -p proc_ns : receiver's artificial processing time per datagram [%d]\n"
+      "  -r rcvbuf : receiver SO_RCVBUF (kernel doubles it) [%d]\n"
+      "  -m msg_size : datagram payload size [%d]\n"
+      "  -S sender_cpu : CPU to pin the sender to (-1 = no pinning) [%d]\n"
+      "  -R receiver_cpu : CPU to pin the receiver to (-1 = no pinning) [%d]\n"
+      "  -T : kernel transmit timestamps; analyze up to %d datagrams per\n"
+      "       configuration\n"
+      "  -t tag : label written to every output line (e.g. a version) [%s]\n"
+      , o_duration_ms, o_proc_ns, o_rcvbuf, o_msg_size, o_sender_cpu,
+      o_receiver_cpu, MAX_STAMPS, o_tag);
+  exit(0);
+}
+
+
+void get_my_opts(int argc, char **argv)
+{
+  int opt;
+
+  while ((opt = getopt(argc, argv, "hd:p:r:m:S:R:Tt:")) != EOF) {
+    switch (opt) {
+      case 'h': help(); break;
+      case 'd': o_duration_ms = atoi(optarg); break;
+      case 'p': o_proc_ns = atoi(optarg); break;
+      case 'r': o_rcvbuf = atoi(optarg); break;
+      case 'm': o_msg_size = atoi(optarg); break;
+      case 'S': o_sender_cpu = atoi(optarg); break;
+      case 'R': o_receiver_cpu = atoi(optarg); break;
+      case 'T': o_tx_stamps = 1; break;
+      case 't': o_tag = optarg; break;
+      default: usage(NULL);
+    }
+  }
+  if (o_duration_ms < 1) usage("duration must be > 0");
+  if (o_proc_ns < 0) usage("proc_ns must be >= 0");
+  if (o_msg_size < 1 || o_msg_size > 65000) usage("msg_size must be 1..65000");
+  if (optind != argc) usage("Extra parameter(s)");
+}  /* get_my_opts */
+
+
+/* Receiver state for one run. */
+typedef struct receiver_s {
+  int sock;
+  unsigned short port;
+  pthread_t thread_id;
+  volatile int stop;
+  unsigned long long delivered;
+  unsigned int rxq_ovfl;  /* Last SO_RXQ_OVFL value seen. */
+} receiver_t;
+
+
+void *receiver_thread(void *arg)
+{
+  receiver_t *rcv = (receiver_t *)arg;
+  char *buf;
+  char cbuf[CMSG_SPACE(sizeof(unsigned int))];
+
+  (void)bench_pin_cpu(o_receiver_cpu);
+  buf = (char *)malloc(65536);
+  NULLCHK(buf);
+
+  for (;;) {
+    struct msghdr msg;
+    struct iovec iov;
+    struct cmsghdr *cmsg;
+    ssize_t len;
+
+    iov.iov_base = buf;
+    iov.iov_len = 65536;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+
+    len = recvmsg(rcv->sock, &msg, 0);
+    if (len < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        /* Receive timeout: done once the sender has finished. */
+        if (rcv->stop) break;
+        continue;
+      }
+      FAILCHK((int)len);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+        memcpy(&rcv->rxq_ovfl, CMSG_DATA(cmsg), sizeof(unsigned int));
+      }
+    }
+    rcv->delivered++;
+    bench_spin_ns(o_proc_ns);
+  }
+
+  free(buf);
+  return NULL;
+}  /* receiver_thread */
+
+
+void receiver_start(receiver_t *rcv)
+{
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  struct timeval tv;
+  int one = 1;
+
+  memset(rcv, 0, sizeof(*rcv));
+  rcv->sock = socket(AF_INET, SOCK_DGRAM, 0);
+  FAILCHK(rcv->sock);
+  FAILCHK(setsockopt(rcv->sock, SOL_SOCKET, SO_RCVBUF, &o_rcvbuf, sizeof(o_rcvbuf)));
+  FAILCHK(setsockopt(rcv->sock, SOL_SOCKET, SO_RXQ_OVFL, &one, sizeof(one)));
+  tv.tv_sec = 0;
+  tv.tv_usec = 100000;  /* 100 ms */
+  FAILCHK(setsockopt(rcv->sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)));
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  addr.sin_port = 0;  /* Ephemeral. */
+  FAILCHK(bind(rcv->sock, (struct sockaddr *)&addr, sizeof(addr)));
+  FAILCHK(getsockname(rcv->sock, (struct sockaddr *)&addr, &addr_len));
+  rcv->port = ntohs(addr.sin_port);
+
+  if (pthread_create(&rcv->thread_id, NULL, receiver_thread, rcv) != 0) {
+    fprintf(stderr, "pthread_create failed\n");
+    exit(1);
+  }
+}  /* receiver_start */
+
+
+/* Drops for the loopback socket bound to "port", from /proc/net/udp,
+ * or -1 if not found. */
+long long proc_udp_drops(unsigned short port)
+{
+  FILE *fp;
+  char line[512];
+  char local[32];
+  long long drops = -1;
+
+  fp = fopen("/proc/net/udp", "r");
+  if (fp == NULL) {
+    return -1;
+  }
+  snprintf(local, sizeof(local), "0100007F:%04X", port);
+  while (fgets(line, sizeof(line), fp) != NULL) {
+    if (strstr(line, local) != NULL) {
+      /* The drops count is the last column (lines are space padded). */
+      char *end = line + strlen(line);
+      char *last;
+      while (end > line && (end[-1] == ' ' || end[-1] == '\n')) {
+        *--end = '\0';
+      }
+      last = strrchr(line, ' ');
+      if (last != NULL) {
+        drops = atoll(last + 1);
+      }
+      break;
+    }
+  }
+  fclose(fp);
+
+  return drops;
+}  /* proc_udp_drops */
+
+
+/* Per-datagram times for "-T", CLOCK_MONOTONIC ns, indexed by send order. */
+typedef struct stamps_s {
+  unsigned long long *due_ns;     /* Tokens due (limiter's ideal schedule). */
+  unsigned long long *grant_ns;   /* rtlim_take() granted them. */
+  unsigned long long *send_ns;    /* sendto() called. */
+  unsigned long long *kernel_ns;  /* Kernel transmit timestamp (0 = none). */
+  long long realtime_offset_ns;   /* CLOCK_REALTIME - CLOCK_MONOTONIC. */
+  int num_kernel;
+} stamps_t;
+
+
+void stamps_init(stamps_t *stamps)
+{
+  struct timespec rt;
+  unsigned long long before_ns, after_ns;
+
+  stamps->due_ns = (unsigned long long *)malloc(MAX_STAMPS * sizeof(unsigned long long));
+  NULLCHK(stamps->due_ns);
+  stamps->grant_ns = (unsigned long long *)malloc(MAX_STAMPS * sizeof(unsigned long long));
+  NULLCHK(stamps->grant_ns);
+  stamps->send_ns = (unsigned long long *)malloc(MAX_STAMPS * sizeof(unsigned long long));
+  NULLCHK(stamps->send_ns);
+  stamps->kernel_ns = (unsigned long long *)calloc(MAX_STAMPS, sizeof(unsigned long long));
+  NULLCHK(stamps->kernel_ns);
+  stamps->num_kernel = 0;
+
+  /* Kernel timestamps are CLOCK_REALTIME; map them to CLOCK_MONOTONIC. */
+  before_ns = current_time_ns();
+  FAILCHK(clock_gettime(CLOCK_REALTIME, &rt));
+  after_ns = current_time_ns();
+  stamps->realtime_offset_ns = (long long)rt.tv_sec * 1000000000 + rt.tv_nsec -
+    (long long)(before_ns + (after_ns - before_ns) / 2);
+}  /* stamps_init */
+
+
+void stamps_free(stamps_t *stamps)
+{
+  free(stamps->due_ns);
+  free(stamps->grant_ns);
+  free(stamps->send_ns);
+  free(stamps->kernel_ns);
+}  /* stamps_free */
+
+
+/* Have the kernel timestamp each datagram sent on "sock" as it is handed
+ * to the device, with the send's sequence number (counting from 0). */
+void stamps_enable(int sock)
+{
+  int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+  FAILCHK(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)));
+}  /* stamps_enable */
+
+
+/* Read the transmit timestamps waiting on "sock"'s error queue, without
+ * blocking. The queue is bounded by the socket's buffer, so this is
+ * called after every send; late readers lose timestamps. */
+void stamps_drain(int sock, stamps_t *stamps)
+{
+  char cbuf[512];
+
+  for (;;) {
+    struct msghdr msg;
+    struct cmsghdr *cmsg;
+    unsigned long long ts_ns = 0;
+    unsigned int id = 0;
+    int have_id = 0;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = cbuf;
+    msg.msg_controllen = sizeof(cbuf);
+    if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+      FAILCHK(-1);
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_TIMESTAMPING) {
+        struct scm_timestamping tss;
+        memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+        ts_ns = (unsigned long long)tss.ts[0].tv_sec * 1000000000 + tss.ts[0].tv_nsec;
+      }
+      else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+        struct sock_extended_err serr;
+        memcpy(&serr, CMSG_DATA(cmsg), sizeof(serr));
+        if (serr.ee_errno == ENOMSG && serr.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+          id = serr.ee_data;
+          have_id = 1;
+        }
+      }
+    }
+    if (have_id && ts_ns != 0 && id < MAX_STAMPS && stamps->kernel_ns[id] == 0) {
+      stamps->kernel_ns[id] = ts_ns - stamps->realtime_offset_ns;
+      stamps->num_kernel++;
+    }
+  }
+}  /* stamps_drain */
+
+
+/* Most of the (sorted) times "ts_ns" that fall within any "window_ns". */
+int peak_in_window(double *ts_ns, int count, double window_ns)
+{
+  int i, j = 0, peak = 0;
+
+  for (i = 0; i < count; i++) {
+    while (ts_ns[i] - ts_ns[j] >= window_ns) j++;
+    if (i - j + 1 > peak) peak = i - j + 1;
+  }
+
+  return peak;
+}  /* peak_in_window */
+
+
+/* Print the "-T" columns for the first "count" datagrams sent, whose ideal
+ * spacing is "gap_ns". */
+void stamps_print(stamps_t *stamps, int count, double gap_ns, int limited)
+{
+  static char *stages[] = { "limiter", "app", "kernel" };
+  bench_stats_t limiter_stats, app_stats, kernel_stats, gap_stats;
+  double *limiter_lag, *app_lag, *kernel_lag, *times;
+  int num_kernel = 0, peaks[3], i, first, cause = -1, most = 0;
+  unsigned long long prev_ns = 0;
+
+  limiter_lag = (double *)malloc(count * sizeof(double));
+  NULLCHK(limiter_lag);
+  app_lag = (double *)malloc(count * sizeof(double));
+  NULLCHK(app_lag);
+  kernel_lag = (double *)malloc(count * sizeof(double));
+  NULLCHK(kernel_lag);
+  times = (double *)malloc(count * sizeof(double));
+  NULLCHK(times);
+
+  for (i = 0; i < count; i++) {
+    limiter_lag[i] = (double)(stamps->grant_ns[i] - stamps->due_ns[i]);
+    app_lag[i] = (double)(stamps->send_ns[i] - stamps->grant_ns[i]);
+    if (stamps->kernel_ns[i] != 0) {
+      kernel_lag[num_kernel++] = (double)stamps->kernel_ns[i] - (double)stamps->send_ns[i];
+    }
+  }
+  bench_stats_calc(&limiter_stats, limiter_lag, count);
+  bench_stats_calc(&app_stats, app_lag, count);
+  bench_stats_calc(&kernel_stats, kernel_lag, num_kernel);
+
+  /* Peaks at the output of each stage, in order of departure. */
+  for (i = 0; i < count; i++) times[i] = (double)stamps->grant_ns[i];
+  peaks[0] = peak_in_window(times, count, gap_ns);
+  for (i = 0; i < count; i++) times[i] = (double)stamps->send_ns[i];
+  peaks[1] = peak_in_window(times, count, gap_ns);
+  num_kernel = 0;
+  for (i = 0; i < count; i++) {
+    if (stamps->kernel_ns[i] != 0) {
+      if (num_kernel > 0) {
+        /* Departure gaps, kept apart from "times" (reused below). */
+        kernel_lag[num_kernel - 1] = (double)(stamps->kernel_ns[i] - prev_ns);
+      }
+      times[num_kernel++] = (double)stamps->kernel_ns[i];
+      prev_ns = stamps->kernel_ns[i];
+    }
+  }
+  bench_stats_calc(&gap_stats, kernel_lag, (num_kernel > 0) ? num_kernel - 1 : 0);
+  peaks[2] = peak_in_window(times, num_kernel, gap_ns);
+
+  /* Each stage's increase over its input (one datagram per gap, ideally).
+   * Without a limiter, the app is the first stage. */
+  first = limited ? 0 : 1;
+  for (i = first; i < 3; i++) {
+    int added = peaks[i] - ((i == first) ? 1 : peaks[i - 1]);
+    if (added > most) {
+      most = added;
+      cause = i;
+    }
+  }
+
+  printf(",%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%d,%d,%d,%s",
+    num_kernel, limiter_stats.p50, limiter_stats.p99, app_stats.p50,
+    app_stats.p99, kernel_stats.p50, kernel_stats.p99, kernel_stats.max,
+    gap_ns, (gap_stats.count > 0) ? bench_quantile(kernel_lag, gap_stats.count, 0.01) : 0.0,
+    gap_stats.p50,
+    peaks[0], peaks[1], peaks[2], (cause < 0) ? "none" : stages[cause]);
+
+  free(limiter_lag);
+  free(app_lag);
+  free(kernel_lag);
+  free(times);
+}  /* stamps_print */
+
+
+/* Send for the configured duration. refill_interval_ns of 0 means no
+ * rate limiting. */
+void run_config(unsigned long long refill_interval_ns, int refill_token_amount,
+  int block)
+{
+  receiver_t rcv;
+  rtlim_t *rl = NULL;
+  struct sockaddr_in dest;
+  char *buf;
+  int sock;
+  unsigned long long sent = 0;
+  unsigned long long start_ns, end_ns, cpu_start_ns, cpu_end_ns;
+  long long proc_drops;
+  double cfg_rate = 0.0;
+  stamps_t stamps;
+
+  receiver_start(&rcv);
+
+  sock = socket(AF_INET, SOCK_DGRAM, 0);
+  FAILCHK(sock);
+  memset(&dest, 0, sizeof(dest));
+  dest.sin_family = AF_INET;
+  dest.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  dest.sin_port = htons(rcv.port);
+  buf = (char *)calloc(1, o_msg_size);
+  NULLCHK(buf);
+
+  if (refill_interval_ns > 0) {
+    rl = rtlim_create(refill_interval_ns, refill_token_amount);
+    cfg_rate = (double)refill_token_amount * 1e9 / refill_interval_ns;
+  }
+
+  if (o_tx_stamps) {
+    stamps_init(&stamps);
+    stamps_enable(sock);
+  }
+
+  start_ns = current_time_ns();
+  cpu_start_ns = bench_thread_cpu_ns();
+  end_ns = start_ns + (unsigned long long)o_duration_ms * 1000000;
+  while (current_time_ns() < end_ns) {
+    if (o_tx_stamps && sent < MAX_STAMPS) {
+      /* Same as below, but noting when each stage let the datagram go. */
+      unsigned long long take_ns = current_time_ns();
+      unsigned long long due_ns = take_ns;
+      if (rl != NULL) {
+        unsigned long long prev_refill_ns = rl->last_refill_ns;
+        rtlim_take(rl, 1, block);
+        if (rl->last_refill_ns != prev_refill_ns &&
+          prev_refill_ns + refill_interval_ns > take_ns)
+        {
+          due_ns = prev_refill_ns + refill_interval_ns;  /* Waited. */
+        }
+        stamps.grant_ns[sent] = rl->cur_ns;
+      }
+      else {
+        stamps.grant_ns[sent] = take_ns;
+      }
+      stamps.due_ns[sent] = due_ns;
+      stamps.send_ns[sent] = current_time_ns();
+      if (sendto(sock, buf, o_msg_size, 0, (struct sockaddr *)&dest, sizeof(dest)) == o_msg_size) {
+        sent++;
+      }
+      stamps_drain(sock, &stamps);
+      continue;
+    }
+    if (rl != NULL) {
+      rtlim_take(rl, 1, block);
+    }
+    if (sendto(sock, buf, o_msg_size, 0, (struct sockaddr *)&dest, sizeof(dest)) == o_msg_size) {
+      sent++;
+    }
+  }
+  cpu_end_ns = bench_thread_cpu_ns();
+  end_ns = current_time_ns();
+
+  if (o_tx_stamps) {
+    /* Collect stragglers. */
+    unsigned long long wait_end_ns = current_time_ns() + 100000000;
+    int count = (sent < MAX_STAMPS) ? (int)sent : MAX_STAMPS;
+    while (stamps.num_kernel < count && current_time_ns() < wait_end_ns) {
+      stamps_drain(sock, &stamps);
+    }
+  }
+
+  rcv.stop = 1;
+  pthread_join(rcv.thread_id, NULL);
+  proc_drops = proc_udp_drops(rcv.port);
+
+  printf("%s,%llu,%d,%s,%.0f,%d,%d,%llu,%llu,%.0f,%.0f,%u,%lld,%.1f",
+    o_tag, refill_interval_ns, refill_token_amount,
+    (rl == NULL) ? "-" : ((block == RTLIM_BLOCK_SPIN) ? "spin" : "sleep"),
+    cfg_rate, o_proc_ns, o_rcvbuf, sent, rcv.delivered,
+    (double)sent * 1e9 / (end_ns - start_ns),
+    (double)rcv.delivered * 1e9 / (end_ns - start_ns),
+    rcv.rxq_ovfl, proc_drops,
+    (double)(cpu_end_ns - cpu_start_ns) * 100.0 / (end_ns - start_ns));
+  if (o_tx_stamps) {
+    int count = (sent < MAX_STAMPS) ? (int)sent : MAX_STAMPS;
+    /* Ideal gap; the unlimited baseline uses its achieved mean gap. */
+    double gap_ns = (rl != NULL) ? (double)refill_interval_ns / refill_token_amount :
+      (double)(end_ns - start_ns) / (sent + 1);
+    stamps_print(&stamps, count, gap_ns, rl != NULL);
+    stamps_free(&stamps);
+  }
+  printf("\n");
+  fflush(stdout);
+
+  if (rl != NULL) {
+    rtlim_delete(rl);
+  }
+  free(buf);
+  close(sock);
+  close(rcv.sock);
+}  /* run_config */
+
+
+int main(int argc, char **argv)
+{
+  /* Rates as fractions of the receiver's capacity, each at a fine and a
+   * coarse granularity (refill intervals of 100 us and 10 ms). */
+  static double capacity_fracs[] = { 0.25, 0.5, 0.8, 1.2 };
+  static unsigned long long intervals_ns[] = { 100000, 10000000 };
+  double capacity;
+  int f, i;
+
+  get_my_opts(argc, argv);
+  (void)bench_pin_cpu(o_sender_cpu);
+
+  capacity = (o_proc_ns > 0) ? 1e9 / o_proc_ns : 1e6;
+
+  printf("tag,interval_ns,amount,block,cfg_rate,proc_ns,rcvbuf,sent,delivered,"
+    "send_rate,delivered_rate,rxq_ovfl_drops,proc_drops,sender_cpu_pct");
+  if (o_tx_stamps) {
+    printf(",tx_stamps,limiter_lag_p50,limiter_lag_p99,app_lag_p50,app_lag_p99,"
+      "kernel_lag_p50,kernel_lag_p99,kernel_lag_max,ideal_gap_ns,tx_gap_p1,"
+      "tx_gap_p50,limiter_peak,app_peak,kernel_peak,burst_cause");
+  }
+  printf("\n");
+
+  run_config(0, 0, 0);
+  for (f = 0; f < sizeof(capacity_fracs) / sizeof(capacity_fracs[0]); f++) {
+    for (i = 0; i < sizeof(intervals_ns) / sizeof(intervals_ns[0]); i++) {
+      int amount = (int)(capacity * capacity_fracs[f] * intervals_ns[i] / 1e9 + 0.5);
+      if (amount < 1) amount = 1;
+      run_config(intervals_ns[i], amount, RTLIM_BLOCK_SPIN);
+      run_config(intervals_ns[i], amount, RTLIM_BLOCK_SLEEP);
+    }
+  }
+
+  return 0;
+}  /* main */